@@ -3,7 +3,6 @@
 flat layout(location = 0) in vec3 fragColor;
 flat layout(location = 1) in vec3 fragNormalWorld;
 layout(location = 2) in vec3 fragPosWorld;
-layout(location = 3) in vec2 fragUV;
 
 layout(location = 0) out vec4 outColor;
 
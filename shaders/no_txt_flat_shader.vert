@@ -3,12 +3,10 @@
 layout(location = 0) in vec3 position;
 layout(location = 1) in vec3 color;
 layout(location = 2) in vec3 normal;
-layout(location = 3) in vec2 uv;
 	
 flat layout(location = 0) out vec3 fragColor;
 flat layout(location = 1) out vec3 fragNormalWorld;
 layout(location = 2) out vec3 fragPosWorld;
-layout(location = 3) out vec2 fragUV;
 
 struct PointLight{
 	vec4 position; // ignore w 
@@ -32,12 +30,24 @@ layout(push_constant) uniform Push{
 	mat4 normalMatrix;
 } push;
 
+// set for models using VcuModel::PackedVertex
+layout(constant_id = 0) const bool PACKED_VERTEX = false;
+
+// packed positions are decoded through the model matrix, normals are octahedral encoded
+vec3 decodeNormal(vec3 n) {
+	if (!PACKED_VERTEX) return n;
+	vec3 v = vec3(n.xy, 1.0 - abs(n.x) - abs(n.y));
+	float t = max(-v.z, 0.0);
+	v.x += v.x >= 0.0 ? -t : t;
+	v.y += v.y >= 0.0 ? -t : t;
+	return normalize(v);
+}
+
 
 void main() {
 	vec4 positionWorld = push.modelMatrix * vec4(position, 1.0);
 	gl_Position = ubo.projection * ubo.view * positionWorld;
-	fragNormalWorld = normalize(mat3(push.normalMatrix) * normal);
+	fragNormalWorld = normalize(mat3(push.normalMatrix) * decodeNormal(normal));
 	fragPosWorld = positionWorld.xyz;
 	fragColor = color;
-	fragUV = uv;
 }
\ No newline at end of file
@@ -2,7 +2,6 @@
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec3 fragPositionWorld;
-layout(location = 2) in vec2 fragUV;
 
 layout(location = 0) out vec4 outColor;
 
@@ -0,0 +1,86 @@
+#version 450
+#extension GL_EXT_buffer_reference : require
+
+// simple_shader.vert without vertex input, the vertex is read from the pool vertex buffer through
+// its address. One pipeline draws both vertex formats.
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec3 fragPosWorld;
+layout(location = 2) out vec3 fragNormalWorld;
+layout(location = 3) out vec2 fragUV;
+
+struct PointLight{
+	vec4 position; // ignore w 
+	vec4 color; // w - intensity
+};
+
+layout(set = 0, binding = 0) uniform GlobalUbo{
+	mat4 projection;
+	mat4 view;
+	mat4 invView;
+	vec4 ambientLightColor; // w - intensity
+	PointLight pointLights[10];
+	int numLights;
+	bool fogEnabled;
+	vec2 movingLightIndices;
+	vec3 movingLightDirection;
+} ubo;
+
+// VcuModel::StandardVertexLayout is 11 floats per vertex, VcuModel::PackedVertex 5 words
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer VertexWords {
+	uint words[];
+};
+
+// the push constants of simple_shader.vert, written into the uniform ring per object
+layout(buffer_reference, std430, buffer_reference_align = 16) readonly buffer ObjectData {
+	mat4 modelMatrix;
+	mat4 normalMatrix;
+};
+
+layout(push_constant) uniform Push{
+	VertexWords vertices;
+	ObjectData object;
+	uint packedVertex;
+} push;
+
+vec3 readVec3(uint word) {
+	return vec3(uintBitsToFloat(push.vertices.words[word]), uintBitsToFloat(push.vertices.words[word + 1]),
+		uintBitsToFloat(push.vertices.words[word + 2]));
+}
+
+// packed normals are octahedral encoded
+vec3 decodeNormal(vec2 n) {
+	vec3 v = vec3(n.xy, 1.0 - abs(n.x) - abs(n.y));
+	float t = max(-v.z, 0.0);
+	v.x += v.x >= 0.0 ? -t : t;
+	v.y += v.y >= 0.0 ? -t : t;
+	return normalize(v);
+}
+
+void main() {
+	vec3 position;
+	vec3 color;
+	vec3 normal;
+	vec2 uv;
+	if (push.packedVertex != 0) {
+		// positions are decoded through the model matrix, uvs with the offset and scale in normalMatrix[3]
+		uint word = uint(gl_VertexIndex) * 5;
+		position = vec3(unpackUnorm2x16(push.vertices.words[word]), unpackUnorm2x16(push.vertices.words[word + 1]).x);
+		normal = decodeNormal(unpackSnorm2x16(push.vertices.words[word + 2]));
+		uv = push.object.normalMatrix[3].xy + unpackUnorm2x16(push.vertices.words[word + 3]) * push.object.normalMatrix[3].zw;
+		color = unpackUnorm4x8(push.vertices.words[word + 4]).rgb;
+	} else {
+		uint word = uint(gl_VertexIndex) * 11;
+		position = readVec3(word);
+		color = readVec3(word + 3);
+		normal = readVec3(word + 6);
+		uv = vec2(uintBitsToFloat(push.vertices.words[word + 9]), uintBitsToFloat(push.vertices.words[word + 10]));
+	}
+
+	vec4 positionWorld = push.object.modelMatrix * vec4(position, 1.0);
+	gl_Position = ubo.projection * ubo.view * positionWorld;
+	fragNormalWorld = normalize(mat3(push.object.normalMatrix) * normal);
+	fragPosWorld = positionWorld.xyz;
+	fragColor = color;
+	fragUV = uv;
+}
@@ -32,12 +32,30 @@ layout(push_constant) uniform Push{
 	mat4 normalMatrix;
 } push;
 
+// set for models using VcuModel::PackedVertex
+layout(constant_id = 0) const bool PACKED_VERTEX = false;
+
+// packed positions are decoded through the model matrix, normals are octahedral encoded
+vec3 decodeNormal(vec3 n) {
+	if (!PACKED_VERTEX) return n;
+	vec3 v = vec3(n.xy, 1.0 - abs(n.x) - abs(n.y));
+	float t = max(-v.z, 0.0);
+	v.x += v.x >= 0.0 ? -t : t;
+	v.y += v.y >= 0.0 ? -t : t;
+	return normalize(v);
+}
+
+// packed uvs are relative to the uv bounds, offset in normalMatrix[3].xy and scale in .zw
+vec2 decodeUV(vec2 texCoord) {
+	return PACKED_VERTEX ? push.normalMatrix[3].xy + texCoord * push.normalMatrix[3].zw : texCoord;
+}
+
 
 void main() {
 	vec4 positionWorld = push.modelMatrix * vec4(position, 1.0);
 	gl_Position = ubo.projection * ubo.view * positionWorld;
-	fragNormalWorld = normalize(mat3(push.normalMatrix) * normal);
+	fragNormalWorld = normalize(mat3(push.normalMatrix) * decodeNormal(normal));
 	fragPosWorld = positionWorld.xyz;
 	fragColor = color;
-	fragUV = uv;
+	fragUV = decodeUV(uv);
 }
\ No newline at end of file
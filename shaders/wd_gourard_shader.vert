@@ -31,6 +31,24 @@ layout(push_constant) uniform Push{
 	mat4 normalMatrix;
 } push;
 
+// set for models using VcuModel::PackedVertex
+layout(constant_id = 0) const bool PACKED_VERTEX = false;
+
+// packed positions are decoded through the model matrix, normals are octahedral encoded
+vec3 decodeNormal(vec3 n) {
+	if (!PACKED_VERTEX) return n;
+	vec3 v = vec3(n.xy, 1.0 - abs(n.x) - abs(n.y));
+	float t = max(-v.z, 0.0);
+	v.x += v.x >= 0.0 ? -t : t;
+	v.y += v.y >= 0.0 ? -t : t;
+	return normalize(v);
+}
+
+// packed uvs are relative to the uv bounds, offset in normalMatrix[3].xy and scale in .zw
+vec2 decodeUV(vec2 texCoord) {
+	return PACKED_VERTEX ? push.normalMatrix[3].xy + texCoord * push.normalMatrix[3].zw : texCoord;
+}
+
 
 void main() {
     vec3 normals = vec3(0.0);
@@ -40,7 +58,7 @@ void main() {
  
     vec4 positionWorld = push.modelMatrix * vec4(position, 1.0);  
     vec3 camPosWorld = ubo.invView[3].xyz;
-    normals = normalize(mat3(push.normalMatrix) * normal);
+    normals = normalize(mat3(push.normalMatrix) * decodeNormal(normal));
  
     vec3 camDir = normalize(camPosWorld - positionWorld.xyz);
  
@@ -66,7 +84,7 @@ void main() {
     vec3 ambience = ubo.ambientLightColor.xyz * ubo.ambientLightColor.w;
     fragColor = ambience + diffuse + specular;
     fragPositionWorld = positionWorld.xyz;
-    fragUV = uv;
+    fragUV = decodeUV(uv);
 
 	gl_Position = ubo.projection * ubo.view * push.modelMatrix * vec4(position, 1.0);
 }
\ No newline at end of file
@@ -1,9 +1,10 @@
 #include "first_app.hpp"
 
 #include "keyboard_movement_controller.hpp"
-#include "vcu_buffer.hpp"
 #include "vcu_camera.hpp"
 #include "vcu_texture.hpp"
+#include "vcu_uniform_ring.hpp"
+#include "vcu_upload_batch.hpp"
 #include "systems/simple_render_system.hpp"
 #include "systems/point_light_system.hpp"
 #include "systems/moving_render_system.hpp"
@@ -22,6 +23,7 @@
 // std
 #include <stdexcept>
 #include <chrono>
+#include <cmath>
 #include <cassert>
 #include <array>
 #include <numeric>
@@ -29,14 +31,54 @@
 
 namespace vcu {
 
+	namespace {
+		// the rippling surface is a grid of SURFACE_RESOLUTION quads per side over [-1, 1] in x and z
+		constexpr uint32_t SURFACE_RESOLUTION = 32;
+		constexpr uint32_t SURFACE_SIDE = SURFACE_RESOLUTION + 1;
+
+		std::vector<VcuModel::Vertex> surfaceVertices(float time) {
+			constexpr float AMPLITUDE = 0.04f;
+			constexpr float WAVE_NUMBER = 12.f;
+			constexpr float SPEED = 3.f;
+
+			std::vector<VcuModel::Vertex> vertices(SURFACE_SIDE * SURFACE_SIDE);
+			for (uint32_t z = 0; z < SURFACE_SIDE; z++) {
+				for (uint32_t x = 0; x < SURFACE_SIDE; x++) {
+					VcuModel::Vertex& vertex = vertices[z * SURFACE_SIDE + x];
+					const glm::vec2 position = glm::vec2{ static_cast<float>(x), static_cast<float>(z) } * (2.f / SURFACE_RESOLUTION) - 1.f;
+					const float distance = glm::length(position);
+					const float phase = WAVE_NUMBER * distance - SPEED * time;
+
+					// ring waves around the center, -y is up
+					vertex.position = { position.x, -AMPLITUDE * std::sin(phase), position.y };
+					const float slope = distance > 0.f ? AMPLITUDE * WAVE_NUMBER * std::cos(phase) / distance : 0.f;
+					vertex.normal = glm::normalize(glm::vec3{ -slope * position.x, -1.f, -slope * position.y });
+					vertex.color = { 0.2f, 0.4f, 0.8f };
+					vertex.uv = (position + 1.f) * 0.5f;
+				}
+			}
+			return vertices;
+		}
+
+		std::vector<uint32_t> surfaceIndices() {
+			std::vector<uint32_t> indices{};
+			indices.reserve(SURFACE_RESOLUTION * SURFACE_RESOLUTION * 6);
+			for (uint32_t z = 0; z < SURFACE_RESOLUTION; z++) {
+				for (uint32_t x = 0; x < SURFACE_RESOLUTION; x++) {
+					const uint32_t corner = z * SURFACE_SIDE + x;
+					indices.insert(indices.end(), { corner, corner + SURFACE_SIDE, corner + 1,
+						corner + 1, corner + SURFACE_SIDE, corner + SURFACE_SIDE + 1 });
+				}
+			}
+			return indices;
+		}
+	}
+
 	FirstApp::FirstApp() {
 		globalPool = VcuDescriptorPool::Builder(vcuDevice)
-			.setMaxSets(VcuSwapChain::MAX_FRAMES_IN_FLIGHT)
-			.addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VcuSwapChain::MAX_FRAMES_IN_FLIGHT)
-			.addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VcuSwapChain::MAX_FRAMES_IN_FLIGHT)
-			.addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VcuSwapChain::MAX_FRAMES_IN_FLIGHT)
-			.addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VcuSwapChain::MAX_FRAMES_IN_FLIGHT)
-			.addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VcuSwapChain::MAX_FRAMES_IN_FLIGHT)
+			.setMaxSets(GLOBAL_SET_COUNT)
+			.addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, GLOBAL_SET_COUNT)
+			.addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4 * GLOBAL_SET_COUNT)
 			.build();
 		loadGameObjects();
 	}
@@ -44,67 +86,61 @@ namespace vcu {
 	FirstApp::~FirstApp() {}
 
 	void FirstApp::run() {
-		std::vector<std::unique_ptr<VcuBuffer>> uboBuffers(VcuSwapChain::MAX_FRAMES_IN_FLIGHT);
-		for (int i = 0; i < uboBuffers.size(); i++) {
-			uboBuffers[i] = std::make_unique<VcuBuffer>(
-				vcuDevice, 
-				sizeof(GlobalUbo), 
-				1,
-				VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT); 
-			uboBuffers[i]->map();
-		}
+		// GlobalUbo and any per pass uniforms of all frames in flight
+		VcuUniformRing uniformRing{ vcuDevice };
 
 		auto globalSetLayout = VcuDescriptorSetLayout::Builder(vcuDevice)
-			.addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS)
+			.addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_ALL_GRAPHICS)
 			.addBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
 			.addBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
 			.addBinding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
 			.addBinding(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
 			.build();
 
-		Texture texture = Texture(vcuDevice, "../textures/road.png");
-
-		VkDescriptorImageInfo imageInfo = {};
-		imageInfo.sampler = texture.getSampler();
-		imageInfo.imageView = texture.getImageView();
-		imageInfo.imageLayout = texture.getImageLayout();
-
-		Texture road = Texture(vcuDevice, "../textures/metal_plate4.jpg");
-
-		VkDescriptorImageInfo roadImageInfo = {};
-		roadImageInfo.sampler = road.getSampler();
-		roadImageInfo.imageView = road.getImageView();
-		roadImageInfo.imageLayout = road.getImageLayout();
-
-		Texture table = Texture(vcuDevice, "../textures/table.jpg");
-
-		VkDescriptorImageInfo tableImageInfo = {};
-		tableImageInfo.sampler = table.getSampler();
-		tableImageInfo.imageView = table.getImageView();
-		tableImageInfo.imageLayout = table.getImageLayout();
-		
-		Texture marble = Texture(vcuDevice, "../textures/marble2.jpg");
-
-		VkDescriptorImageInfo marbleImageInfo = {};
-		marbleImageInfo.sampler = marble.getSampler();
-		marbleImageInfo.imageView = marble.getImageView();
-		marbleImageInfo.imageLayout = marble.getImageLayout();
+		// all textures go up in one submission
+		VcuUploadBatch textureUploads{ vcuDevice };
+		Texture texture{ vcuDevice, "../textures/road.png", textureUploads };
+		Texture road{ vcuDevice, "../textures/metal_plate4.jpg", textureUploads };
+		Texture table{ vcuDevice, "../textures/table.jpg", textureUploads };
+		Texture marble{ vcuDevice, "../textures/marble2.jpg", textureUploads };
+		textureUploads.submit();
+
+		auto textureImageInfo = [](Texture& texture) {
+			VkDescriptorImageInfo imageInfo = {};
+			imageInfo.sampler = texture.getSampler();
+			imageInfo.imageView = texture.getImageView();
+			imageInfo.imageLayout = texture.getImageLayout();
+			return imageInfo;
+		};
 
-		std::vector<VkDescriptorSet> globalDescriptorSets(VcuSwapChain::MAX_FRAMES_IN_FLIGHT);
-		for (int i = 0; i < globalDescriptorSets.size(); i++) {
-			auto bufferInfo = uboBuffers[i]->descriptorInfo();
+		// Every frame binds the same set. When the defragmenter has moved textures, the next spare set is
+		// written and used from then on, sets are reused only after all frames that bound them have finished.
+		std::vector<VkDescriptorSet> globalDescriptorSets(GLOBAL_SET_COUNT);
+		size_t globalSetIndex = 0;
+		auto writeGlobalSet = [&](VkDescriptorSet& set) {
+			auto bufferInfo = uniformRing.descriptorInfo(sizeof(GlobalUbo));
+			VkDescriptorImageInfo imageInfo = textureImageInfo(texture);
+			VkDescriptorImageInfo roadImageInfo = textureImageInfo(road);
+			VkDescriptorImageInfo tableImageInfo = textureImageInfo(table);
+			VkDescriptorImageInfo marbleImageInfo = textureImageInfo(marble);
 			VcuDescriptorWriter(*globalSetLayout, *globalPool)
 				.writeBuffer(0, &bufferInfo)
 				.writeImage(1, &imageInfo)
 				.writeImage(2, &roadImageInfo)
 				.writeImage(3, &tableImageInfo)
 				.writeImage(4, &marbleImageInfo)
-				.build(globalDescriptorSets[i]);
+				.overwrite(set);
+		};
+		for (auto& set : globalDescriptorSets) {
+			if (!globalPool->allocateDescriptorSet(globalSetLayout->getDescriptorSetLayout(), set)) {
+				throw std::runtime_error("failed to allocate global descriptor set!");
+			}
 		}
+		writeGlobalSet(globalDescriptorSets[globalSetIndex]);
+		uint64_t descriptorGeneration = vcuDevice.defragmenter().getGeneration();
 
 		auto renderSystems = std::vector<std::unique_ptr<SimpleRenderSystem>>();
-		renderSystems.push_back(std::move(std::make_unique<SimpleRenderSystem>(vcuDevice, vcuRenderer.getSwapChainRenderPass(), globalSetLayout->getDescriptorSetLayout(),"simple_shader.vert.spv","simple_shader.frag.spv")));
+		renderSystems.push_back(std::move(std::make_unique<SimpleRenderSystem>(vcuDevice, vcuRenderer.getSwapChainRenderPass(), globalSetLayout->getDescriptorSetLayout(),"simple_shader.vert.spv","simple_shader.frag.spv",vertexPulling ? "pulled_simple_shader.vert.spv" : "")));
 		renderSystems.push_back(std::move(std::make_unique<SimpleRenderSystem>(vcuDevice, vcuRenderer.getSwapChainRenderPass(), globalSetLayout->getDescriptorSetLayout(),"flat_shader.vert.spv","flat_shader.frag.spv")));
 		renderSystems.push_back(std::move(std::make_unique<SimpleRenderSystem>(vcuDevice, vcuRenderer.getSwapChainRenderPass(), globalSetLayout->getDescriptorSetLayout(),"gourard_shader.vert.spv","gourard_shader.frag.spv")));
 		PointLightSystem pointLightSystem{ vcuDevice, vcuRenderer.getSwapChainRenderPass(), globalSetLayout->getDescriptorSetLayout() };
@@ -131,6 +167,7 @@ namespace vcu {
         KeyboardMovementController cameraController{};
 
         auto currentTime = std::chrono::high_resolution_clock::now();
+		const auto startTime = currentTime;
 		auto lastCameraModeChangeTime = currentTime;
 		auto lastShaderModeChangeTime = currentTime;
 		auto lastFogChangeTime = currentTime;
@@ -143,6 +180,14 @@ namespace vcu {
 		while (!vcuWindow.shouldClose()) {
 			glfwPollEvents();
 
+			{
+				// models that finished loading this frame share one staging submission
+				VcuUploadBatch modelUploads{ vcuDevice };
+				for (auto& kv : gameObjects) {
+					kv.second.updatePendingModel();
+				}
+			}
+
             auto newTime = std::chrono::high_resolution_clock::now();
             float frameTime = std::chrono::duration<float, std::chrono::seconds::period>(newTime - currentTime).count();
             currentTime = newTime;
@@ -206,13 +251,20 @@ namespace vcu {
 
 			if (auto commandBuffer = vcuRenderer.beginFrame()) {
 				int frameIndex = vcuRenderer.getFrameIndex();
+				if (descriptorGeneration != vcuDevice.defragmenter().getGeneration()) {
+					globalSetIndex = (globalSetIndex + 1) % globalDescriptorSets.size();
+					writeGlobalSet(globalDescriptorSets[globalSetIndex]);
+					descriptorGeneration = vcuDevice.defragmenter().getGeneration();
+				}
+				uniformRing.beginFrame(frameIndex);
 				FrameInfo frameInfo{
 					frameIndex,
 					frameTime,
 					commandBuffer,
 					camera,
-					globalDescriptorSets[frameIndex],
-					gameObjects
+					globalDescriptorSets[globalSetIndex],
+					gameObjects,
+					uniformRing
 				};
 
 				// update
@@ -226,11 +278,20 @@ namespace vcu {
 				ubo.movingLightDirection = spotlightDirection;
 				movingRenderSystems[shaderMode]->update(frameInfo, ubo, movingObjectTranslation, movingObjectRotation);
 				pointLightSystem.update(frameInfo, ubo, movingObjectTranslation);
-				uboBuffers[frameIndex]->writeToBuffer(&ubo);
-				uboBuffers[frameIndex]->flush();
+				frameInfo.globalUboOffset = uniformRing.push(ubo);
+
+				// dynamic models are edited and uploaded before the render pass
+				const float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+				rippleSurface->setVertices(0, surfaceVertices(time));
+				for (auto& kv : gameObjects) {
+					if (kv.second.dynamicModel != nullptr) {
+						kv.second.dynamicModel->recordUploads(commandBuffer, frameIndex);
+					}
+				}
 
 				// render
 				vcuRenderer.beginSwapChainRenderPass(commandBuffer);
+				geometryPool.bind(commandBuffer);
 				renderSystems[shaderMode]->renderGameObjects(frameInfo);
 				woodRenderSystems[shaderMode]->renderGameObjects(frameInfo);
 				noTxtRenderSystem[shaderMode]->renderGameObjects(frameInfo);
@@ -246,35 +307,40 @@ namespace vcu {
 	}
 
 	void FirstApp::loadGameObjects() {
-		std::shared_ptr<VcuModel> vcuModel = VcuModel::createModelFromFile(vcuDevice, "models/smooth_vase.obj");
-
+		VcuModel::LoadOptions loadOptions{};
+		loadOptions.optimizeMesh = true;
+		loadOptions.useMeshCache = true;
+		loadOptions.vertexFormat = VcuModel::VertexFormat::Packed;
+		loadOptions.splitFor16BitIndices = true;
+		loadOptions.lodCount = 4;
+
+		// large models are parsed in the background and show up once they are uploaded
 		auto flatVase = VcuGameObject::createGameObject();
-		flatVase.model = vcuModel;
+		flatVase.pendingModel = VcuModel::createModelFromFileAsync(geometryPool, "models/smooth_vase.obj", loadOptions);
 		flatVase.transform.translation = { -7.5f, .5f, 0.f };
 		flatVase.transform.scale = glm::vec3{ 20.f, 15.5f, 20.f };
 		flatVase.type = 5;
 		gameObjects.emplace(flatVase.getId(), std::move(flatVase));
 
 
-		vcuModel = VcuModel::createModelFromFile(vcuDevice, "models/Chess.obj");
 		auto floor = VcuGameObject::createGameObject();
-		floor.model = vcuModel;
+		floor.pendingModel = VcuModel::createModelFromFileAsync(geometryPool, "models/Chess.obj", loadOptions);
 		floor.transform.translation = { 0.f, .5f, 0.f };
 		floor.transform.rotation = glm::vec3{ glm::radians(-180.f), 0.f, 0.f };
 		floor.transform.scale = glm::vec3{ 3.0f, 3.0f, 3.0f };
 		gameObjects.emplace(floor.getId(), std::move(floor));
 
-		vcuModel = VcuModel::createModelFromFile(vcuDevice, "models/table.obj");
 		auto table = VcuGameObject::makeWoodObject();
-		table.model = vcuModel;
+		table.pendingModel = VcuModel::createModelFromFileAsync(geometryPool, "models/table.obj", loadOptions);
 		table.transform.translation = { 0.f, 16.0f, 0.f };
 		table.transform.rotation = glm::vec3{ glm::radians(-180.f), 0.f, 0.f };
 		table.transform.scale = glm::vec3{ 18.0f, 18.0f, 18.0f };
 		gameObjects.emplace(table.getId(), std::move(table)); 
 
-		vcuModel = VcuModel::createModelFromFile(vcuDevice, "models/uh60.obj");
 		auto helicopter = VcuGameObject::makeMovingObject();
-		helicopter.model = vcuModel;
+		VcuModel::LoadOptions denseLoadOptions = loadOptions;
+		denseLoadOptions.buildMeshlets = true;
+		helicopter.pendingModel = VcuModel::createModelFromFileAsync(geometryPool, "models/uh60.obj", denseLoadOptions);
 		helicopter.transform.translation = { 0.f, -10.5f, 0.f };
 		helicopter.transform.rotation = glm::vec3{ glm::radians(-180.f), 0.f, 0.f };
 		helicopter.transform.scale = glm::vec3{ 0.04f, 0.04f, 0.04f };
@@ -294,7 +360,7 @@ namespace vcu {
 			gameObjects.emplace(pointLight.getId(), std::move(pointLight));
 		}
 
-		vcuModel = VcuModel::createModelBezier(vcuDevice);
+		std::shared_ptr<VcuModel> vcuModel = VcuModel::createModelBezier(geometryPool);
 		auto bezierModel = VcuGameObject::createGameObject();
 		bezierModel.model = vcuModel;
 		bezierModel.transform.translation = { 10.5f, 0.5f, 0.f };
@@ -303,6 +369,14 @@ namespace vcu {
 		bezierModel.type = 3;
 		gameObjects.emplace(bezierModel.getId(), std::move(bezierModel));
 
+		auto surface = VcuGameObject::createGameObject();
+		rippleSurface = std::make_shared<VcuDynamicModel>(geometryPool, surfaceVertices(0.f), surfaceIndices());
+		surface.dynamicModel = rippleSurface;
+		surface.transform.translation = { 4.5f, 0.4f, -4.5f };
+		surface.transform.scale = glm::vec3{ 1.5f, 1.f, 1.5f };
+		surface.type = 3;
+		gameObjects.emplace(surface.getId(), std::move(surface));
+
 		std::vector<glm::vec3> lightColors{
 		 {1.f, .1f, .1f},
 		 {.1f, .1f, 1.f},
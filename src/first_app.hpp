@@ -5,6 +5,7 @@
 #include "vcu_device.hpp"
 #include "vcu_renderer.hpp"
 #include "vcu_descriptors.hpp"
+#include "vcu_geometry_pool.hpp"
 
 // std
 #include <memory>
@@ -22,6 +23,8 @@ namespace vcu {
 		int shaderMode{ 0 };
 		bool fogEnabled{ false };
 		bool nightMode{ true };
+		// draws the Phong shaded models through pulled_simple_shader.vert, falls back to vertex input if it is not built
+		bool vertexPulling{ false };
 		glm::vec3 spotlightDirection{ 0.0, 1.0, 0.0 };
 		const std::vector<const char*> cameraModeNames{ "Free", "Static", "Following", "3rd person", ""};
 		const std::vector<const char*> shadingModeNames{ "Phong", "Flat", "Gouraud" };
@@ -35,14 +38,19 @@ namespace vcu {
 		void run();
 
 	private:
+		// the global set changes at most once per frame, so one more than the frames in flight are enough
+		static constexpr uint32_t GLOBAL_SET_COUNT = VcuSwapChain::MAX_FRAMES_IN_FLIGHT + 1;
+
 		void loadGameObjects();
 
 		VcuWindow vcuWindow{ WIDTH, HEIGHT, "Little engine" };
 		VcuDevice vcuDevice{ vcuWindow };
 		VcuRenderer vcuRenderer{ vcuWindow, vcuDevice };
+		VcuGeometryPool geometryPool{ vcuDevice }; // declared before gameObjects so it outlives the models
 
 		std::unique_ptr<VcuDescriptorPool> globalPool{};
 		VcuGameObject::Map gameObjects; 
+		std::shared_ptr<VcuDynamicModel> rippleSurface; // animated on the CPU every frame
 }; 
 } // namespace vcu
 
@@ -52,20 +52,19 @@ namespace vcu {
 	void MarbleRenderSystem::createPipeline(VkRenderPass renderPass, const std::string& vertexShaderFile, const std::string& fragmentShaderFile) {
 		assert(pipelineLayout != nullptr && "Cannot create pipeline before pipeline layout");
 
-		PipelineConfigInfo pipelineConfig{};
-		VcuPipeline::defaultPipelineConfigInfo(pipelineConfig);
-		pipelineConfig.renderPass = renderPass;
-		pipelineConfig.pipelineLayout = pipelineLayout;
-		vcuPipeline = std::make_unique<VcuPipeline>(
+		pipelines = std::make_unique<VcuPipelineVariants>(
 			vcuDevice,
 			"shaders/" + vertexShaderFile,
 			"shaders/" + fragmentShaderFile,
-			pipelineConfig
-		);
+			[&](PipelineConfigInfo& pipelineConfig) {
+				pipelineConfig.renderPass = renderPass;
+				pipelineConfig.pipelineLayout = pipelineLayout;
+			});
 	}
 
 	void MarbleRenderSystem::renderGameObjects(FrameInfo &frameInfo) {
-		vcuPipeline->bind(frameInfo.commandBuffer);
+		VcuPipeline* boundPipeline = &pipelines->get(false, false);
+		boundPipeline->bind(frameInfo.commandBuffer);
 
 		vkCmdBindDescriptorSets(
 			frameInfo.commandBuffer,
@@ -74,15 +73,24 @@ namespace vcu {
 			0,
 			1,
 			&frameInfo.globalDescriptorSet,
-			0,
-			nullptr);	
+			1,
+			&frameInfo.globalUboOffset);	
 
 		for (auto& kv : frameInfo.gameObjects) {
 			auto& obj = kv.second;
-			if (obj.model == nullptr || obj.type != 5) continue;
+			if (obj.model == nullptr || obj.type != 5 || !obj.model->isUploaded()) continue;
+			const glm::mat4 modelMatrix = obj.transform.mat4();
+			VcuPipeline& pipeline = pipelines->select(*obj.model, modelMatrix);
+			if (&pipeline != boundPipeline) {
+				boundPipeline = &pipeline;
+				pipeline.bind(frameInfo.commandBuffer);
+			}
+			obj.updateLod(frameInfo.camera, modelMatrix);
+
 			SimplePushConstantData push{};
-			push.modelMatrix = obj.transform.mat4();
+			push.modelMatrix = modelMatrix * obj.model->getPositionDecodeMatrix();
 			push.normalMatrix = obj.transform.normalMatrix();
+			push.normalMatrix[3] = obj.model->getUVDecode();
 
 			vkCmdPushConstants(
 				frameInfo.commandBuffer,
@@ -92,7 +100,7 @@ namespace vcu {
 				sizeof(SimplePushConstantData),
 				&push);
 			obj.model->bind(frameInfo.commandBuffer);
-			obj.model->draw(frameInfo.commandBuffer);
+			obj.model->drawCulled(frameInfo.commandBuffer, obj.lod, frameInfo.camera, modelMatrix);
 		}
 	}
 }
\ No newline at end of file
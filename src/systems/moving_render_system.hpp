@@ -28,7 +28,7 @@ namespace vcu {
 
 		VcuDevice& vcuDevice;
 
-		std::unique_ptr<VcuPipeline> vcuPipeline;
+		std::unique_ptr<VcuPipelineVariants> pipelines;
 		VkPipelineLayout pipelineLayout;
 	};
 } // namespace vcu
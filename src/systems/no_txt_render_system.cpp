@@ -13,6 +13,9 @@
 
 namespace vcu {
 
+	// position, color and normal, the no_txt shaders have no uv input
+	using NoTxtShaderInputs = VertexInputs<0, 1, 2>;
+
 	struct SimplePushConstantData {
 		glm::mat4 modelMatrix{ 1.f };
 		glm::mat4 normalMatrix{ 1.f };		
@@ -52,20 +55,20 @@ namespace vcu {
 	void NoTxtRenderSystem::createPipeline(VkRenderPass renderPass, const std::string& vertexShaderFile, const std::string& fragmentShaderFile) {
 		assert(pipelineLayout != nullptr && "Cannot create pipeline before pipeline layout");
 
-		PipelineConfigInfo pipelineConfig{};
-		VcuPipeline::defaultPipelineConfigInfo(pipelineConfig);
-		pipelineConfig.renderPass = renderPass;
-		pipelineConfig.pipelineLayout = pipelineLayout;
-		vcuPipeline = std::make_unique<VcuPipeline>(
+		pipelines = std::make_unique<VcuPipelineVariants>(
 			vcuDevice,
 			"shaders/" + vertexShaderFile,
 			"shaders/" + fragmentShaderFile,
-			pipelineConfig
-		);
+			[&](PipelineConfigInfo& pipelineConfig) {
+				pipelineConfig.renderPass = renderPass;
+				pipelineConfig.pipelineLayout = pipelineLayout;
+				VcuPipeline::setVertexInputs<NoTxtShaderInputs>(pipelineConfig);
+			});
 	}
 
 	void NoTxtRenderSystem::renderGameObjects(FrameInfo &frameInfo) {
-		vcuPipeline->bind(frameInfo.commandBuffer);
+		VcuPipeline* boundPipeline = &pipelines->get(false, false);
+		boundPipeline->bind(frameInfo.commandBuffer);
 
 		vkCmdBindDescriptorSets(
 			frameInfo.commandBuffer,
@@ -74,15 +77,24 @@ namespace vcu {
 			0,
 			1,
 			&frameInfo.globalDescriptorSet,
-			0,
-			nullptr);	
+			1,
+			&frameInfo.globalUboOffset);	
 
 		for (auto& kv : frameInfo.gameObjects) {
 			auto& obj = kv.second;
-			if (obj.model == nullptr || obj.type != 3) continue;
+			if (obj.model == nullptr || obj.type != 3 || !obj.model->isUploaded()) continue;
+			const glm::mat4 modelMatrix = obj.transform.mat4();
+			VcuPipeline& pipeline = pipelines->select(*obj.model, modelMatrix);
+			if (&pipeline != boundPipeline) {
+				boundPipeline = &pipeline;
+				pipeline.bind(frameInfo.commandBuffer);
+			}
+			obj.updateLod(frameInfo.camera, modelMatrix);
+
 			SimplePushConstantData push{};
-			push.modelMatrix = obj.transform.mat4();
+			push.modelMatrix = modelMatrix * obj.model->getPositionDecodeMatrix();
 			push.normalMatrix = obj.transform.normalMatrix();
+			push.normalMatrix[3] = obj.model->getUVDecode();
 
 			vkCmdPushConstants(
 				frameInfo.commandBuffer,
@@ -92,7 +104,33 @@ namespace vcu {
 				sizeof(SimplePushConstantData),
 				&push);
 			obj.model->bind(frameInfo.commandBuffer);
-			obj.model->draw(frameInfo.commandBuffer);
+			obj.model->drawCulled(frameInfo.commandBuffer, obj.lod, frameInfo.camera, modelMatrix);
+		}
+
+		// dynamic models use the standard layout and are drawn two sided
+		for (auto& kv : frameInfo.gameObjects) {
+			auto& obj = kv.second;
+			if (obj.dynamicModel == nullptr || obj.type != 3) continue;
+			VcuPipeline& pipeline = pipelines->get(false, false);
+			if (&pipeline != boundPipeline) {
+				boundPipeline = &pipeline;
+				pipeline.bind(frameInfo.commandBuffer);
+			}
+
+			SimplePushConstantData push{};
+			push.modelMatrix = obj.transform.mat4();
+			push.normalMatrix = obj.transform.normalMatrix();
+			push.normalMatrix[3] = glm::vec4{ 0.f, 0.f, 1.f, 1.f };
+
+			vkCmdPushConstants(
+				frameInfo.commandBuffer,
+				pipelineLayout,
+				VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+				0,
+				sizeof(SimplePushConstantData),
+				&push);
+			obj.dynamicModel->bind(frameInfo.commandBuffer);
+			obj.dynamicModel->draw(frameInfo.commandBuffer);
 		}
 	}
 }
\ No newline at end of file
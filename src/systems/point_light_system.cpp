@@ -118,8 +118,8 @@ namespace vcu {
 			0,
 			1,
 			&frameInfo.globalDescriptorSet,
-			0,
-			nullptr);	
+			1,
+			&frameInfo.globalUboOffset);	
 
 		// iterate through sorted lights in reverse order
 		for (auto it = sorted.rbegin(); it != sorted.rend(); ++it) {
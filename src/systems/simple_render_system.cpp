@@ -7,6 +7,7 @@
 #include <glm/gtc/constants.hpp>
 
 // std
+#include <algorithm>
 #include <stdexcept>
 #include <cassert>
 #include <array>
@@ -18,11 +19,22 @@ namespace vcu {
 		glm::mat4 normalMatrix{ 1.f };		
 	};
 
+	// pulled_simple_shader.vert reads the vertex and SimplePushConstantData through these
+	struct PulledPushConstantData {
+		VkDeviceAddress vertices;
+		VkDeviceAddress object;
+		uint32_t packedVertex;
+	};
+
 	SimpleRenderSystem::SimpleRenderSystem(VcuDevice& device, VkRenderPass renderPass, VkDescriptorSetLayout globalSetLayout,
-		const std::string& vertexShaderFile, const std::string& fragmentShaderFile)
+		const std::string& vertexShaderFile, const std::string& fragmentShaderFile, const std::string& pulledVertexShaderFile)
 		: vcuDevice{device} {
 		createPipelineLayout(globalSetLayout);
 		createPipeline(renderPass, vertexShaderFile, fragmentShaderFile);
+		if (!pulledVertexShaderFile.empty() && vcuDevice.hasBufferDeviceAddress() &&
+			VcuPipeline::shaderExists(pulledVertexShaderFile)) {
+			createPulledPipelines(renderPass, pulledVertexShaderFile, fragmentShaderFile);
+		}
 	}
 
 	SimpleRenderSystem::~SimpleRenderSystem() {
@@ -33,7 +45,7 @@ namespace vcu {
 		VkPushConstantRange pushConstantRange{};
 		pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
 		pushConstantRange.offset = 0;
-		pushConstantRange.size = sizeof(SimplePushConstantData);
+		pushConstantRange.size = static_cast<uint32_t>(std::max(sizeof(SimplePushConstantData), sizeof(PulledPushConstantData)));
 
 		std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { globalSetLayout };
 
@@ -52,11 +64,32 @@ namespace vcu {
 	void SimpleRenderSystem::createPipeline(VkRenderPass renderPass, const std::string& vertexShaderFile, const std::string& fragmentShaderFile) {
 		assert(pipelineLayout != nullptr && "Cannot create pipeline before pipeline layout");
 
+		pipelines = std::make_unique<VcuPipelineVariants>(
+			vcuDevice,
+			"shaders/" + vertexShaderFile,
+			"shaders/" + fragmentShaderFile,
+			[&](PipelineConfigInfo& pipelineConfig) {
+				pipelineConfig.renderPass = renderPass;
+				pipelineConfig.pipelineLayout = pipelineLayout;
+			});
+	}
+
+	void SimpleRenderSystem::createPulledPipelines(VkRenderPass renderPass, const std::string& vertexShaderFile,
+		const std::string& fragmentShaderFile) {
 		PipelineConfigInfo pipelineConfig{};
 		VcuPipeline::defaultPipelineConfigInfo(pipelineConfig);
 		pipelineConfig.renderPass = renderPass;
 		pipelineConfig.pipelineLayout = pipelineLayout;
-		vcuPipeline = std::make_unique<VcuPipeline>(
+		VcuPipeline::enableVertexPulling(pipelineConfig);
+		pulledPipeline = std::make_unique<VcuPipeline>(
+			vcuDevice,
+			"shaders/" + vertexShaderFile,
+			"shaders/" + fragmentShaderFile,
+			pipelineConfig
+		);
+
+		VcuPipeline::enableBackfaceCulling(pipelineConfig);
+		pulledCulledPipeline = std::make_unique<VcuPipeline>(
 			vcuDevice,
 			"shaders/" + vertexShaderFile,
 			"shaders/" + fragmentShaderFile,
@@ -64,8 +97,16 @@ namespace vcu {
 		);
 	}
 
+	VcuPipeline& SimpleRenderSystem::selectPipeline(const VcuModel& model, const glm::mat4& modelMatrix) {
+		if (pulledPipeline) {
+			return model.canBackfaceCull(modelMatrix) ? *pulledCulledPipeline : *pulledPipeline;
+		}
+		return pipelines->select(model, modelMatrix);
+	}
+
 	void SimpleRenderSystem::renderGameObjects(FrameInfo &frameInfo) {
-		vcuPipeline->bind(frameInfo.commandBuffer);
+		VcuPipeline* boundPipeline = &pipelines->get(false, false);
+		boundPipeline->bind(frameInfo.commandBuffer);
 
 		vkCmdBindDescriptorSets(
 			frameInfo.commandBuffer,
@@ -74,25 +115,49 @@ namespace vcu {
 			0,
 			1,
 			&frameInfo.globalDescriptorSet,
-			0,
-			nullptr);	
+			1,
+			&frameInfo.globalUboOffset);	
 
 		for (auto& kv : frameInfo.gameObjects) {
 			auto& obj = kv.second;
-			if (obj.model == nullptr || obj.type != 0) continue;
+			if (obj.model == nullptr || obj.type != 0 || !obj.model->isUploaded()) continue;
+			const glm::mat4 modelMatrix = obj.transform.mat4();
+			VcuPipeline& pipeline = selectPipeline(*obj.model, modelMatrix);
+			if (&pipeline != boundPipeline) {
+				boundPipeline = &pipeline;
+				pipeline.bind(frameInfo.commandBuffer);
+			}
+			obj.updateLod(frameInfo.camera, modelMatrix);
+
 			SimplePushConstantData push{};
-			push.modelMatrix = obj.transform.mat4();
+			push.modelMatrix = modelMatrix * obj.model->getPositionDecodeMatrix();
 			push.normalMatrix = obj.transform.normalMatrix();
+			push.normalMatrix[3] = obj.model->getUVDecode();
 
-			vkCmdPushConstants(
-				frameInfo.commandBuffer,
-				pipelineLayout,
-				VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-				0,
-				sizeof(SimplePushConstantData),
-				&push);
+			if (pulledPipeline) {
+				PulledPushConstantData pulled{};
+				pulled.vertices = obj.model->getVertexAddress();
+				pulled.object = frameInfo.uniformRing.getDeviceAddress(frameInfo.uniformRing.push(push));
+				pulled.packedVertex = obj.model->getVertexFormat() == VcuModel::VertexFormat::Packed;
+				vkCmdPushConstants(
+					frameInfo.commandBuffer,
+					pipelineLayout,
+					VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+					0,
+					sizeof(PulledPushConstantData),
+					&pulled);
+			}
+			else {
+				vkCmdPushConstants(
+					frameInfo.commandBuffer,
+					pipelineLayout,
+					VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+					0,
+					sizeof(SimplePushConstantData),
+					&push);
+			}
 			obj.model->bind(frameInfo.commandBuffer);
-			obj.model->draw(frameInfo.commandBuffer);
+			obj.model->drawCulled(frameInfo.commandBuffer, obj.lod, frameInfo.camera, modelMatrix);
 		}
 	}
 }
\ No newline at end of file
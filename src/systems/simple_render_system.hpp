@@ -13,8 +13,11 @@
 namespace vcu {
 	class SimpleRenderSystem {
 	public:
+		// models are drawn with pulledVertexShaderFile instead, if it is set, compiled and the device has buffer
+		// device addresses
 		SimpleRenderSystem(VcuDevice &device, VkRenderPass renderPass, VkDescriptorSetLayout globalSetLayout, 
-			const std::string& vertexShaderFile, const std::string& fragmentShaderFile);
+			const std::string& vertexShaderFile, const std::string& fragmentShaderFile,
+			const std::string& pulledVertexShaderFile = "");
 		~SimpleRenderSystem();
 		SimpleRenderSystem(const SimpleRenderSystem&) = delete;
 		SimpleRenderSystem& operator=(const SimpleRenderSystem&) = delete;
@@ -24,10 +27,15 @@ namespace vcu {
 	private:
 		void createPipelineLayout(VkDescriptorSetLayout globalSetLayout);
 		void createPipeline(VkRenderPass renderPass, const std::string& vertexShaderFile, const std::string& fragmentShaderFile);
+		void createPulledPipelines(VkRenderPass renderPass, const std::string& vertexShaderFile, const std::string& fragmentShaderFile);
+		VcuPipeline& selectPipeline(const VcuModel& model, const glm::mat4& modelMatrix);
 
 		VcuDevice& vcuDevice;
 
-		std::unique_ptr<VcuPipeline> vcuPipeline;
+		std::unique_ptr<VcuPipelineVariants> pipelines;
+		// vertex pulling with and without back face culling, the packedVertex push constant picks the vertex format
+		std::unique_ptr<VcuPipeline> pulledPipeline;
+		std::unique_ptr<VcuPipeline> pulledCulledPipeline;
 		VkPipelineLayout pipelineLayout;
 	};
 } // namespace vcu
@@ -0,0 +1,717 @@
+#include "vcu_allocator.hpp"
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <stdexcept>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace vcu {
+
+	namespace {
+		// heaps smaller than this many blocks get smaller blocks, so one block does not take most of them
+		constexpr VkDeviceSize MIN_BLOCKS_PER_HEAP = 8;
+
+		// budget callbacks that keep reporting progress without making room do not retry forever
+		constexpr uint32_t MAX_BUDGET_RETRIES = 4;
+
+		VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+			return (value + alignment - 1) & ~(alignment - 1);
+		}
+
+		uint32_t highestBit(uint64_t value) {
+#if defined(_MSC_VER)
+			unsigned long index;
+			_BitScanReverse64(&index, value);
+			return static_cast<uint32_t>(index);
+#else
+			return 63 - static_cast<uint32_t>(__builtin_clzll(value));
+#endif
+		}
+
+		uint32_t lowestBit(uint64_t value) {
+#if defined(_MSC_VER)
+			unsigned long index;
+			_BitScanForward64(&index, value);
+			return static_cast<uint32_t>(index);
+#else
+			return static_cast<uint32_t>(__builtin_ctzll(value));
+#endif
+		}
+	}
+
+	VcuAllocator::Tlsf::Tlsf(VkDeviceSize size) : freeSize{ size } {
+		for (auto& heads : freeHeads) {
+			heads.fill(NONE);
+		}
+		const uint32_t node = createNode();
+		nodes[node] = { 0, size, NONE, NONE, NONE, NONE, true };
+		insertFree(node);
+	}
+
+	void VcuAllocator::Tlsf::mapping(VkDeviceSize size, uint32_t& fl, uint32_t& sl) {
+		if (size < (VkDeviceSize{ 1 } << FL_OFFSET)) {
+			fl = 0;
+			sl = static_cast<uint32_t>(size >> (FL_OFFSET - SL_BITS));
+			return;
+		}
+		const uint32_t bit = highestBit(size);
+		fl = bit - FL_OFFSET + 1;
+		sl = static_cast<uint32_t>(size >> (bit - SL_BITS)) & (SL_COUNT - 1);
+	}
+
+	uint32_t VcuAllocator::Tlsf::findFree(VkDeviceSize size) const {
+		// round up to the next size class, so every range in the list found is big enough
+		if (size >= (VkDeviceSize{ 1 } << FL_OFFSET)) {
+			const VkDeviceSize rounded = size + (VkDeviceSize{ 1 } << (highestBit(size) - SL_BITS)) - 1;
+			if (rounded < size) return NONE;
+			size = rounded;
+		}
+		uint32_t fl, sl;
+		mapping(size, fl, sl);
+
+		uint32_t slMap = slBitmap[fl] & (~0u << sl);
+		if (slMap == 0) {
+			const uint64_t flMap = fl + 1 < FL_COUNT ? flBitmap & (~uint64_t{ 0 } << (fl + 1)) : 0;
+			if (flMap == 0) return NONE;
+			fl = lowestBit(flMap);
+			slMap = slBitmap[fl];
+		}
+		sl = lowestBit(slMap);
+		return freeHeads[fl][sl];
+	}
+
+	void VcuAllocator::Tlsf::insertFree(uint32_t node) {
+		uint32_t fl, sl;
+		mapping(nodes[node].size, fl, sl);
+		const uint32_t head = freeHeads[fl][sl];
+		nodes[node].previousFree = NONE;
+		nodes[node].nextFree = head;
+		if (head != NONE) nodes[head].previousFree = node;
+		freeHeads[fl][sl] = node;
+		slBitmap[fl] |= 1u << sl;
+		flBitmap |= uint64_t{ 1 } << fl;
+	}
+
+	void VcuAllocator::Tlsf::removeFree(uint32_t node) {
+		const Node& n = nodes[node];
+		if (n.previousFree != NONE) nodes[n.previousFree].nextFree = n.nextFree;
+		if (n.nextFree != NONE) nodes[n.nextFree].previousFree = n.previousFree;
+
+		uint32_t fl, sl;
+		mapping(n.size, fl, sl);
+		if (freeHeads[fl][sl] == node) {
+			freeHeads[fl][sl] = n.nextFree;
+			if (n.nextFree == NONE) {
+				slBitmap[fl] &= ~(1u << sl);
+				if (slBitmap[fl] == 0) flBitmap &= ~(uint64_t{ 1 } << fl);
+			}
+		}
+	}
+
+	uint32_t VcuAllocator::Tlsf::createNode() {
+		if (!unusedNodes.empty()) {
+			const uint32_t node = unusedNodes.back();
+			unusedNodes.pop_back();
+			return node;
+		}
+		nodes.push_back({});
+		return static_cast<uint32_t>(nodes.size() - 1);
+	}
+
+	void VcuAllocator::Tlsf::splitAfter(uint32_t node, VkDeviceSize size) {
+		const uint32_t rest = createNode();
+		Node& n = nodes[node];
+		nodes[rest] = { n.offset + size, n.size - size, node, n.nextPhysical, NONE, NONE, true };
+		if (n.nextPhysical != NONE) nodes[n.nextPhysical].previousPhysical = rest;
+		n.nextPhysical = rest;
+		n.size = size;
+		insertFree(rest);
+	}
+
+	void VcuAllocator::Tlsf::merge(uint32_t node, uint32_t next) {
+		Node& n = nodes[node];
+		const Node& absorbed = nodes[next];
+		n.size += absorbed.size;
+		n.nextPhysical = absorbed.nextPhysical;
+		if (absorbed.nextPhysical != NONE) nodes[absorbed.nextPhysical].previousPhysical = node;
+		unusedNodes.push_back(next);
+	}
+
+	uint32_t VcuAllocator::Tlsf::allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset, VkDeviceSize& allocatedSize) {
+		size = alignUp(std::max(size, MIN_ALIGNMENT), MIN_ALIGNMENT);
+		alignment = std::max(alignment, MIN_ALIGNMENT);
+
+		// the worst case padding in front has to fit as well
+		uint32_t node = findFree(size + alignment - MIN_ALIGNMENT);
+		if (node == NONE) return NONE;
+		removeFree(node);
+
+		const VkDeviceSize padding = alignUp(nodes[node].offset, alignment) - nodes[node].offset;
+		if (padding > 0) {
+			// the padding stays a free range of its own, its physical predecessor is in use
+			const uint32_t front = node;
+			splitAfter(front, padding);
+			node = nodes[front].nextPhysical;
+			removeFree(node);
+			insertFree(front);
+		}
+		if (nodes[node].size > size) {
+			splitAfter(node, size);
+		}
+
+		Node& n = nodes[node];
+		n.free = false;
+		freeSize -= n.size;
+		allocationCount++;
+		offset = n.offset;
+		allocatedSize = n.size;
+		return node;
+	}
+
+	VkDeviceSize VcuAllocator::Tlsf::blockSizeFor(VkDeviceSize size, VkDeviceSize alignment) {
+		size = alignUp(std::max(size, MIN_ALIGNMENT), MIN_ALIGNMENT);
+		alignment = std::max(alignment, MIN_ALIGNMENT);
+		VkDeviceSize request = size + alignment - MIN_ALIGNMENT;
+		if (request >= (VkDeviceSize{ 1 } << FL_OFFSET)) {
+			request += VkDeviceSize{ 1 } << (highestBit(request) - SL_BITS);
+		}
+		return alignUp(request, MIN_ALIGNMENT);
+	}
+
+	void VcuAllocator::Tlsf::free(uint32_t node) {
+		assert(!nodes[node].free && "Range is already free");
+		nodes[node].free = true;
+		freeSize += nodes[node].size;
+		allocationCount--;
+
+		const uint32_t next = nodes[node].nextPhysical;
+		if (next != NONE && nodes[next].free) {
+			removeFree(next);
+			merge(node, next);
+		}
+		const uint32_t previous = nodes[node].previousPhysical;
+		if (previous != NONE && nodes[previous].free) {
+			removeFree(previous);
+			merge(previous, node);
+			node = previous;
+		}
+		insertFree(node);
+	}
+
+	VcuAllocator::VcuAllocator(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize)
+		: physicalDevice{ physicalDevice }, device{ device }, preferredBlockSize{ blockSize } {
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		bufferImageGranularity = properties.limits.bufferImageGranularity;
+		nonCoherentAtomSize = properties.limits.nonCoherentAtomSize;
+		updateBudgetLocked();
+	}
+
+	VcuAllocator::~VcuAllocator() {
+		if (allocationCount > 0) {
+			std::cout << allocationCount << " device memory allocations were not freed" << std::endl;
+		}
+		for (auto& pool : pools) {
+			for (auto& block : pool.blocks) {
+				vkFreeMemory(device, block->memory, nullptr);
+			}
+		}
+	}
+
+	uint32_t VcuAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const {
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+			if ((typeFilter & (1 << i)) &&
+				(memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+				return i;
+			}
+		}
+		throw std::runtime_error("failed to find suitable memory type!");
+	}
+
+	uint32_t VcuAllocator::getPoolIndex(uint32_t memoryTypeIndex, ResourceKind kind) const {
+		// without a granularity restriction buffers and images can share blocks
+		const uint32_t kindIndex = bufferImageGranularity > 1 ? static_cast<uint32_t>(kind) : 0;
+		return memoryTypeIndex * 2 + kindIndex;
+	}
+
+	bool VcuAllocator::isHostVisible(uint32_t memoryTypeIndex) const {
+		return (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+	}
+
+	bool VcuAllocator::isNonCoherent(uint32_t memoryTypeIndex) const {
+		const VkMemoryPropertyFlags flags = memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags;
+		return (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0 && (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 0;
+	}
+
+	VkDeviceMemory VcuAllocator::allocateMemory(VkDeviceSize size, uint32_t memoryTypeIndex, void** mapped) {
+		// the driver would start paging or fail on its own, better to let the caller make room first
+		const uint32_t heapIndex = memoryProperties.memoryTypes[memoryTypeIndex].heapIndex;
+		HeapBudget& heap = heapBudgets[heapIndex];
+		if (getHeapUsage(heapIndex) + size > heap.budget) {
+			return VK_NULL_HANDLE;
+		}
+
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = size;
+		allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+		VkMemoryAllocateFlagsInfoKHR flagsInfo{};
+		flagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO_KHR;
+		flagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
+		if (bufferDeviceAddress) {
+			allocInfo.pNext = &flagsInfo;
+		}
+
+		VkDeviceMemory memory;
+		if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+			return VK_NULL_HANDLE;
+		}
+
+		*mapped = nullptr;
+		if (isHostVisible(memoryTypeIndex) && vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS) {
+			vkFreeMemory(device, memory, nullptr);
+			throw std::runtime_error("failed to map device memory!");
+		}
+
+		heap.allocated += size;
+		heap.peak = std::max(heap.peak, heap.allocated);
+		return memory;
+	}
+
+	void VcuAllocator::freeMemory(VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryTypeIndex) {
+		vkFreeMemory(device, memory, nullptr);
+		heapBudgets[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex].allocated -= size;
+	}
+
+	VcuAllocator::Allocation* VcuAllocator::allocateDedicated(VkDeviceSize size, uint32_t memoryTypeIndex) {
+		void* mapped;
+		VkDeviceMemory memory = allocateMemory(size, memoryTypeIndex, &mapped);
+		if (memory == VK_NULL_HANDLE) return nullptr;
+
+		auto* allocation = new Allocation{};
+		allocation->memory = memory;
+		allocation->size = size;
+		allocation->mapped = mapped;
+		allocation->memoryTypeIndex = memoryTypeIndex;
+		return allocation;
+	}
+
+	VcuAllocator::Block* VcuAllocator::createBlock(VkDeviceSize minSize, uint32_t memoryTypeIndex, uint32_t poolIndex) {
+		const uint32_t heapIndex = memoryProperties.memoryTypes[memoryTypeIndex].heapIndex;
+		VkDeviceSize blockSize = std::min(preferredBlockSize, memoryProperties.memoryHeaps[heapIndex].size / MIN_BLOCKS_PER_HEAP);
+		blockSize = std::max(blockSize, minSize);
+
+		// retry with smaller blocks before giving up, the request may still fit
+		void* mapped = nullptr;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		while (memory == VK_NULL_HANDLE) {
+			memory = allocateMemory(blockSize, memoryTypeIndex, &mapped);
+			if (memory != VK_NULL_HANDLE) break;
+			if (blockSize == minSize) return nullptr;
+			blockSize = std::max(blockSize / 2, minSize);
+		}
+
+#ifndef NDEBUG
+		std::cout << "Allocated " << blockSize / (1024 * 1024) << " MiB device memory block of type " << memoryTypeIndex << std::endl;
+#endif
+		return new Block{ memory, blockSize, static_cast<char*>(mapped), poolIndex, Tlsf{ blockSize } };
+	}
+
+	VcuAllocator::Allocation* VcuAllocator::allocateForBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties, MemoryCategory category) {
+		VkMemoryRequirements requirements;
+		vkGetBufferMemoryRequirements(device, buffer, &requirements);
+
+		Allocation* allocation = allocate(requirements, properties, ResourceKind::Linear, category);
+		if (vkBindBufferMemory(device, buffer, allocation->memory, allocation->offset) != VK_SUCCESS) {
+			free(allocation);
+			throw std::runtime_error("failed to bind buffer memory!");
+		}
+		return allocation;
+	}
+
+	VcuAllocator::Allocation* VcuAllocator::allocateForImage(VkImage image, const VkImageCreateInfo& imageInfo, VkMemoryPropertyFlags properties,
+		MemoryCategory category) {
+		VkMemoryRequirements requirements;
+		vkGetImageMemoryRequirements(device, image, &requirements);
+
+		// attachments are recreated with the swap chain, giving them their own memory keeps the blocks from fragmenting
+		constexpr VkImageUsageFlags attachmentUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+		const bool dedicated = (imageInfo.usage & attachmentUsage) != 0;
+		const ResourceKind kind = imageInfo.tiling == VK_IMAGE_TILING_OPTIMAL ? ResourceKind::Optimal : ResourceKind::Linear;
+
+		Allocation* allocation = allocate(requirements, properties, kind, category, dedicated);
+		if (vkBindImageMemory(device, image, allocation->memory, allocation->offset) != VK_SUCCESS) {
+			free(allocation);
+			throw std::runtime_error("failed to bind image memory!");
+		}
+		return allocation;
+	}
+
+	VcuAllocator::Allocation* VcuAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties,
+		ResourceKind kind, MemoryCategory category, bool dedicated) {
+		const uint32_t memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, properties);
+		const uint32_t heapIndex = memoryProperties.memoryTypes[memoryTypeIndex].heapIndex;
+
+		for (uint32_t retry = 0;; retry++) {
+			{
+				std::lock_guard<std::mutex> lock{ mutex };
+				Allocation* allocation = tryAllocate(requirements, memoryTypeIndex, kind, dedicated);
+				if (allocation == nullptr && releaseEmptyBlocks(heapIndex)) {
+					allocation = tryAllocate(requirements, memoryTypeIndex, kind, dedicated);
+				}
+				if (allocation != nullptr) {
+					allocation->category = category;
+					allocation->alignment = requirements.alignment;
+					CategoryStats& stats = categoryStats[static_cast<uint32_t>(category)];
+					stats.current += allocation->size;
+					stats.peak = std::max(stats.peak, stats.current);
+					stats.allocationCount++;
+					allocationCount++;
+					return allocation;
+				}
+			}
+
+			if (retry == MAX_BUDGET_RETRIES || !runBudgetCallbacks(heapIndex, requirements.size)) {
+				std::lock_guard<std::mutex> lock{ mutex };
+				std::cout << "Out of device memory for " << requirements.size / 1024 << " KiB of " << getCategoryName(category)
+					<< ", heap " << heapIndex << " uses " << getHeapUsage(heapIndex) / (1024 * 1024) << " of "
+					<< heapBudgets[heapIndex].budget / (1024 * 1024) << " MiB" << std::endl;
+				throw std::runtime_error("failed to allocate device memory!");
+			}
+		}
+	}
+
+	VcuAllocator::Allocation* VcuAllocator::tryAllocate(const VkMemoryRequirements& requirements, uint32_t memoryTypeIndex,
+		ResourceKind kind, bool dedicated) {
+		if (dedicated || requirements.size > preferredBlockSize / 2) {
+			return allocateDedicated(requirements.size, memoryTypeIndex);
+		}
+
+		// flushes are widened to whole atoms, which must not reach into a neighbouring allocation
+		VkDeviceSize alignment = requirements.alignment;
+		VkDeviceSize size = requirements.size;
+		if (isNonCoherent(memoryTypeIndex)) {
+			alignment = std::max(alignment, nonCoherentAtomSize);
+			size = alignUp(size, nonCoherentAtomSize);
+		}
+
+		const uint32_t poolIndex = getPoolIndex(memoryTypeIndex, kind);
+		Pool& pool = pools[poolIndex];
+		Block* block = nullptr;
+		uint32_t node = Tlsf::NONE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize allocatedSize = 0;
+		for (auto& candidate : pool.blocks) {
+			node = candidate->tlsf.allocate(size, alignment, offset, allocatedSize);
+			if (node != Tlsf::NONE) {
+				block = candidate.get();
+				break;
+			}
+		}
+		if (block == nullptr) {
+			block = createBlock(Tlsf::blockSizeFor(size, alignment), memoryTypeIndex, poolIndex);
+			if (block == nullptr) return nullptr;
+			node = block->tlsf.allocate(size, alignment, offset, allocatedSize);
+			if (node == Tlsf::NONE) {
+				freeMemory(block->memory, block->size, memoryTypeIndex);
+				delete block;
+				return nullptr;
+			}
+			pool.blocks.emplace_back(block);
+		}
+
+		auto* allocation = new Allocation{};
+		allocation->memory = block->memory;
+		allocation->offset = offset;
+		allocation->size = allocatedSize;
+		allocation->mapped = block->mapped != nullptr ? block->mapped + offset : nullptr;
+		allocation->memoryTypeIndex = memoryTypeIndex;
+		allocation->block = block;
+		allocation->node = node;
+		return allocation;
+	}
+
+	void VcuAllocator::free(Allocation* allocation) {
+		if (allocation == nullptr) return;
+		std::lock_guard<std::mutex> lock{ mutex };
+		allocationCount--;
+		CategoryStats& stats = categoryStats[static_cast<uint32_t>(allocation->category)];
+		stats.current -= allocation->size;
+		stats.allocationCount--;
+
+		Block* block = allocation->block;
+		if (block == nullptr) {
+			freeMemory(allocation->memory, allocation->size, allocation->memoryTypeIndex);
+			delete allocation;
+			return;
+		}
+
+		block->tlsf.free(allocation->node);
+		releaseBlockIfSpare(block, allocation->memoryTypeIndex);
+		delete allocation;
+	}
+
+	bool VcuAllocator::releaseBlockIfSpare(Block* block, uint32_t memoryTypeIndex) {
+		// one empty block per pool is kept around, so a resource created right after does not pay for a new one
+		if (!block->tlsf.isEmpty()) return false;
+		Pool& pool = pools[block->poolIndex];
+		const bool otherEmpty = std::any_of(pool.blocks.begin(), pool.blocks.end(),
+			[block](const std::unique_ptr<Block>& candidate) { return candidate.get() != block && candidate->tlsf.isEmpty(); });
+		if (!otherEmpty) return false;
+
+		freeMemory(block->memory, block->size, memoryTypeIndex);
+		pool.blocks.erase(std::find_if(pool.blocks.begin(), pool.blocks.end(),
+			[block](const std::unique_ptr<Block>& candidate) { return candidate.get() == block; }));
+		return true;
+	}
+
+	std::vector<VcuAllocator::Move> VcuAllocator::planMoves(const std::vector<Allocation*>& candidates, VkDeviceSize maxBytes) {
+		std::lock_guard<std::mutex> lock{ mutex };
+		std::vector<Move> moves;
+		VkDeviceSize plannedBytes = 0;
+
+		// candidates grouped by their block, only blocks that can be emptied completely are worth draining
+		std::vector<Allocation*> sorted;
+		for (Allocation* allocation : candidates) {
+			if (allocation->block != nullptr && !isHostVisible(allocation->memoryTypeIndex)) {
+				sorted.push_back(allocation);
+			}
+		}
+		std::sort(sorted.begin(), sorted.end(), [](const Allocation* a, const Allocation* b) {
+			return a->block != b->block ? a->block < b->block : a->offset < b->offset;
+		});
+
+		for (auto& pool : pools) {
+			if (pool.blocks.size() < 2) continue;
+
+			std::vector<Block*> order;
+			for (auto& block : pool.blocks) {
+				if (!block->tlsf.isEmpty()) order.push_back(block.get());
+			}
+			std::sort(order.begin(), order.end(), [](const Block* a, const Block* b) {
+				return a->tlsf.getFreeSize() > b->tlsf.getFreeSize();
+			});
+
+			std::vector<Block*> targets; // blocks that received moves are not drained in the same pass
+			for (size_t source = 0; source + 1 < order.size(); source++) {
+				Block* block = order[source];
+				if (std::find(targets.begin(), targets.end(), block) != targets.end()) continue;
+
+				auto first = std::lower_bound(sorted.begin(), sorted.end(), block,
+					[](const Allocation* allocation, const Block* b) { return allocation->block < b; });
+				auto last = first;
+				while (last != sorted.end() && (*last)->block == block) ++last;
+				if (static_cast<uint32_t>(last - first) != block->tlsf.getAllocationCount()) continue;
+				// a block is drained in one pass, only the first one of a pass may go over maxBytes
+				if (plannedBytes > 0 && plannedBytes + block->size - block->tlsf.getFreeSize() > maxBytes) return moves;
+
+				// the block is only worth the copies if all of it fits somewhere else, otherwise the reserved ranges go back
+				const size_t blockMoves = moves.size();
+				VkDeviceSize blockBytes = 0;
+				for (auto it = first; it != last; ++it) {
+					Allocation* allocation = *it;
+					Move move{};
+					for (size_t target = source + 1; target < order.size(); target++) {
+						VkDeviceSize offset;
+						move.node = order[target]->tlsf.allocate(allocation->size, std::max(allocation->alignment, Tlsf::MIN_ALIGNMENT),
+							offset, move.size);
+						if (move.node == Tlsf::NONE) continue;
+
+						move.allocation = allocation;
+						move.memoryTypeIndex = allocation->memoryTypeIndex;
+						move.memory = order[target]->memory;
+						move.offset = offset;
+						move.block = order[target];
+						break;
+					}
+					if (move.allocation == nullptr) break;
+					moves.push_back(move);
+					blockBytes += allocation->size;
+				}
+				if (moves.size() - blockMoves != static_cast<size_t>(last - first)) {
+					for (size_t i = blockMoves; i < moves.size(); i++) {
+						moves[i].block->tlsf.free(moves[i].node);
+					}
+					moves.resize(blockMoves);
+					continue;
+				}
+				for (size_t i = blockMoves; i < moves.size(); i++) {
+					if (std::find(targets.begin(), targets.end(), moves[i].block) == targets.end()) targets.push_back(moves[i].block);
+				}
+				plannedBytes += blockBytes;
+				if (plannedBytes >= maxBytes) return moves;
+			}
+		}
+		return moves;
+	}
+
+	void VcuAllocator::commitMove(Move& move) {
+		std::lock_guard<std::mutex> lock{ mutex };
+		Allocation* allocation = move.allocation;
+		CategoryStats& stats = categoryStats[static_cast<uint32_t>(allocation->category)];
+		stats.current = stats.current - allocation->size + move.size;
+
+		std::swap(allocation->block, move.block);
+		std::swap(allocation->node, move.node);
+		std::swap(allocation->size, move.size);
+		allocation->memory = move.memory;
+		allocation->offset = move.offset;
+
+		defragmentationStats.movedAllocations++;
+		defragmentationStats.movedBytes += allocation->size;
+	}
+
+	void VcuAllocator::freeMoveSource(const Move& move) {
+		std::lock_guard<std::mutex> lock{ mutex };
+		move.block->tlsf.free(move.node);
+		if (releaseBlockIfSpare(move.block, move.memoryTypeIndex)) {
+			defragmentationStats.releasedBlocks++;
+		}
+	}
+
+	bool VcuAllocator::releaseEmptyBlocks(uint32_t heapIndex) {
+		bool released = false;
+		for (uint32_t poolIndex = 0; poolIndex < pools.size(); poolIndex++) {
+			const uint32_t memoryTypeIndex = poolIndex / 2;
+			if (memoryTypeIndex >= memoryProperties.memoryTypeCount ||
+				memoryProperties.memoryTypes[memoryTypeIndex].heapIndex != heapIndex) continue;
+
+			auto& blocks = pools[poolIndex].blocks;
+			for (auto it = blocks.begin(); it != blocks.end();) {
+				if ((*it)->tlsf.isEmpty()) {
+					freeMemory((*it)->memory, (*it)->size, memoryTypeIndex);
+					it = blocks.erase(it);
+					released = true;
+				}
+				else {
+					++it;
+				}
+			}
+		}
+		return released;
+	}
+
+	bool VcuAllocator::runBudgetCallbacks(uint32_t heapIndex, VkDeviceSize requiredSize) {
+		std::vector<BudgetCallback> callbacks;
+		{
+			std::lock_guard<std::mutex> lock{ mutex };
+			callbacks = budgetCallbacks;
+		}
+
+		bool released = false;
+		for (auto& callback : callbacks) {
+			released |= callback(heapIndex, requiredSize);
+		}
+		return released;
+	}
+
+	void VcuAllocator::addBudgetCallback(BudgetCallback callback) {
+		std::lock_guard<std::mutex> lock{ mutex };
+		budgetCallbacks.push_back(std::move(callback));
+	}
+
+	VkDeviceSize VcuAllocator::getHeapUsage(uint32_t heapIndex) const {
+		const HeapBudget& heap = heapBudgets[heapIndex];
+		if (getMemoryProperties2 == nullptr) return heap.allocated;
+
+		// the driver's number only changes on a query, our own allocations since then are added on top
+		if (heap.allocated >= heap.allocatedAtQuery) return heap.usage + (heap.allocated - heap.allocatedAtQuery);
+		return heap.usage - std::min(heap.usage, heap.allocatedAtQuery - heap.allocated);
+	}
+
+	void VcuAllocator::enableMemoryBudget(PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2) {
+		std::lock_guard<std::mutex> lock{ mutex };
+		this->getMemoryProperties2 = getMemoryProperties2;
+		updateBudgetLocked();
+	}
+
+	void VcuAllocator::updateBudget() {
+		std::lock_guard<std::mutex> lock{ mutex };
+		updateBudgetLocked();
+	}
+
+	void VcuAllocator::updateBudgetLocked() {
+		if (getMemoryProperties2 == nullptr) {
+			for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+				heapBudgets[i].budget = memoryProperties.memoryHeaps[i].size * FALLBACK_BUDGET_PERCENT / 100;
+			}
+			return;
+		}
+
+		VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+		budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+		VkPhysicalDeviceMemoryProperties2KHR properties{};
+		properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+		properties.pNext = &budgetProperties;
+		getMemoryProperties2(physicalDevice, &properties);
+
+		for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+			HeapBudget& heap = heapBudgets[i];
+			const VkDeviceSize heapSize = memoryProperties.memoryHeaps[i].size;
+			heap.usage = budgetProperties.heapUsage[i];
+			heap.allocatedAtQuery = heap.allocated;
+			// some drivers report nothing for heaps they do not track
+			heap.budget = budgetProperties.heapBudget[i] > 0
+				? std::min(budgetProperties.heapBudget[i], heapSize)
+				: heapSize * FALLBACK_BUDGET_PERCENT / 100;
+		}
+	}
+
+	VcuAllocator::Stats VcuAllocator::getStats() {
+		std::lock_guard<std::mutex> lock{ mutex };
+		Stats stats{};
+		stats.categories = categoryStats;
+		stats.defragmentation = defragmentationStats;
+		stats.heaps.resize(memoryProperties.memoryHeapCount);
+		for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+			HeapStats& heap = stats.heaps[i];
+			heap.allocated = heapBudgets[i].allocated;
+			heap.peak = heapBudgets[i].peak;
+			heap.usage = getHeapUsage(i);
+			heap.budget = heapBudgets[i].budget;
+			heap.size = memoryProperties.memoryHeaps[i].size;
+			heap.deviceLocal = (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+		}
+		return stats;
+	}
+
+	const char* VcuAllocator::getCategoryName(MemoryCategory category) {
+		switch (category) {
+		case MemoryCategory::Mesh: return "mesh";
+		case MemoryCategory::Texture: return "texture";
+		case MemoryCategory::Staging: return "staging";
+		case MemoryCategory::Uniform: return "uniform";
+		case MemoryCategory::Attachment: return "attachment";
+		default: return "other";
+		}
+	}
+
+	VkMappedMemoryRange VcuAllocator::mappedRange(const Allocation& allocation, VkDeviceSize size, VkDeviceSize offset) const {
+		if (size == VK_WHOLE_SIZE) {
+			size = allocation.size - offset;
+		}
+		const VkDeviceSize atom = std::max<VkDeviceSize>(nonCoherentAtomSize, 1);
+		const VkDeviceSize begin = (allocation.offset + offset) / atom * atom;
+		VkDeviceSize end = alignUp(allocation.offset + offset + size, atom);
+		if (allocation.block != nullptr) {
+			end = std::min(end, allocation.block->size);
+		}
+		else {
+			end = std::min(end, allocation.size);
+		}
+
+		VkMappedMemoryRange range{};
+		range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+		range.memory = allocation.memory;
+		range.offset = begin;
+		range.size = end - begin;
+		return range;
+	}
+}
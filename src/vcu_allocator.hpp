@@ -0,0 +1,260 @@
+#pragma once
+
+// libs
+#include <vulkan/vulkan.h>
+
+// std
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace vcu {
+	// Sub-allocates buffers and images from large VkDeviceMemory blocks, so the number of
+	// vkAllocateMemory calls stays far below maxMemoryAllocationCount. Every memory type has its own
+	// blocks, each managed by a TLSF allocator, and host visible blocks stay mapped for their whole
+	// life. Buffers and optimal tiling images live in separate blocks when bufferImageGranularity
+	// is above 1, so they can never share a granularity page. Attachments and resources bigger
+	// than half a block get memory of their own.
+	//
+	// Every allocation is accounted to a category, and new device memory is only allocated while
+	// its heap stays within budget. The budget comes from VK_EXT_memory_budget when the device
+	// has it, otherwise it is a fixed share of the heap size.
+	class VcuAllocator {
+	public:
+		static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64 * 1024 * 1024;
+
+		// what the memory is bound to, linear resources and optimal images need separate blocks
+		enum class ResourceKind : uint32_t { Linear = 0, Optimal = 1 };
+		// what the memory is used for, only for accounting
+		enum class MemoryCategory : uint32_t { Mesh, Texture, Staging, Uniform, Attachment, Other, Count };
+		static constexpr uint32_t MEMORY_CATEGORY_COUNT = static_cast<uint32_t>(MemoryCategory::Count);
+
+		struct CategoryStats {
+			VkDeviceSize current = 0; // bytes of the live allocations
+			VkDeviceSize peak = 0;
+			uint32_t allocationCount = 0;
+		};
+
+		struct HeapStats {
+			VkDeviceSize allocated = 0; // device memory this allocator holds in the heap, including free block space
+			VkDeviceSize peak = 0;
+			VkDeviceSize usage = 0; // of the whole process, estimated between budget queries
+			VkDeviceSize budget = 0;
+			VkDeviceSize size = 0;
+			bool deviceLocal = false;
+		};
+
+		// totals of the moves made by defragmentation
+		struct DefragmentationStats {
+			uint64_t movedAllocations = 0;
+			VkDeviceSize movedBytes = 0;
+			uint32_t releasedBlocks = 0;
+		};
+
+		struct Stats {
+			std::array<CategoryStats, MEMORY_CATEGORY_COUNT> categories{};
+			std::vector<HeapStats> heaps;
+			DefragmentationStats defragmentation{};
+		};
+
+		// Called when new device memory would exceed the budget of heapIndex. Returns true if it
+		// released something, the allocation is tried again then. Runs without the allocator lock,
+		// so it may free allocations.
+		using BudgetCallback = std::function<bool(uint32_t heapIndex, VkDeviceSize requiredSize)>;
+
+	private:
+		struct Block;
+
+	public:
+		// owned by the allocator, valid until it is passed to free
+		struct Allocation {
+			VkDeviceMemory memory = VK_NULL_HANDLE;
+			VkDeviceSize offset = 0; // of the allocation inside memory
+			VkDeviceSize size = 0;
+			void* mapped = nullptr; // start of the allocation for host visible memory
+			uint32_t memoryTypeIndex = 0;
+			MemoryCategory category = MemoryCategory::Other;
+
+		private:
+			friend class VcuAllocator;
+			Block* block = nullptr; // nullptr for dedicated allocations
+			uint32_t node = 0;
+			VkDeviceSize alignment = 0; // of the resource, for moves
+		};
+
+		// An allocation that is going to move to another block. The new range is reserved by
+		// planMoves, commitMove switches the allocation over to it and freeMoveSource gives the old
+		// range back once nothing uses it anymore.
+		struct Move {
+			Allocation* allocation = nullptr;
+			VkDeviceMemory memory = VK_NULL_HANDLE; // where the allocation goes
+			VkDeviceSize offset = 0;
+
+		private:
+			friend class VcuAllocator;
+			Block* block = nullptr; // the other range, the new one before commitMove and the old one after
+			uint32_t node = 0;
+			VkDeviceSize size = 0;
+			uint32_t memoryTypeIndex = 0; // the allocation may be gone by freeMoveSource
+		};
+
+		VcuAllocator(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE);
+		~VcuAllocator();
+
+		VcuAllocator(const VcuAllocator&) = delete;
+		VcuAllocator& operator=(const VcuAllocator&) = delete;
+
+		// allocates memory for the resource and binds it, throws if the heap stays over budget
+		Allocation* allocateForBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties, MemoryCategory category);
+		Allocation* allocateForImage(VkImage image, const VkImageCreateInfo& imageInfo, VkMemoryPropertyFlags properties,
+			MemoryCategory category);
+		Allocation* allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties,
+			ResourceKind kind, MemoryCategory category, bool dedicated = false);
+		void free(Allocation* allocation);
+
+		// Switches the budget over to VK_EXT_memory_budget, the device must have the extension
+		// enabled. getMemoryProperties2 is vkGetPhysicalDeviceMemoryProperties2(KHR).
+		void enableMemoryBudget(PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2);
+		// queries the budget again, it changes with the memory use of other processes
+		void updateBudget();
+		void addBudgetCallback(BudgetCallback callback);
+		uint32_t getHeapIndex(uint32_t memoryTypeIndex) const { return memoryProperties.memoryTypes[memoryTypeIndex].heapIndex; }
+		// allocates all memory with VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, so any buffer can have an address.
+		// Call before the first allocation, the device must have VK_KHR_buffer_device_address enabled.
+		void enableBufferDeviceAddress() { bufferDeviceAddress = true; }
+		Stats getStats();
+		static const char* getCategoryName(MemoryCategory category);
+
+		// Plans moves of candidates out of the least used blocks into fuller blocks of the same pool, until
+		// about maxBytes are planned. A block is only drained if all of its allocations are candidates and
+		// fit elsewhere. Only device local allocations that are not host visible are moved.
+		std::vector<Move> planMoves(const std::vector<Allocation*>& candidates, VkDeviceSize maxBytes);
+		void commitMove(Move& move);
+		void freeMoveSource(const Move& move);
+
+		// range for vkFlushMappedMemoryRanges / vkInvalidateMappedMemoryRanges, relative to the
+		// allocation and widened to nonCoherentAtomSize. VK_WHOLE_SIZE covers the rest of the allocation.
+		VkMappedMemoryRange mappedRange(const Allocation& allocation, VkDeviceSize size, VkDeviceSize offset) const;
+
+	private:
+		// Two level segregated fit allocator over one block. Free ranges are kept in lists per size
+		// class with bitmaps of the non empty lists, so allocate and free are O(1). Offsets and sizes
+		// are multiples of MIN_ALIGNMENT.
+		class Tlsf {
+		public:
+			static constexpr uint32_t NONE = UINT32_MAX;
+			static constexpr VkDeviceSize MIN_ALIGNMENT = 16;
+
+			explicit Tlsf(VkDeviceSize size);
+
+			// returns the node of the allocation or NONE if there is no free range big enough
+			uint32_t allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset, VkDeviceSize& allocatedSize);
+			// smallest empty Tlsf that allocate is sure to serve the request from, the request is
+			// padded for alignment and rounded up to the next size class like in findFree
+			static VkDeviceSize blockSizeFor(VkDeviceSize size, VkDeviceSize alignment);
+			void free(uint32_t node);
+
+			bool isEmpty() const { return allocationCount == 0; }
+			uint32_t getAllocationCount() const { return allocationCount; }
+			VkDeviceSize getFreeSize() const { return freeSize; }
+
+		private:
+			// sizes below 2^FL_OFFSET share the first list in steps of MIN_ALIGNMENT, every power of two
+			// above is split into SL_COUNT lists
+			static constexpr uint32_t SL_BITS = 4;
+			static constexpr uint32_t SL_COUNT = 1u << SL_BITS;
+			static constexpr uint32_t FL_OFFSET = 8;
+			static constexpr uint32_t FL_COUNT = 64 - FL_OFFSET + 1;
+
+			struct Node {
+				VkDeviceSize offset;
+				VkDeviceSize size;
+				uint32_t previousPhysical; // neighbours in address order
+				uint32_t nextPhysical;
+				uint32_t previousFree; // neighbours in the free list of the size class
+				uint32_t nextFree;
+				bool free;
+			};
+
+			static void mapping(VkDeviceSize size, uint32_t& fl, uint32_t& sl);
+			uint32_t findFree(VkDeviceSize size) const;
+			void insertFree(uint32_t node);
+			void removeFree(uint32_t node);
+			// splits the end of node off into a new free node
+			void splitAfter(uint32_t node, VkDeviceSize size);
+			void merge(uint32_t node, uint32_t next);
+			uint32_t createNode();
+
+			std::vector<Node> nodes;
+			std::vector<uint32_t> unusedNodes;
+			uint64_t flBitmap = 0;
+			std::array<uint32_t, FL_COUNT> slBitmap{};
+			std::array<std::array<uint32_t, SL_COUNT>, FL_COUNT> freeHeads;
+			VkDeviceSize freeSize;
+			uint32_t allocationCount = 0;
+		};
+
+		struct Block {
+			VkDeviceMemory memory;
+			VkDeviceSize size;
+			char* mapped; // whole block, nullptr if not host visible
+			uint32_t poolIndex;
+			Tlsf tlsf;
+		};
+
+		struct Pool {
+			std::vector<std::unique_ptr<Block>> blocks;
+		};
+
+		uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+		uint32_t getPoolIndex(uint32_t memoryTypeIndex, ResourceKind kind) const;
+		bool isHostVisible(uint32_t memoryTypeIndex) const;
+		bool isNonCoherent(uint32_t memoryTypeIndex) const;
+		// returns VK_NULL_HANDLE if the heap would go over budget or the device is out of memory
+		VkDeviceMemory allocateMemory(VkDeviceSize size, uint32_t memoryTypeIndex, void** mapped);
+		void freeMemory(VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryTypeIndex);
+		Allocation* allocateDedicated(VkDeviceSize size, uint32_t memoryTypeIndex);
+		Block* createBlock(VkDeviceSize minSize, uint32_t memoryTypeIndex, uint32_t poolIndex);
+		// returns nullptr if no device memory could be allocated
+		Allocation* tryAllocate(const VkMemoryRequirements& requirements, uint32_t memoryTypeIndex,
+			ResourceKind kind, bool dedicated);
+		// frees the empty blocks kept for reuse in the heap, returns true if there were any
+		bool releaseEmptyBlocks(uint32_t heapIndex);
+		// frees block if it is empty and the pool already keeps another empty one, returns true if it did
+		bool releaseBlockIfSpare(Block* block, uint32_t memoryTypeIndex);
+		// runs the budget callbacks, returns true if one of them released memory
+		bool runBudgetCallbacks(uint32_t heapIndex, VkDeviceSize requiredSize);
+		VkDeviceSize getHeapUsage(uint32_t heapIndex) const;
+		void updateBudgetLocked();
+
+		// only without VK_EXT_memory_budget, leaves room for other processes and the driver
+		static constexpr VkDeviceSize FALLBACK_BUDGET_PERCENT = 80;
+
+		struct HeapBudget {
+			VkDeviceSize allocated = 0;
+			VkDeviceSize peak = 0;
+			VkDeviceSize usage = 0; // reported by the driver
+			VkDeviceSize allocatedAtQuery = 0; // allocated when usage was reported
+			VkDeviceSize budget = 0;
+		};
+
+		VkPhysicalDevice physicalDevice;
+		VkDevice device;
+		VkPhysicalDeviceMemoryProperties memoryProperties;
+		VkDeviceSize bufferImageGranularity;
+		VkDeviceSize nonCoherentAtomSize;
+		VkDeviceSize preferredBlockSize;
+		std::array<Pool, VK_MAX_MEMORY_TYPES * 2> pools{};
+		uint32_t allocationCount = 0;
+		std::array<HeapBudget, VK_MAX_MEMORY_HEAPS> heapBudgets{};
+		std::array<CategoryStats, MEMORY_CATEGORY_COUNT> categoryStats{};
+		DefragmentationStats defragmentationStats{};
+		PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2 = nullptr;
+		bool bufferDeviceAddress = false;
+		std::vector<BudgetCallback> budgetCallbacks;
+		std::mutex mutex;
+	};
+}
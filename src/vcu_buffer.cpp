@@ -43,18 +43,68 @@ namespace vcu {
         memoryPropertyFlags{ memoryPropertyFlags } {
         alignmentSize = getAlignment(instanceSize, minOffsetAlignment);
         bufferSize = alignmentSize * instanceCount;
-        device.createBuffer(bufferSize, usageFlags, memoryPropertyFlags, buffer, memory);
+        device.createBuffer(bufferSize, usageFlags, memoryPropertyFlags, buffer, allocation);
     }
 
     VcuBuffer::~VcuBuffer() {
+        if (movable) {
+            vcuDevice.defragmenter().unregisterAllocation(allocation);
+        }
         unmap();
         vkDestroyBuffer(vcuDevice.device(), buffer, nullptr);
-        vkFreeMemory(vcuDevice.device(), memory, nullptr);
+        vcuDevice.allocator().free(allocation);
+    }
+
+    void VcuBuffer::allowMoves() {
+        assert(!(memoryPropertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && "Only device local buffers can move");
+        assert((usageFlags & VK_BUFFER_USAGE_TRANSFER_SRC_BIT) && (usageFlags & VK_BUFFER_USAGE_TRANSFER_DST_BIT) &&
+            "Moved buffers need transfer usage");
+        if (movable) return;
+        movable = true;
+
+        VcuDefragmenter::Handler handler;
+        handler.canMove = [this]() {
+            // uploads still running on the transfer queue would be missing from the copy, try again next pass
+            return vcuDevice.stagingRing().getAcquiredValue() >= uploadValue;
+        };
+        handler.recordMove = [this](VkCommandBuffer commandBuffer, VkDeviceMemory memory, VkDeviceSize offset) {
+            movedBuffer = vcuDevice.createBufferHandle(bufferSize, usageFlags);
+            vkBindBufferMemory(vcuDevice.device(), movedBuffer, memory, offset);
+
+            VkBufferCopy copyRegion{};
+            copyRegion.size = bufferSize;
+            vkCmdCopyBuffer(commandBuffer, buffer, movedBuffer, 1, &copyRegion);
+        };
+        handler.finishMove = [this]() {
+            VkDevice device = vcuDevice.device();
+            VkBuffer oldBuffer = buffer;
+            vcuDevice.defragmenter().destroyLater([device, oldBuffer]() { vkDestroyBuffer(device, oldBuffer, nullptr); });
+            buffer = movedBuffer;
+            movedBuffer = VK_NULL_HANDLE;
+            deviceAddress = 0;
+        };
+        vcuDevice.defragmenter().registerAllocation(allocation, std::move(handler));
+    }
+
+    void VcuBuffer::waitForMove() {
+        if (movable) {
+            vcuDevice.defragmenter().finishMove(allocation);
+        }
+    }
+
+    VkDeviceAddress VcuBuffer::getDeviceAddress() {
+        assert((usageFlags & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR) && "Buffer was created without device address usage");
+        if (deviceAddress == 0) {
+            deviceAddress = vcuDevice.getBufferDeviceAddress(buffer);
+        }
+        return deviceAddress;
     }
 
     /**
      * Map a memory range of this buffer. If successful, mapped points to the specified buffer range.
      *
+     * @note The allocator keeps host visible memory mapped, so this only hands out a pointer into it
+     *
      * @param size (Optional) Size of the memory range to map. Pass VK_WHOLE_SIZE to map the complete
      * buffer range.
      * @param offset (Optional) Byte offset from beginning
@@ -62,20 +112,23 @@ namespace vcu {
      * @return VkResult of the buffer mapping call
      */
     VkResult VcuBuffer::map(VkDeviceSize size, VkDeviceSize offset) {
-        assert(buffer && memory && "Called map on buffer before create");
-        return vkMapMemory(vcuDevice.device(), memory, offset, size, 0, &mapped);
+        assert(buffer && allocation && "Called map on buffer before create");
+        assert((size == VK_WHOLE_SIZE ? offset : offset + size) <= bufferSize && "Mapped range is outside the buffer");
+        (void)size; // the whole allocation is mapped already, size is only checked
+        if (allocation->mapped == nullptr) {
+            return VK_ERROR_MEMORY_MAP_FAILED;
+        }
+        mapped = static_cast<char*>(allocation->mapped) + offset;
+        return VK_SUCCESS;
     }
 
     /**
      * Unmap a mapped memory range
      *
-     * @note Does not return a result as vkUnmapMemory can't fail
+     * @note The memory itself stays mapped by the allocator until it is freed
      */
     void VcuBuffer::unmap() {
-        if (mapped) {
-            vkUnmapMemory(vcuDevice.device(), memory);
-            mapped = nullptr;
-        }
+        mapped = nullptr;
     }
 
     /**
@@ -112,11 +165,7 @@ namespace vcu {
      * @return VkResult of the flush call
      */
     VkResult VcuBuffer::flush(VkDeviceSize size, VkDeviceSize offset) {
-        VkMappedMemoryRange mappedRange = {};
-        mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-        mappedRange.memory = memory;
-        mappedRange.offset = offset;
-        mappedRange.size = size;
+        VkMappedMemoryRange mappedRange = vcuDevice.allocator().mappedRange(*allocation, size, offset);
         return vkFlushMappedMemoryRanges(vcuDevice.device(), 1, &mappedRange);
     }
 
@@ -132,11 +181,7 @@ namespace vcu {
      * @return VkResult of the invalidate call
      */
     VkResult VcuBuffer::invalidate(VkDeviceSize size, VkDeviceSize offset) {
-        VkMappedMemoryRange mappedRange = {};
-        mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-        mappedRange.memory = memory;
-        mappedRange.offset = offset;
-        mappedRange.size = size;
+        VkMappedMemoryRange mappedRange = vcuDevice.allocator().mappedRange(*allocation, size, offset);
         return vkInvalidateMappedMemoryRanges(vcuDevice.device(), 1, &mappedRange);
     }
 
@@ -2,6 +2,9 @@
 
 #include "vcu_device.hpp"
 
+// std
+#include <algorithm>
+
 namespace vcu {
 
     class VcuBuffer {
@@ -31,6 +34,20 @@ namespace vcu {
         VkDescriptorBufferInfo descriptorInfoForIndex(int index);
         VkResult invalidateIndex(int index);
 
+        // Lets the defragmenter move the buffer to another place in device memory, getBuffer returns a new
+        // handle afterwards. Only for device local buffers with TRANSFER_SRC and TRANSFER_DST usage that
+        // are written by transfers alone, each of them has to call waitForMove first.
+        void allowMoves();
+        void waitForMove();
+        // the staging ring upload that last wrote into the buffer, it is not moved before the graphics
+        // queue has acquired it, see VcuStagingRing::getAcquiredValue
+        void setUploadValue(uint64_t value) { uploadValue = std::max(uploadValue, value); }
+        uint64_t getUploadValue() const { return uploadValue; }
+
+        // for shaders reading through VK_KHR_buffer_device_address, the buffer needs
+        // VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR usage. Changes when the buffer moves.
+        VkDeviceAddress getDeviceAddress();
+
         VkBuffer getBuffer() const { return buffer; }
         void* getMappedMemory() const { return mapped; }
         uint32_t getInstanceCount() const { return instanceCount; }
@@ -46,7 +63,11 @@ namespace vcu {
         VcuDevice& vcuDevice;
         void* mapped = nullptr;
         VkBuffer buffer = VK_NULL_HANDLE;
-        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkBuffer movedBuffer = VK_NULL_HANDLE; // copy target of a move in flight
+        bool movable = false;
+        uint64_t uploadValue = 0;
+        VkDeviceAddress deviceAddress = 0; // queried on first use
+        VcuAllocator::Allocation* allocation = nullptr;
 
         VkDeviceSize bufferSize;
         uint32_t instanceCount;
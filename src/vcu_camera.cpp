@@ -104,4 +104,37 @@ namespace vcu {
 		inverseViewMatrix[3][1] = position.y;
 		inverseViewMatrix[3][2] = position.z;
 	}
-}	
\ No newline at end of file
+
+	float VcuCamera::projectedSize(const glm::vec3& center, float radius) const {
+		const float distance = glm::length(center - getPosition());
+		if (distance <= radius) return std::numeric_limits<float>::max();
+		return radius * glm::abs(projectionMatrix[1][1]) / distance;
+	}
+
+	Frustum VcuCamera::getFrustum() const {
+		// Gribb/Hartmann plane extraction, clip space depth is [0, 1]
+		const glm::mat4 viewProjection = projectionMatrix * viewMatrix;
+		auto row = [&](int i) {
+			return glm::vec4{ viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i] };
+		};
+
+		Frustum frustum{};
+		frustum.planes[0] = row(3) + row(0);
+		frustum.planes[1] = row(3) - row(0);
+		frustum.planes[2] = row(3) + row(1);
+		frustum.planes[3] = row(3) - row(1);
+		frustum.planes[4] = row(2);
+		frustum.planes[5] = row(3) - row(2);
+		for (auto& plane : frustum.planes) {
+			plane /= glm::length(glm::vec3{ plane });
+		}
+		return frustum;
+	}
+
+	bool Frustum::intersectsSphere(const glm::vec3& center, float radius) const {
+		for (const auto& plane : planes) {
+			if (glm::dot(glm::vec3{ plane }, center) + plane.w < -radius) return false;
+		}
+		return true;
+	}
+}
\ No newline at end of file
@@ -7,6 +7,11 @@
 
 namespace vcu {
 
+	struct Frustum {
+		glm::vec4 planes[6]{}; // xyz normal pointing inwards, w distance, world space
+
+		bool intersectsSphere(const glm::vec3& center, float radius) const;
+	};
 
 	class VcuCamera {
 	public:
@@ -23,6 +28,11 @@ namespace vcu {
 		const glm::mat4& getInverseView() const { return inverseViewMatrix; }
 		const glm::vec3 getPosition() const { return glm::vec3(inverseViewMatrix[3]); }
 
+		Frustum getFrustum() const;
+
+		// diameter of a world space sphere on screen as a fraction of the viewport height
+		float projectedSize(const glm::vec3& center, float radius) const;
+
 	private:
 		glm::mat4 projectionMatrix{ 1.f };
 		glm::mat4 viewMatrix{ 1.f };
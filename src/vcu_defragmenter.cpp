@@ -0,0 +1,147 @@
+#include "vcu_defragmenter.hpp"
+
+#include "vcu_device.hpp"
+#include "vcu_swap_chain.hpp"
+
+// std
+#include <algorithm>
+#include <stdexcept>
+
+namespace vcu {
+	namespace {
+		// a frame that may use an old resource can start up to MAX_FRAMES_IN_FLIGHT frames after the
+		// switch, before its descriptor set is written again, and takes as many frames to finish
+		constexpr uint64_t RETIRE_FRAMES = 2 * VcuSwapChain::MAX_FRAMES_IN_FLIGHT;
+	}
+
+	VcuDefragmenter::VcuDefragmenter(VcuDevice& device, VkDeviceSize bytesPerFrame)
+		: vcuDevice{ device }, bytesPerFrame{ bytesPerFrame } {
+		VkFenceCreateInfo fenceInfo{};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		if (vkCreateFence(vcuDevice.device(), &fenceInfo, nullptr, &fence) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create defragmentation fence!");
+		}
+	}
+
+	VcuDefragmenter::~VcuDefragmenter() {
+		if (!moves.empty()) {
+			finishPass();
+		}
+		// the device is idle by now
+		for (auto& entry : retired) {
+			entry.destroy();
+		}
+		vkDestroyFence(vcuDevice.device(), fence, nullptr);
+	}
+
+	void VcuDefragmenter::registerAllocation(VcuAllocator::Allocation* allocation, Handler handler) {
+		handlers[allocation] = std::move(handler);
+	}
+
+	void VcuDefragmenter::unregisterAllocation(VcuAllocator::Allocation* allocation) {
+		finishMove(allocation);
+		handlers.erase(allocation);
+	}
+
+	void VcuDefragmenter::finishMove(VcuAllocator::Allocation* allocation) {
+		if (isMoving(allocation)) {
+			finishPass();
+		}
+	}
+
+	bool VcuDefragmenter::isMoving(VcuAllocator::Allocation* allocation) const {
+		return std::any_of(moves.begin(), moves.end(),
+			[allocation](const VcuAllocator::Move& move) { return move.allocation == allocation; });
+	}
+
+	void VcuDefragmenter::destroyLater(std::function<void()> destroy) {
+		retired.push_back({ frame, std::move(destroy) });
+	}
+
+	void VcuDefragmenter::update() {
+		frame++;
+		while (!retired.empty() && retired.front().frame + RETIRE_FRAMES <= frame) {
+			retired.front().destroy();
+			retired.pop_front();
+		}
+
+		if (!moves.empty()) {
+			if (vkGetFenceStatus(vcuDevice.device(), fence) == VK_SUCCESS) {
+				finishPass();
+			}
+			return;
+		}
+		if (handlers.empty()) return;
+
+		std::vector<VcuAllocator::Allocation*> candidates;
+		candidates.reserve(handlers.size());
+		for (auto& kv : handlers) {
+			if (!kv.second.canMove || kv.second.canMove()) {
+				candidates.push_back(kv.first);
+			}
+		}
+		moves = vcuDevice.allocator().planMoves(candidates, bytesPerFrame);
+		if (moves.empty()) return;
+
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandPool = vcuDevice.getCommandPool();
+		allocInfo.commandBufferCount = 1;
+		if (vkAllocateCommandBuffers(vcuDevice.device(), &allocInfo, &commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate defragmentation command buffer!");
+		}
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+		// frames submitted before may still write the sources, the copies have to see their writes
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		for (auto& move : moves) {
+			handlers[move.allocation].recordMove(commandBuffer, move.memory, move.offset);
+		}
+
+		// frames submitted after the switch read the copies
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+			VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+		vkEndCommandBuffer(commandBuffer);
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffer;
+		if (vkQueueSubmit(vcuDevice.graphicsQueue(), 1, &submitInfo, fence) != VK_SUCCESS) {
+			throw std::runtime_error("failed to submit defragmentation copies!");
+		}
+	}
+
+	void VcuDefragmenter::finishPass() {
+		vkWaitForFences(vcuDevice.device(), 1, &fence, VK_TRUE, UINT64_MAX);
+		vkResetFences(vcuDevice.device(), 1, &fence);
+		vkFreeCommandBuffers(vcuDevice.device(), vcuDevice.getCommandPool(), 1, &commandBuffer);
+		commandBuffer = VK_NULL_HANDLE;
+
+		VcuAllocator& allocator = vcuDevice.allocator();
+		std::vector<VcuAllocator::Move> finished;
+		finished.swap(moves);
+		for (auto& move : finished) {
+			allocator.commitMove(move);
+			handlers[move.allocation].finishMove();
+			// queued after the owner's old resource, so it is destroyed before its memory is reused
+			destroyLater([&allocator, move]() { allocator.freeMoveSource(move); });
+		}
+		generation++;
+	}
+}
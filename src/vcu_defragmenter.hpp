@@ -0,0 +1,76 @@
+#pragma once
+
+#include "vcu_allocator.hpp"
+
+// std
+#include <deque>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace vcu {
+	class VcuDevice;
+
+	// Moves device local allocations out of sparsely used blocks a few megabytes per frame, so the
+	// blocks can be freed again in long sessions that keep loading and unloading assets. Owners opt
+	// in per allocation with a Handler, which creates the resource again at the new place and
+	// records the copy, and switches over to it once the copy has finished. The old resources are
+	// destroyed when no frame in flight can use them anymore.
+	class VcuDefragmenter {
+	public:
+		static constexpr VkDeviceSize DEFAULT_BYTES_PER_FRAME = 8 * 1024 * 1024;
+
+		struct Handler {
+			// creates the resource bound to memory at offset and records the copy of the contents
+			std::function<void(VkCommandBuffer commandBuffer, VkDeviceMemory memory, VkDeviceSize offset)> recordMove;
+			// switches the owner over to the new resource, the old one goes to destroyLater
+			std::function<void()> finishMove;
+			// optional, the allocation is left out of the pass while it returns false
+			std::function<bool()> canMove;
+		};
+
+		explicit VcuDefragmenter(VcuDevice& device, VkDeviceSize bytesPerFrame = DEFAULT_BYTES_PER_FRAME);
+		~VcuDefragmenter();
+
+		VcuDefragmenter(const VcuDefragmenter&) = delete;
+		VcuDefragmenter& operator=(const VcuDefragmenter&) = delete;
+
+		void registerAllocation(VcuAllocator::Allocation* allocation, Handler handler);
+		// call before the allocation is freed, finishes a move of it that is still in flight
+		void unregisterAllocation(VcuAllocator::Allocation* allocation);
+		// Waits for a move of the allocation that is still in flight and switches over to the new
+		// resource. Owners call this before they write to the resource again.
+		void finishMove(VcuAllocator::Allocation* allocation);
+
+		// runs destroy once every frame that might still use the old resource has finished
+		void destroyLater(std::function<void()> destroy);
+
+		// call once per frame after its fence has been waited on, starts or finishes a pass of moves
+		void update();
+		// Counts the passes that switched resources over. Descriptor sets written before the
+		// current generation may still point at old resources and have to be written again.
+		uint64_t getGeneration() const { return generation; }
+
+	private:
+		struct Retired {
+			uint64_t frame;
+			std::function<void()> destroy;
+		};
+
+		bool isMoving(VcuAllocator::Allocation* allocation) const;
+		void finishPass();
+
+		VcuDevice& vcuDevice;
+		VkDeviceSize bytesPerFrame;
+		std::unordered_map<VcuAllocator::Allocation*, Handler> handlers;
+
+		// the pass in flight
+		std::vector<VcuAllocator::Move> moves;
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkFence fence = VK_NULL_HANDLE;
+
+		std::deque<Retired> retired;
+		uint64_t frame = 0;
+		uint64_t generation = 0;
+	};
+}
@@ -1,6 +1,7 @@
 #include "vcu_device.hpp"
 
 // std headers
+#include <cassert>
 #include <cstring>
 #include <iostream>
 #include <set>
@@ -8,6 +9,25 @@
 
 namespace vcu {
 
+namespace {
+VcuAllocator::MemoryCategory bufferCategory(VkBufferUsageFlags usage) {
+  if (usage & (VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT)) {
+    return VcuAllocator::MemoryCategory::Mesh;
+  }
+  if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT) return VcuAllocator::MemoryCategory::Uniform;
+  if (usage == VK_BUFFER_USAGE_TRANSFER_SRC_BIT) return VcuAllocator::MemoryCategory::Staging;
+  return VcuAllocator::MemoryCategory::Other;
+}
+
+VcuAllocator::MemoryCategory imageCategory(VkImageUsageFlags usage) {
+  if (usage & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)) {
+    return VcuAllocator::MemoryCategory::Attachment;
+  }
+  if (usage & VK_IMAGE_USAGE_SAMPLED_BIT) return VcuAllocator::MemoryCategory::Texture;
+  return VcuAllocator::MemoryCategory::Other;
+}
+}  // namespace
+
 // local callback functions
 static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
     VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
@@ -54,9 +74,43 @@ VcuDevice::VcuDevice(VcuWindow &window) : window{window} {
   pickPhysicalDevice();
   createLogicalDevice();
   createCommandPool();
+  allocator_ = std::make_unique<VcuAllocator>(physicalDevice, device_);
+  if (memoryBudgetEnabled) {
+    auto getMemoryProperties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)vkGetInstanceProcAddr(
+        instance,
+        "vkGetPhysicalDeviceMemoryProperties2KHR");
+    if (getMemoryProperties2 != nullptr) {
+      allocator_->enableMemoryBudget(getMemoryProperties2);
+      if (enableValidationLayers) {
+        std::cout << "using VK_EXT_memory_budget" << std::endl;
+      }
+    }
+  }
+  if (hasBufferDeviceAddress()) {
+    allocator_->enableBufferDeviceAddress();
+  }
+  stagingRing_ = std::make_unique<VcuStagingRing>(
+      device_,
+      *allocator_,
+      transferCommandPool,
+      transferQueue_,
+      queueFamilies.transferFamilyHasValue ? queueFamilies.transferFamily : queueFamilies.graphicsFamily,
+      queueFamilies.graphicsFamily,
+      queueFamilies.transferFamilyHasValue ? queueFamilies.transferRowGranularity : 1);
+  // the ring is idle most of the time, it gives its memory back when a heap runs out
+  allocator_->addBudgetCallback(
+      [this](uint32_t heapIndex, VkDeviceSize) { return stagingRing_->trim(heapIndex); });
+  defragmenter_ = std::make_unique<VcuDefragmenter>(*this);
 }
 
 VcuDevice::~VcuDevice() {
+  vkDeviceWaitIdle(device_);
+  defragmenter_.reset();
+  stagingRing_.reset();
+  allocator_.reset();
+  if (transferCommandPool != commandPool) {
+    vkDestroyCommandPool(device_, transferCommandPool, nullptr);
+  }
   vkDestroyCommandPool(device_, commandPool, nullptr);
   vkDestroyDevice(device_, nullptr);
 
@@ -86,6 +140,21 @@ void VcuDevice::createInstance() {
   createInfo.pApplicationInfo = &appInfo;
 
   auto extensions = getRequiredExtensions();
+  uint32_t availableCount = 0;
+  vkEnumerateInstanceExtensionProperties(nullptr, &availableCount, nullptr);
+  std::vector<VkExtensionProperties> availableExtensions(availableCount);
+  vkEnumerateInstanceExtensionProperties(nullptr, &availableCount, availableExtensions.data());
+  for (const auto &extension : availableExtensions) {
+    if (strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0) {
+      extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+      properties2Enabled = true;
+    }
+    // VkMemoryAllocateFlagsInfo for buffer device addresses
+    if (strcmp(extension.extensionName, VK_KHR_DEVICE_GROUP_CREATION_EXTENSION_NAME) == 0) {
+      extensions.push_back(VK_KHR_DEVICE_GROUP_CREATION_EXTENSION_NAME);
+      deviceGroupCreationEnabled = true;
+    }
+  }
   createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
   createInfo.ppEnabledExtensionNames = extensions.data();
 
@@ -135,9 +204,13 @@ void VcuDevice::pickPhysicalDevice() {
 
 void VcuDevice::createLogicalDevice() {
   QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+  queueFamilies = indices;
 
   std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
   std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily, indices.presentFamily};
+  if (indices.transferFamilyHasValue) {
+    uniqueQueueFamilies.insert(indices.transferFamily);
+  }
 
   float queuePriority = 1.0f;
   for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -158,9 +231,37 @@ void VcuDevice::createLogicalDevice() {
   createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
   createInfo.pQueueCreateInfos = queueCreateInfos.data();
 
+  std::vector<const char *> enabledExtensions = deviceExtensions;
+  if (properties2Enabled && isDeviceExtensionAvailable(physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)) {
+    enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    memoryBudgetEnabled = true;
+  }
+
+  VkPhysicalDeviceBufferDeviceAddressFeaturesKHR bufferDeviceAddressFeatures{};
+  bufferDeviceAddressFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES_KHR;
+  auto getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(
+      instance,
+      "vkGetPhysicalDeviceFeatures2KHR");
+  if (properties2Enabled && deviceGroupCreationEnabled && getFeatures2 != nullptr &&
+      isDeviceExtensionAvailable(physicalDevice, VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME) &&
+      isDeviceExtensionAvailable(physicalDevice, VK_KHR_DEVICE_GROUP_EXTENSION_NAME)) {
+    VkPhysicalDeviceFeatures2KHR features2{};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+    features2.pNext = &bufferDeviceAddressFeatures;
+    getFeatures2(physicalDevice, &features2);
+    if (bufferDeviceAddressFeatures.bufferDeviceAddress) {
+      enabledExtensions.push_back(VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME);
+      enabledExtensions.push_back(VK_KHR_DEVICE_GROUP_EXTENSION_NAME);
+      bufferDeviceAddressFeatures.pNext = nullptr;
+      bufferDeviceAddressFeatures.bufferDeviceAddressCaptureReplay = VK_FALSE;
+      bufferDeviceAddressFeatures.bufferDeviceAddressMultiDevice = VK_FALSE;
+      createInfo.pNext = &bufferDeviceAddressFeatures;
+    }
+  }
+
   createInfo.pEnabledFeatures = &deviceFeatures;
-  createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-  createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+  createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+  createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
   // might not really be necessary anymore because device specific validation layers
   // have been deprecated
@@ -175,8 +276,24 @@ void VcuDevice::createLogicalDevice() {
     throw std::runtime_error("failed to create logical device!");
   }
 
+  if (createInfo.pNext == &bufferDeviceAddressFeatures) {
+    getBufferDeviceAddress_ =
+        (PFN_vkGetBufferDeviceAddressKHR)vkGetDeviceProcAddr(device_, "vkGetBufferDeviceAddressKHR");
+    if (getBufferDeviceAddress_ != nullptr && enableValidationLayers) {
+      std::cout << "using VK_KHR_buffer_device_address" << std::endl;
+    }
+  }
+
   vkGetDeviceQueue(device_, indices.graphicsFamily, 0, &graphicsQueue_);
   vkGetDeviceQueue(device_, indices.presentFamily, 0, &presentQueue_);
+  if (indices.transferFamilyHasValue) {
+    vkGetDeviceQueue(device_, indices.transferFamily, 0, &transferQueue_);
+    if (enableValidationLayers) {
+      std::cout << "using dedicated transfer queue family " << indices.transferFamily << std::endl;
+    }
+  } else {
+    transferQueue_ = graphicsQueue_;
+  }
 }
 
 void VcuDevice::createCommandPool() {
@@ -191,6 +308,14 @@ void VcuDevice::createCommandPool() {
   if (vkCreateCommandPool(device_, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
     throw std::runtime_error("failed to create command pool!");
   }
+
+  transferCommandPool = commandPool;
+  if (queueFamilyIndices.transferFamilyHasValue) {
+    poolInfo.queueFamilyIndex = queueFamilyIndices.transferFamily;
+    if (vkCreateCommandPool(device_, &poolInfo, nullptr, &transferCommandPool) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create transfer command pool!");
+    }
+  }
 }
 
 void VcuDevice::createSurface() { window.createWindowSurface(instance, &surface_); }
@@ -317,6 +442,20 @@ bool VcuDevice::checkDeviceExtensionSupport(VkPhysicalDevice device) {
   return requiredExtensions.empty();
 }
 
+bool VcuDevice::isDeviceExtensionAvailable(VkPhysicalDevice device, const char *extensionName) {
+  uint32_t extensionCount;
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+  std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+  for (const auto &extension : availableExtensions) {
+    if (strcmp(extension.extensionName, extensionName) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
 QueueFamilyIndices VcuDevice::findQueueFamilies(VkPhysicalDevice device) {
   QueueFamilyIndices indices;
 
@@ -345,6 +484,21 @@ QueueFamilyIndices VcuDevice::findQueueFamilies(VkPhysicalDevice device) {
     i++;
   }
 
+  // a family without graphics and compute is a separate copy engine that runs next to rendering.
+  // A granularity of zero only allows whole mip levels, images are uploaded in row chunks so those
+  // families are skipped and the graphics queue does the copies.
+  for (uint32_t family = 0; family < queueFamilyCount; family++) {
+    const VkQueueFlags flags = queueFamilies[family].queueFlags;
+    const VkExtent3D granularity = queueFamilies[family].minImageTransferGranularity;
+    if (queueFamilies[family].queueCount > 0 && (flags & VK_QUEUE_TRANSFER_BIT) &&
+        !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) && granularity.height > 0) {
+      indices.transferFamily = family;
+      indices.transferRowGranularity = granularity.height;
+      indices.transferFamilyHasValue = true;
+      break;
+    }
+  }
+
   return indices;
 }
 
@@ -408,30 +562,47 @@ void VcuDevice::createBuffer(
     VkBufferUsageFlags usage,
     VkMemoryPropertyFlags properties,
     VkBuffer &buffer,
-    VkDeviceMemory &bufferMemory) {
+    VcuAllocator::Allocation *&bufferAllocation) {
+  buffer = createBufferHandle(size, usage);
+
+  try {
+    bufferAllocation = allocator_->allocateForBuffer(buffer, properties, bufferCategory(usage));
+  } catch (...) {
+    vkDestroyBuffer(device_, buffer, nullptr);
+    buffer = VK_NULL_HANDLE;
+    throw;
+  }
+}
+
+VkDeviceAddress VcuDevice::getBufferDeviceAddress(VkBuffer buffer) {
+  assert(hasBufferDeviceAddress() && "VK_KHR_buffer_device_address is not enabled");
+  VkBufferDeviceAddressInfoKHR addressInfo{};
+  addressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO_KHR;
+  addressInfo.buffer = buffer;
+  return getBufferDeviceAddress_(device_, &addressInfo);
+}
+
+VkBuffer VcuDevice::createBufferHandle(VkDeviceSize size, VkBufferUsageFlags usage) {
   VkBufferCreateInfo bufferInfo{};
   bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
   bufferInfo.size = size;
   bufferInfo.usage = usage;
   bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-  if (vkCreateBuffer(device_, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
-    throw std::runtime_error("failed to create vertex buffer!");
+  // upload targets are written by the transfer queue while the graphics queue reads other ranges,
+  // concurrent sharing saves an ownership transfer per range
+  const uint32_t sharedFamilies[] = {queueFamilies.graphicsFamily, queueFamilies.transferFamily};
+  if (hasDedicatedTransferQueue() && (usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT)) {
+    bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    bufferInfo.queueFamilyIndexCount = 2;
+    bufferInfo.pQueueFamilyIndices = sharedFamilies;
   }
 
-  VkMemoryRequirements memRequirements;
-  vkGetBufferMemoryRequirements(device_, buffer, &memRequirements);
-
-  VkMemoryAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memRequirements.size;
-  allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-  if (vkAllocateMemory(device_, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-    throw std::runtime_error("failed to allocate vertex buffer memory!");
+  VkBuffer buffer;
+  if (vkCreateBuffer(device_, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create vertex buffer!");
   }
-
-  vkBindBufferMemory(device_, buffer, bufferMemory, 0);
+  return buffer;
 }
 
 VkCommandBuffer VcuDevice::beginSingleTimeCommands() {
@@ -449,29 +620,45 @@ VkCommandBuffer VcuDevice::beginSingleTimeCommands() {
   beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
   vkBeginCommandBuffer(commandBuffer, &beginInfo);
+  stagingRing_->acquireCompleted(commandBuffer);
   return commandBuffer;
 }
 
-void VcuDevice::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
+void VcuDevice::endSingleTimeCommands(VkCommandBuffer commandBuffer, VkSemaphore waitSemaphore) {
   vkEndCommandBuffer(commandBuffer);
 
   VkSubmitInfo submitInfo{};
   submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
   submitInfo.commandBufferCount = 1;
   submitInfo.pCommandBuffers = &commandBuffer;
+  const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+  if (waitSemaphore != VK_NULL_HANDLE) {
+    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pWaitSemaphores = &waitSemaphore;
+    submitInfo.pWaitDstStageMask = &waitStage;
+  }
 
-  vkQueueSubmit(graphicsQueue_, 1, &submitInfo, VK_NULL_HANDLE);
-  vkQueueWaitIdle(graphicsQueue_);
+  // waits for these commands only, frames in flight on the same queue keep running
+  VkFenceCreateInfo fenceInfo{};
+  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  VkFence fence;
+  if (vkCreateFence(device_, &fenceInfo, nullptr, &fence) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create fence!");
+  }
+  vkQueueSubmit(graphicsQueue_, 1, &submitInfo, fence);
+  vkWaitForFences(device_, 1, &fence, VK_TRUE, UINT64_MAX);
+  vkDestroyFence(device_, fence, nullptr);
 
   vkFreeCommandBuffers(device_, commandPool, 1, &commandBuffer);
 }
 
-void VcuDevice::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
+void VcuDevice::copyBuffer(
+    VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset, VkDeviceSize dstOffset) {
   VkCommandBuffer commandBuffer = beginSingleTimeCommands();
 
   VkBufferCopy copyRegion{};
-  copyRegion.srcOffset = 0;  // Optional
-  copyRegion.dstOffset = 0;  // Optional
+  copyRegion.srcOffset = srcOffset;
+  copyRegion.dstOffset = dstOffset;
   copyRegion.size = size;
   vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
 
@@ -509,26 +696,55 @@ void VcuDevice::createImageWithInfo(
     const VkImageCreateInfo &imageInfo,
     VkMemoryPropertyFlags properties,
     VkImage &image,
-    VkDeviceMemory &imageMemory) {
+    VcuAllocator::Allocation *&imageAllocation) {
   if (vkCreateImage(device_, &imageInfo, nullptr, &image) != VK_SUCCESS) {
     throw std::runtime_error("failed to create image!");
   }
 
-  VkMemoryRequirements memRequirements;
-  vkGetImageMemoryRequirements(device_, image, &memRequirements);
+  try {
+    imageAllocation = allocator_->allocateForImage(image, imageInfo, properties, imageCategory(imageInfo.usage));
+  } catch (...) {
+    vkDestroyImage(device_, image, nullptr);
+    image = VK_NULL_HANDLE;
+    throw;
+  }
+}
 
-  VkMemoryAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memRequirements.size;
-  allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+void VcuDevice::updateMemoryBudget() {
+  allocator_->updateBudget();
 
-  if (vkAllocateMemory(device_, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-    throw std::runtime_error("failed to allocate image memory!");
+  if (!enableValidationLayers) return;
+  const auto now = std::chrono::steady_clock::now();
+  if (now - lastMemoryLog >= MEMORY_LOG_INTERVAL) {
+    lastMemoryLog = now;
+    logMemoryStats();
   }
+}
+
+void VcuDevice::logMemoryStats() {
+  constexpr VkDeviceSize MiB = 1024 * 1024;
+  const VcuAllocator::Stats stats = allocator_->getStats();
 
-  if (vkBindImageMemory(device_, image, imageMemory, 0) != VK_SUCCESS) {
-    throw std::runtime_error("failed to bind image memory!");
+  std::cout << "GPU memory:";
+  for (uint32_t i = 0; i < stats.heaps.size(); i++) {
+    const VcuAllocator::HeapStats &heap = stats.heaps[i];
+    if (heap.peak == 0) continue;
+    std::cout << " heap " << i << (heap.deviceLocal ? " (local) " : " ") << heap.usage / MiB << "/"
+              << heap.budget / MiB << " MiB, peak " << heap.peak / MiB << " MiB;";
+  }
+  for (uint32_t i = 0; i < VcuAllocator::MEMORY_CATEGORY_COUNT; i++) {
+    const auto category = static_cast<VcuAllocator::MemoryCategory>(i);
+    const VcuAllocator::CategoryStats &categoryStats = stats.categories[i];
+    if (categoryStats.peak == 0) continue;
+    std::cout << " " << VcuAllocator::getCategoryName(category) << " " << categoryStats.current / MiB << " MiB ("
+              << categoryStats.allocationCount << ")";
+  }
+  if (stats.defragmentation.movedAllocations > 0) {
+    std::cout << "; defragmentation moved " << stats.defragmentation.movedAllocations << " allocations ("
+              << stats.defragmentation.movedBytes / MiB << " MiB), released "
+              << stats.defragmentation.releasedBlocks << " blocks";
   }
+  std::cout << std::endl;
 }
 
 }  // namespace lve
\ No newline at end of file
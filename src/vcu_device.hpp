@@ -1,8 +1,13 @@
 #pragma once
 
 #include "vcu_window.hpp"
+#include "vcu_allocator.hpp"
+#include "vcu_staging_ring.hpp"
+#include "vcu_defragmenter.hpp"
 
 // std lib headers
+#include <chrono>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -17,8 +22,11 @@ struct SwapChainSupportDetails {
 struct QueueFamilyIndices {
   uint32_t graphicsFamily;
   uint32_t presentFamily;
+  uint32_t transferFamily;  // transfer only family, usually backed by a DMA engine
+  uint32_t transferRowGranularity = 1;  // minImageTransferGranularity.height of transferFamily
   bool graphicsFamilyHasValue = false;
   bool presentFamilyHasValue = false;
+  bool transferFamilyHasValue = false;
   bool isComplete() { return graphicsFamilyHasValue && presentFamilyHasValue; }
 };
 
@@ -45,6 +53,20 @@ class VcuDevice {
   VkSurfaceKHR surface() { return surface_; }
   VkQueue graphicsQueue() { return graphicsQueue_; }
   VkQueue presentQueue() { return presentQueue_; }
+  // the graphics queue if the device has no dedicated transfer family
+  VkQueue transferQueue() { return transferQueue_; }
+  bool hasDedicatedTransferQueue() { return transferQueue_ != graphicsQueue_; }
+  const QueueFamilyIndices &queueFamilyIndices() { return queueFamilies; }
+  VcuAllocator &allocator() { return *allocator_; }
+  VcuStagingRing &stagingRing() { return *stagingRing_; }
+  VcuDefragmenter &defragmenter() { return *defragmenter_; }
+
+  // per category and per heap numbers, heap usage and budget come from VK_EXT_memory_budget if available
+  VcuAllocator::Stats memoryStats() { return allocator_->getStats(); }
+  // call once per frame, refreshes the budget and in debug builds logs the stats every MEMORY_LOG_INTERVAL
+  void updateMemoryBudget();
+  void logMemoryStats();
+  static constexpr std::chrono::seconds MEMORY_LOG_INTERVAL{10};
 
   SwapChainSupportDetails getSwapChainSupport() { return querySwapChainSupport(physicalDevice); }
   uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
@@ -58,10 +80,18 @@ class VcuDevice {
       VkBufferUsageFlags usage,
       VkMemoryPropertyFlags properties,
       VkBuffer &buffer,
-      VkDeviceMemory &bufferMemory);
+      VcuAllocator::Allocation *&bufferAllocation);
+  // the buffer without memory, with the sharing mode createBuffer would pick
+  VkBuffer createBufferHandle(VkDeviceSize size, VkBufferUsageFlags usage);
+  // true if buffers created with VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR can be read by
+  // shaders through their address
+  bool hasBufferDeviceAddress() { return getBufferDeviceAddress_ != nullptr; }
+  VkDeviceAddress getBufferDeviceAddress(VkBuffer buffer);
   VkCommandBuffer beginSingleTimeCommands();
-  void endSingleTimeCommands(VkCommandBuffer commandBuffer);
-  void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
+  // waitSemaphore, if set, is waited on before any of the commands run
+  void endSingleTimeCommands(VkCommandBuffer commandBuffer, VkSemaphore waitSemaphore = VK_NULL_HANDLE);
+  void copyBuffer(
+      VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset = 0, VkDeviceSize dstOffset = 0);
   void copyBufferToImage(
       VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount);
 
@@ -69,7 +99,7 @@ class VcuDevice {
       const VkImageCreateInfo &imageInfo,
       VkMemoryPropertyFlags properties,
       VkImage &image,
-      VkDeviceMemory &imageMemory);
+      VcuAllocator::Allocation *&imageAllocation);
 
   VkPhysicalDeviceProperties properties;
 
@@ -90,17 +120,29 @@ class VcuDevice {
   void hasGflwRequiredInstanceExtensions();
   bool checkDeviceExtensionSupport(VkPhysicalDevice device);
   SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device);
+  bool isDeviceExtensionAvailable(VkPhysicalDevice device, const char *extensionName);
 
   VkInstance instance;
   VkDebugUtilsMessengerEXT debugMessenger;
   VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
   VcuWindow &window;
   VkCommandPool commandPool;
+  VkCommandPool transferCommandPool;
+  QueueFamilyIndices queueFamilies;
 
   VkDevice device_;
   VkSurfaceKHR surface_;
   VkQueue graphicsQueue_;
   VkQueue presentQueue_;
+  VkQueue transferQueue_;
+  std::unique_ptr<VcuAllocator> allocator_;
+  std::unique_ptr<VcuStagingRing> stagingRing_;
+  std::unique_ptr<VcuDefragmenter> defragmenter_;
+  bool properties2Enabled = false;  // VK_KHR_get_physical_device_properties2, needed for the budget
+  bool memoryBudgetEnabled = false;
+  bool deviceGroupCreationEnabled = false;  // VK_KHR_device_group_creation, needed for buffer device addresses
+  PFN_vkGetBufferDeviceAddressKHR getBufferDeviceAddress_ = nullptr;
+  std::chrono::steady_clock::time_point lastMemoryLog{};
 
   const std::vector<const char *> validationLayers = {"VK_LAYER_KHRONOS_validation"};
   const std::vector<const char *> deviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
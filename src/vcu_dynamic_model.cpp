@@ -0,0 +1,184 @@
+#include "vcu_dynamic_model.hpp"
+#include "vcu_swap_chain.hpp"
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iterator>
+
+namespace vcu {
+
+	namespace {
+		constexpr VkDeviceSize VERTEX_STRIDE = VcuModel::StandardVertexLayout::stride;
+
+		void writeVertices(const VcuModel::Vertex* vertices, size_t count, char* out) {
+			for (size_t i = 0; i < count; i++) {
+				const VcuModel::Vertex& vertex = vertices[i];
+				VcuModel::StandardVertexLayout::write(out + i * VERTEX_STRIDE, vertex.position, vertex.color, vertex.normal, vertex.uv);
+			}
+		}
+	}
+
+	VcuDynamicModel::VcuDynamicModel(VcuGeometryPool& pool, const std::vector<Vertex>& initialVertices,
+		const std::vector<uint32_t>& initialIndices, uint32_t vertexCapacity, uint32_t indexCapacity, VkDeviceSize stagingSize)
+		: geometryPool{ pool }, vertices{ initialVertices }, indices{ initialIndices },
+		vertexCount{ static_cast<uint32_t>(initialVertices.size()) }, indexCount{ static_cast<uint32_t>(initialIndices.size()) },
+		stagingSize{ stagingSize } {
+		assert(stagingSize >= VERTEX_STRIDE && "Staging size must hold at least one vertex");
+		vertices.resize(std::max<size_t>(std::max(vertexCapacity, vertexCount), 1));
+		indices.resize(std::max<size_t>(std::max(indexCapacity, indexCount), 1));
+
+		// the initial data goes through the pool's own upload, only later edits use the ring
+		std::vector<char> stream(VERTEX_STRIDE * vertices.size());
+		writeVertices(vertices.data(), vertices.size(), stream.data());
+		vertexAllocation = geometryPool.allocateVertices(stream.data(), stream.size(), VERTEX_STRIDE);
+		baseVertex = static_cast<int32_t>(vertexAllocation.offset / VERTEX_STRIDE);
+		indexAllocation = geometryPool.allocateIndices(indices.data(), sizeof(uint32_t) * indices.size(), sizeof(uint32_t));
+		baseIndex = static_cast<uint32_t>(indexAllocation.offset / sizeof(uint32_t));
+
+		stagingBuffer = std::make_unique<VcuBuffer>(
+			geometryPool.getDevice(),
+			stagingSize,
+			VcuSwapChain::MAX_FRAMES_IN_FLIGHT,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		stagingBuffer->map();
+	}
+
+	VcuDynamicModel::~VcuDynamicModel() {
+		geometryPool.freeVertices(vertexAllocation);
+		geometryPool.freeIndices(indexAllocation);
+	}
+
+	void VcuDynamicModel::setVertex(uint32_t index, const Vertex& vertex) {
+		assert(index < vertexCount && "Vertex index out of range");
+		vertices[index] = vertex;
+		markDirty(dirtyVertices, index, index + 1);
+	}
+
+	void VcuDynamicModel::setVertices(uint32_t first, const std::vector<Vertex>& newVertices) {
+		const uint32_t end = first + static_cast<uint32_t>(newVertices.size());
+		assert(end <= vertices.size() && "Vertices exceed the model capacity");
+		std::copy(newVertices.begin(), newVertices.end(), vertices.begin() + first);
+		vertexCount = std::max(vertexCount, end);
+		markDirty(dirtyVertices, first, end);
+	}
+
+	void VcuDynamicModel::setIndices(uint32_t first, const std::vector<uint32_t>& newIndices) {
+		const uint32_t end = first + static_cast<uint32_t>(newIndices.size());
+		assert(end <= indices.size() && "Indices exceed the model capacity");
+		std::copy(newIndices.begin(), newIndices.end(), indices.begin() + first);
+		indexCount = std::max(indexCount, end);
+		markDirty(dirtyIndices, first, end);
+	}
+
+	void VcuDynamicModel::resize(uint32_t newVertexCount, uint32_t newIndexCount) {
+		assert(newVertexCount <= vertices.size() && newIndexCount <= indices.size() && "Size exceeds the model capacity");
+		if (newVertexCount > vertexCount) {
+			std::fill(vertices.begin() + vertexCount, vertices.begin() + newVertexCount, Vertex{});
+			markDirty(dirtyVertices, vertexCount, newVertexCount);
+		}
+		if (newIndexCount > indexCount) {
+			std::fill(indices.begin() + indexCount, indices.begin() + newIndexCount, 0u);
+			markDirty(dirtyIndices, indexCount, newIndexCount);
+		}
+		vertexCount = newVertexCount;
+		indexCount = newIndexCount;
+	}
+
+	void VcuDynamicModel::markDirty(RangeSet& ranges, uint32_t first, uint32_t end) {
+		if (first >= end) return;
+
+		auto it = ranges.upper_bound(first);
+		if (it != ranges.begin() && std::prev(it)->second >= first) {
+			--it;
+			first = it->first;
+			end = std::max(end, it->second);
+			it = ranges.erase(it);
+		}
+		while (it != ranges.end() && it->first <= end) {
+			end = std::max(end, it->second);
+			it = ranges.erase(it);
+		}
+		ranges.emplace(first, end);
+	}
+
+	template<typename Write>
+	std::vector<VkBufferCopy> VcuDynamicModel::stageRanges(RangeSet& ranges, VkDeviceSize stride, VkDeviceSize destinationOffset,
+		VkDeviceSize frameOffset, VkDeviceSize& used, Write write) {
+		std::vector<VkBufferCopy> regions{};
+		char* staging = static_cast<char*>(stagingBuffer->getMappedMemory()) + frameOffset;
+
+		auto it = ranges.begin();
+		while (it != ranges.end()) {
+			const uint32_t first = it->first;
+			const uint32_t end = it->second;
+			const uint32_t fits = static_cast<uint32_t>(std::min<VkDeviceSize>(end - first, (stagingSize - used) / stride));
+			if (fits == 0) break;
+
+			VkBufferCopy region{};
+			region.srcOffset = frameOffset + used;
+			region.dstOffset = destinationOffset + first * stride;
+			region.size = fits * stride;
+			write(first, fits, staging + used);
+			regions.push_back(region);
+			used += region.size;
+
+			it = ranges.erase(it);
+			if (first + fits < end) {
+				// the ring is full, the rest of the range waits for the next frame
+				ranges.emplace(first + fits, end);
+				break;
+			}
+		}
+		return regions;
+	}
+
+	void VcuDynamicModel::recordUploads(VkCommandBuffer commandBuffer, int frameIndex) {
+		if (!hasPendingUploads()) return;
+
+		// the renderer waited for the fence of this frame index, so its staging region is free again
+		const VkDeviceSize frameOffset = stagingSize * static_cast<VkDeviceSize>(frameIndex);
+		VkDeviceSize used = 0;
+		const std::vector<VkBufferCopy> vertexRegions = stageRanges(dirtyVertices, VERTEX_STRIDE, vertexAllocation.offset,
+			frameOffset, used, [&](uint32_t first, uint32_t count, char* out) {
+				writeVertices(vertices.data() + first, count, out);
+			});
+		const std::vector<VkBufferCopy> indexRegions = stageRanges(dirtyIndices, sizeof(uint32_t), indexAllocation.offset,
+			frameOffset, used, [&](uint32_t first, uint32_t count, char* out) {
+				std::memcpy(out, indices.data() + first, sizeof(uint32_t) * count);
+			});
+		if (vertexRegions.empty() && indexRegions.empty()) return;
+
+		geometryPool.waitForMoves();
+		// earlier frames may still be reading the ranges that are about to be overwritten
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+		if (!vertexRegions.empty()) {
+			vkCmdCopyBuffer(commandBuffer, stagingBuffer->getBuffer(), geometryPool.getVertexBuffer(),
+				static_cast<uint32_t>(vertexRegions.size()), vertexRegions.data());
+		}
+		if (!indexRegions.empty()) {
+			vkCmdCopyBuffer(commandBuffer, stagingBuffer->getBuffer(), geometryPool.getIndexBuffer(),
+				static_cast<uint32_t>(indexRegions.size()), indexRegions.data());
+		}
+
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+	}
+
+	void VcuDynamicModel::bind(VkCommandBuffer commandBuffer) {
+		geometryPool.bindIndexType(commandBuffer, VK_INDEX_TYPE_UINT32);
+	}
+
+	void VcuDynamicModel::draw(VkCommandBuffer commandBuffer) {
+		if (indexCount == 0) return;
+		vkCmdDrawIndexed(commandBuffer, indexCount, 1, baseIndex, baseVertex, 0);
+	}
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "vcu_model.hpp"
+#include "vcu_geometry_pool.hpp"
+#include "vcu_buffer.hpp"
+
+// std
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace vcu {
+	// Mesh that can change after it is created, for edit tools and procedural geometry. Vertices and
+	// indices live in the geometry pool like those of VcuModel, in the standard vertex layout, with a
+	// copy kept on the CPU. Edits only touch the copy and mark ranges dirty. recordUploads copies the
+	// dirty ranges through this frame's part of a staging ring and records vkCmdCopyBuffer into the
+	// frame's command buffer, so there is no queue wait. Ranges that do not fit into the ring stay
+	// dirty and go out with the next frame.
+	class VcuDynamicModel {
+	public:
+		using Vertex = VcuModel::Vertex;
+
+		static constexpr VkDeviceSize DEFAULT_STAGING_SIZE = 256 * 1024; // per frame in flight
+
+		// capacities of 0 use the initial sizes, the mesh can later grow up to the capacity
+		VcuDynamicModel(VcuGeometryPool& pool, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+			uint32_t vertexCapacity = 0, uint32_t indexCapacity = 0, VkDeviceSize stagingSize = DEFAULT_STAGING_SIZE);
+		~VcuDynamicModel();
+
+		VcuDynamicModel(const VcuDynamicModel&) = delete;
+		VcuDynamicModel& operator=(const VcuDynamicModel&) = delete;
+
+		uint32_t getVertexCount() const { return vertexCount; }
+		uint32_t getIndexCount() const { return indexCount; }
+		const Vertex& getVertex(uint32_t index) const { return vertices[index]; }
+		uint32_t getIndex(uint32_t index) const { return indices[index]; }
+
+		void setVertex(uint32_t index, const Vertex& vertex);
+		// writing past the current count grows the mesh
+		void setVertices(uint32_t first, const std::vector<Vertex>& newVertices);
+		void setIndices(uint32_t first, const std::vector<uint32_t>& newIndices);
+		// counts can shrink freely, new elements are zero until they are written
+		void resize(uint32_t newVertexCount, uint32_t newIndexCount);
+
+		bool hasPendingUploads() const { return !dirtyVertices.empty() || !dirtyIndices.empty(); }
+		// call once per frame outside of the render pass, before the model is drawn
+		void recordUploads(VkCommandBuffer commandBuffer, int frameIndex);
+
+		// like VcuModel::bind, the geometry pool has to be bound already
+		void bind(VkCommandBuffer commandBuffer);
+		void draw(VkCommandBuffer commandBuffer);
+
+	private:
+		// element ranges [first, end), overlapping and touching ranges are merged
+		using RangeSet = std::map<uint32_t, uint32_t>;
+
+		static void markDirty(RangeSet& ranges, uint32_t first, uint32_t end);
+		// moves as much of the dirty ranges into staging as fits, returns the copy regions.
+		// write(first, count, out) fills count elements in the GPU layout.
+		template<typename Write>
+		std::vector<VkBufferCopy> stageRanges(RangeSet& ranges, VkDeviceSize stride, VkDeviceSize destinationOffset,
+			VkDeviceSize frameOffset, VkDeviceSize& used, Write write);
+
+		VcuGeometryPool& geometryPool;
+
+		std::vector<Vertex> vertices; // sized to the capacity
+		std::vector<uint32_t> indices;
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		RangeSet dirtyVertices;
+		RangeSet dirtyIndices;
+
+		VcuGeometryPool::Allocation vertexAllocation{};
+		int32_t baseVertex = 0;
+		VcuGeometryPool::Allocation indexAllocation{};
+		uint32_t baseIndex = 0;
+
+		// one region per frame in flight, a region is reused once the renderer has waited for its frame
+		std::unique_ptr<VcuBuffer> stagingBuffer;
+		VkDeviceSize stagingSize;
+	};
+}
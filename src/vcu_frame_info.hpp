@@ -2,6 +2,7 @@
 
 #include "vcu_camera.hpp"
 #include "vcu_game_object.hpp"
+#include "vcu_uniform_ring.hpp"
 
 // lib
 #include <vulkan/vulkan.h>
@@ -34,5 +35,7 @@ namespace vcu {
 		VcuCamera &camera;
 		VkDescriptorSet globalDescriptorSet;
 		VcuGameObject::Map &gameObjects;
+		VcuUniformRing &uniformRing; // for per pass and per object uniforms of this frame
+		uint32_t globalUboOffset = 0; // dynamic offset of the GlobalUbo in globalDescriptorSet
 	};
 }
\ No newline at end of file
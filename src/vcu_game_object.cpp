@@ -60,6 +60,23 @@ namespace vcu {
         };
     }
 
+    VcuModel::BoundingBox TransformComponent::worldBounds(const VcuModel::BoundingBox& bounds) {
+        const glm::mat4 matrix = mat4();
+        const glm::vec3 center{ matrix * glm::vec4{ bounds.center(), 1.f } };
+        const glm::vec3 extent = bounds.extent();
+        const glm::vec3 worldExtent =
+            glm::abs(glm::vec3{ matrix[0] }) * extent.x +
+            glm::abs(glm::vec3{ matrix[1] }) * extent.y +
+            glm::abs(glm::vec3{ matrix[2] }) * extent.z;
+        return { center - worldExtent, center + worldExtent };
+    }
+
+    VcuModel::BoundingSphere TransformComponent::worldBounds(const VcuModel::BoundingSphere& bounds) {
+        const glm::vec3 center{ mat4() * glm::vec4{ bounds.center, 1.f } };
+        const float maxScale = glm::max(glm::abs(scale.x), glm::max(glm::abs(scale.y), glm::abs(scale.z)));
+        return { center, bounds.radius * maxScale };
+    }
+
     VcuGameObject VcuGameObject::makePointLight(float intensity, float radius, glm::vec3 color, int type) {
         VcuGameObject obj = VcuGameObject::createGameObject();
         obj.color = color;
@@ -83,4 +100,21 @@ namespace vcu {
 		return obj;
 	}
 
+    void VcuGameObject::updateLod(const VcuCamera& camera, const glm::mat4& modelMatrix) {
+        if (model == nullptr) return;
+
+        const VcuModel::BoundingSphere& bounds = model->getBoundingSphere();
+        const glm::vec3 center{ modelMatrix * glm::vec4{ bounds.center, 1.f } };
+        const float maxScale = glm::max(glm::abs(transform.scale.x), glm::max(glm::abs(transform.scale.y), glm::abs(transform.scale.z)));
+        lod = model->selectLod(camera.projectedSize(center, bounds.radius * maxScale), lod);
+    }
+
+    void VcuGameObject::updatePendingModel() {
+        if (pendingModel == nullptr) return;
+
+        model = pendingModel->poll();
+        if (model != nullptr) {
+            pendingModel.reset();
+        }
+    }
 }
\ No newline at end of file
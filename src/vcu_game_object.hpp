@@ -1,6 +1,8 @@
 #pragma once
 
 #include "vcu_model.hpp"
+#include "vcu_dynamic_model.hpp"
+#include "vcu_camera.hpp"
 
 // libs
 #include <glm/gtc/matrix_transform.hpp>
@@ -18,6 +20,11 @@ namespace vcu {
 
         glm::mat4 mat4();
         glm::mat3 normalMatrix();
+
+        // World space bounds of model space bounds. The box is moved by its center and grown by the
+        // absolute rotation-scale matrix (Arvo), which avoids transforming all eight corners.
+        VcuModel::BoundingBox worldBounds(const VcuModel::BoundingBox& bounds);
+        VcuModel::BoundingSphere worldBounds(const VcuModel::BoundingSphere& bounds);
     };
 
     struct PointLightComponent {
@@ -46,12 +53,20 @@ namespace vcu {
         id_t getId() { return id; }
         int type;
 
+        // picks the model LOD from the projected size of its bounding sphere
+        void updateLod(const VcuCamera& camera, const glm::mat4& modelMatrix);
+        // takes over the model of pendingModel once it has finished loading
+        void updatePendingModel();
+
         glm::vec3 color{};
         TransformComponent transform{};
 
         // Optional pointer components
         std::shared_ptr<VcuModel> model{};
+        std::shared_ptr<VcuModel::AsyncLoad> pendingModel{}; // model stays empty until this is ready
+        std::shared_ptr<VcuDynamicModel> dynamicModel{}; // edited at runtime, uploaded with recordUploads
         std::unique_ptr<PointLightComponent> pointLight = nullptr;
+        uint32_t lod = 0;
 
     private:
         VcuGameObject(id_t objId, int type) : id{ objId }, type{type} {}
@@ -0,0 +1,173 @@
+#include "vcu_geometry_pool.hpp"
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+namespace vcu {
+
+	VcuGeometryPool::RangeAllocator::RangeAllocator(VkDeviceSize capacity) : capacity{ capacity } {
+		freeBlocks[0] = capacity;
+	}
+
+	bool VcuGeometryPool::RangeAllocator::allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset) {
+		for (auto it = freeBlocks.begin(); it != freeBlocks.end(); ++it) {
+			const VkDeviceSize blockOffset = it->first;
+			const VkDeviceSize blockSize = it->second;
+			// vertex strides are not powers of two, so round up with a division
+			const VkDeviceSize aligned = (blockOffset + alignment - 1) / alignment * alignment;
+			if (aligned + size > blockOffset + blockSize) continue;
+
+			freeBlocks.erase(it);
+			if (aligned > blockOffset) {
+				freeBlocks[blockOffset] = aligned - blockOffset;
+			}
+			if (aligned + size < blockOffset + blockSize) {
+				freeBlocks[aligned + size] = blockOffset + blockSize - aligned - size;
+			}
+			offset = aligned;
+			return true;
+		}
+		return false;
+	}
+
+	void VcuGeometryPool::RangeAllocator::free(VkDeviceSize offset, VkDeviceSize size) {
+		auto next = freeBlocks.lower_bound(offset);
+		if (next != freeBlocks.end() && offset + size == next->first) {
+			size += next->second;
+			next = freeBlocks.erase(next);
+		}
+		if (next != freeBlocks.begin()) {
+			auto previous = std::prev(next);
+			if (previous->first + previous->second == offset) {
+				previous->second += size;
+				return;
+			}
+		}
+		freeBlocks[offset] = size;
+	}
+
+	void VcuGeometryPool::RangeAllocator::grow(VkDeviceSize newCapacity) {
+		assert(newCapacity > capacity && "Range allocator can only grow");
+		free(capacity, newCapacity - capacity);
+		capacity = newCapacity;
+	}
+
+	VcuGeometryPool::VcuGeometryPool(VcuDevice& device, VkDeviceSize vertexCapacity, VkDeviceSize indexCapacity)
+		: vcuDevice{ device },
+		vertexPool{ nullptr, RangeAllocator{ vertexCapacity }, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT },
+		indexPool{ nullptr, RangeAllocator{ indexCapacity }, VK_BUFFER_USAGE_INDEX_BUFFER_BIT } {
+		vertexPool.buffer = createBuffer(vertexCapacity, vertexPool.usage);
+		indexPool.buffer = createBuffer(indexCapacity, indexPool.usage);
+	}
+
+	VcuGeometryPool::~VcuGeometryPool() {}
+
+	VcuGeometryPool::Allocation VcuGeometryPool::allocateVertices(const void* data, VkDeviceSize size, VkDeviceSize vertexStride) {
+		return allocate(vertexPool, data, size, vertexStride);
+	}
+
+	VcuGeometryPool::Allocation VcuGeometryPool::allocateIndices(const void* data, VkDeviceSize size, VkDeviceSize indexSize) {
+		return allocate(indexPool, data, size, indexSize);
+	}
+
+	void VcuGeometryPool::freeVertices(const Allocation& allocation) {
+		freeLater(vertexPool, allocation);
+	}
+
+	void VcuGeometryPool::freeIndices(const Allocation& allocation) {
+		freeLater(indexPool, allocation);
+	}
+
+	void VcuGeometryPool::freeLater(Pool& pool, const Allocation& allocation) {
+		if (allocation.size == 0) return;
+
+		// frames in flight may still draw from the range, a new upload must not overwrite it before they finish
+		std::weak_ptr<bool> poolAlive = alive;
+		RangeAllocator* ranges = &pool.ranges;
+		const VkDeviceSize offset = allocation.offset;
+		const VkDeviceSize size = allocation.size;
+		vcuDevice.defragmenter().destroyLater([poolAlive, ranges, offset, size]() {
+			if (!poolAlive.expired()) ranges->free(offset, size);
+		});
+	}
+
+	void VcuGeometryPool::bind(VkCommandBuffer commandBuffer) {
+		VkBuffer buffers[] = { vertexPool.buffer->getBuffer() };
+		VkDeviceSize offsets[] = { 0 };
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffers, offsets);
+		vkCmdBindIndexBuffer(commandBuffer, indexPool.buffer->getBuffer(), 0, boundIndexType);
+		boundCommandBuffer = commandBuffer;
+	}
+
+	void VcuGeometryPool::bindIndexType(VkCommandBuffer commandBuffer, VkIndexType indexType) {
+		assert(commandBuffer == boundCommandBuffer && "Geometry pool must be bound before drawing models");
+		if (indexType == boundIndexType) return;
+
+		vkCmdBindIndexBuffer(commandBuffer, indexPool.buffer->getBuffer(), 0, indexType);
+		boundIndexType = indexType;
+	}
+
+	VcuGeometryPool::Allocation VcuGeometryPool::allocate(Pool& pool, const void* data, VkDeviceSize size, VkDeviceSize alignment) {
+		Allocation allocation{};
+		if (size == 0) return allocation;
+
+		if (!pool.ranges.allocate(size, alignment, allocation.offset)) {
+			grow(pool, size + alignment);
+			if (!pool.ranges.allocate(size, alignment, allocation.offset)) {
+				throw std::runtime_error("failed to allocate from geometry pool!");
+			}
+		}
+		allocation.size = size;
+		allocation.uploadValue = upload(*pool.buffer, allocation.offset, data, size);
+		return allocation;
+	}
+
+	std::unique_ptr<VcuBuffer> VcuGeometryPool::createBuffer(VkDeviceSize capacity, VkBufferUsageFlags usage) {
+		if (vcuDevice.hasBufferDeviceAddress()) {
+			usage |= VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR;
+		}
+		auto buffer = std::make_unique<VcuBuffer>(vcuDevice, capacity, 1,
+			usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		// only written by uploads and the copies of dynamic models, which wait for moves first
+		buffer->allowMoves();
+		return buffer;
+	}
+
+	void VcuGeometryPool::grow(Pool& pool, VkDeviceSize requiredSize) {
+		const VkDeviceSize oldCapacity = pool.ranges.getCapacity();
+		const VkDeviceSize newCapacity = std::max(oldCapacity * 2, oldCapacity + requiredSize);
+		if (vcuDevice.enableValidationLayers) {
+			std::cout << "Growing geometry pool from " << oldCapacity << " to " << newCapacity << " bytes" << std::endl;
+		}
+
+		// frames in flight still read the old buffer, and the render loop binds the new one next frame.
+		// Copies held back by an open upload batch still write to it, so they are flushed first.
+		vcuDevice.stagingRing().waitIdle();
+		pool.buffer->waitForMove();
+		vkDeviceWaitIdle(vcuDevice.device());
+		std::unique_ptr<VcuBuffer> buffer = createBuffer(newCapacity, pool.usage);
+		buffer->setUploadValue(pool.buffer->getUploadValue());
+		vcuDevice.copyBuffer(pool.buffer->getBuffer(), buffer->getBuffer(), oldCapacity);
+		pool.buffer = std::move(buffer);
+		pool.ranges.grow(newCapacity);
+		boundCommandBuffer = VK_NULL_HANDLE;
+	}
+
+	void VcuGeometryPool::waitForMoves() {
+		vertexPool.buffer->waitForMove();
+		indexPool.buffer->waitForMove();
+	}
+
+	uint64_t VcuGeometryPool::upload(VcuBuffer& buffer, VkDeviceSize offset, const void* data, VkDeviceSize size) {
+		buffer.waitForMove();
+		// the ring chunks big uploads, the range may be drawn once the returned value is acquired
+		const uint64_t value = vcuDevice.stagingRing().uploadToBuffer(buffer.getBuffer(), offset, data, size);
+		buffer.setUploadValue(value);
+		return value;
+	}
+}
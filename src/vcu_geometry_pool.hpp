@@ -0,0 +1,93 @@
+#pragma once
+
+#include "vcu_device.hpp"
+#include "vcu_buffer.hpp"
+
+// std
+#include <map>
+#include <memory>
+
+namespace vcu {
+	// One device local vertex buffer and one index buffer shared by all static models. Models keep
+	// an allocation into each and draw with firstIndex / vertexOffset, so the buffers are bound once
+	// per command buffer instead of once per object.
+	class VcuGeometryPool {
+	public:
+		static constexpr VkDeviceSize DEFAULT_VERTEX_CAPACITY = 32 * 1024 * 1024;
+		static constexpr VkDeviceSize DEFAULT_INDEX_CAPACITY = 16 * 1024 * 1024;
+
+		struct Allocation {
+			VkDeviceSize offset = 0; // in bytes, a multiple of the alignment passed to allocate
+			VkDeviceSize size = 0;
+			uint64_t uploadValue = 0; // of the staging ring, see VcuStagingRing::getAcquiredValue
+		};
+
+		VcuGeometryPool(VcuDevice& device, VkDeviceSize vertexCapacity = DEFAULT_VERTEX_CAPACITY,
+			VkDeviceSize indexCapacity = DEFAULT_INDEX_CAPACITY);
+		~VcuGeometryPool();
+
+		VcuGeometryPool(const VcuGeometryPool&) = delete;
+		VcuGeometryPool& operator=(const VcuGeometryPool&) = delete;
+
+		// copy data into the pool, the offset is aligned to the vertex stride / index size so it can
+		// be turned into a vertexOffset / firstIndex. The buffers grow when they run out of space.
+		Allocation allocateVertices(const void* data, VkDeviceSize size, VkDeviceSize vertexStride);
+		Allocation allocateIndices(const void* data, VkDeviceSize size, VkDeviceSize indexSize);
+		// the range is reused once no frame in flight can draw from it anymore
+		void freeVertices(const Allocation& allocation);
+		void freeIndices(const Allocation& allocation);
+
+		// binds both buffers, call once per command buffer before drawing any model
+		void bind(VkCommandBuffer commandBuffer);
+		// switches the index type of the bound index buffer, no-op if it is already bound that way
+		void bindIndexType(VkCommandBuffer commandBuffer, VkIndexType indexType);
+
+		VcuDevice& getDevice() { return vcuDevice; }
+		// call before recording writes into the buffers, they may be moved by the defragmenter
+		void waitForMoves();
+		// the buffers are replaced when the pool grows or moves, so do not keep these across frames
+		VkBuffer getVertexBuffer() const { return vertexPool.buffer->getBuffer(); }
+		VkBuffer getIndexBuffer() const { return indexPool.buffer->getBuffer(); }
+		// for vertex pulling, only with VcuDevice::hasBufferDeviceAddress. Vertex i of a model is at
+		// i * vertex size from here, so draws keep their vertexOffset.
+		VkDeviceAddress getVertexAddress() { return vertexPool.buffer->getDeviceAddress(); }
+
+	private:
+		// first fit free list over a byte range, neighbouring free blocks are merged
+		class RangeAllocator {
+		public:
+			explicit RangeAllocator(VkDeviceSize capacity);
+
+			bool allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+			void free(VkDeviceSize offset, VkDeviceSize size);
+			void grow(VkDeviceSize newCapacity);
+
+			VkDeviceSize getCapacity() const { return capacity; }
+
+		private:
+			std::map<VkDeviceSize, VkDeviceSize> freeBlocks; // offset -> size
+			VkDeviceSize capacity;
+		};
+
+		struct Pool {
+			std::unique_ptr<VcuBuffer> buffer;
+			RangeAllocator ranges;
+			VkBufferUsageFlags usage;
+		};
+
+		Allocation allocate(Pool& pool, const void* data, VkDeviceSize size, VkDeviceSize alignment);
+		void freeLater(Pool& pool, const Allocation& allocation);
+		std::unique_ptr<VcuBuffer> createBuffer(VkDeviceSize capacity, VkBufferUsageFlags usage);
+		void grow(Pool& pool, VkDeviceSize requiredSize);
+		uint64_t upload(VcuBuffer& buffer, VkDeviceSize offset, const void* data, VkDeviceSize size);
+
+		VcuDevice& vcuDevice;
+		Pool vertexPool;
+		Pool indexPool;
+
+		VkCommandBuffer boundCommandBuffer = VK_NULL_HANDLE;
+		VkIndexType boundIndexType = VK_INDEX_TYPE_UINT32;
+		// the defragmenter outlives the pool, frees it retires after the pool is gone are dropped
+		std::shared_ptr<bool> alive = std::make_shared<bool>(true);
+	};
+}
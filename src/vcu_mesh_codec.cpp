@@ -0,0 +1,212 @@
+#include "vcu_mesh_codec.hpp"
+
+// std
+#include <algorithm>
+#include <array>
+#include <climits>
+
+// the SSSE3 decoder is compiled on every x86-64 build and picked at runtime
+#if defined(__x86_64__) || defined(_M_X64)
+#include <tmmintrin.h>
+#define VCU_CODEC_SSSE3
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define VCU_TARGET_SSSE3
+#else
+#define VCU_TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
+#endif
+
+namespace vcu {
+
+	namespace {
+		constexpr size_t GROUP_SIZE = 16;
+
+		struct DecodeTables {
+			std::array<uint8_t, 256> popcount{};
+			// for every 8 bit mask, where each output byte comes from in the packed input (0x80 = zero)
+			std::array<std::array<uint8_t, 8>, 256> shuffle{};
+
+			DecodeTables() {
+				for (int mask = 0; mask < 256; mask++) {
+					uint8_t next = 0;
+					for (int bit = 0; bit < 8; bit++) {
+						shuffle[mask][bit] = (mask & (1 << bit)) ? next++ : 0x80;
+					}
+					popcount[mask] = next;
+				}
+			}
+		};
+
+		const DecodeTables& decodeTables() {
+			static const DecodeTables tables{};
+			return tables;
+		}
+
+		template<typename T>
+		T zigzag(T delta) {
+			constexpr int bits = sizeof(T) * CHAR_BIT;
+			return static_cast<T>((delta << 1) ^ (T{ 0 } - (delta >> (bits - 1))));
+		}
+
+		template<typename T>
+		T unzigzag(T value) {
+			return static_cast<T>((value >> 1) ^ (T{ 0 } - (value & 1)));
+		}
+
+		void encodePlane(const uint8_t* plane, size_t count, std::vector<uint8_t>& out) {
+			for (size_t group = 0; group < count; group += GROUP_SIZE) {
+				const size_t groupSize = std::min(GROUP_SIZE, count - group);
+				uint16_t mask = 0;
+				for (size_t i = 0; i < groupSize; i++) {
+					if (plane[group + i] != 0) mask |= static_cast<uint16_t>(1u << i);
+				}
+
+				out.push_back(static_cast<uint8_t>(mask & 0xff));
+				out.push_back(static_cast<uint8_t>(mask >> 8));
+				for (size_t i = 0; i < groupSize; i++) {
+					if (plane[group + i] != 0) out.push_back(plane[group + i]);
+				}
+			}
+		}
+
+		// returns the position after the plane or nullptr if the data ends too early
+		const uint8_t* decodePlaneScalar(const uint8_t* src, const uint8_t* end, size_t count, uint8_t* plane) {
+			for (size_t group = 0; group < count; group += GROUP_SIZE) {
+				if (end - src < 2) return nullptr;
+				const uint16_t mask = static_cast<uint16_t>(src[0] | (src[1] << 8));
+				src += 2;
+
+				const size_t groupSize = std::min(GROUP_SIZE, count - group);
+				for (size_t i = 0; i < groupSize; i++) {
+					if (mask & (1u << i)) {
+						if (src == end) return nullptr;
+						plane[group + i] = *src++;
+					}
+					else {
+						plane[group + i] = 0;
+					}
+				}
+			}
+			return src;
+		}
+
+#ifdef VCU_CODEC_SSSE3
+		bool hasSsse3() {
+#if defined(_MSC_VER)
+			int info[4];
+			__cpuid(info, 1);
+			return (info[2] & (1 << 9)) != 0;
+#else
+			return __builtin_cpu_supports("ssse3");
+#endif
+		}
+
+		// one pshufb per group expands the packed non zero bytes to their positions
+		VCU_TARGET_SSSE3 const uint8_t* decodePlaneSsse3(const uint8_t* src, const uint8_t* end, size_t count, uint8_t* plane) {
+			const DecodeTables& tables = decodeTables();
+			const size_t fullGroups = count / GROUP_SIZE;
+
+			for (size_t group = 0; group < fullGroups; group++) {
+				if (end - src < 2) return nullptr;
+				const uint8_t lowMask = src[0];
+				const uint8_t highMask = src[1];
+				src += 2;
+
+				const size_t lowCount = tables.popcount[lowMask];
+				const size_t byteCount = lowCount + tables.popcount[highMask];
+				if (static_cast<size_t>(end - src) < byteCount) return nullptr;
+
+				// the high half of the shuffle starts after the bytes of the low half,
+				// 0x80 + lowCount still has the zeroing bit set
+				const __m128i low = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(tables.shuffle[lowMask].data()));
+				__m128i high = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(tables.shuffle[highMask].data()));
+				high = _mm_add_epi8(high, _mm_set1_epi8(static_cast<char>(lowCount)));
+				const __m128i shuffle = _mm_unpacklo_epi64(low, high);
+
+				const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(plane + group * GROUP_SIZE), _mm_shuffle_epi8(packed, shuffle));
+				src += byteCount;
+			}
+
+			const size_t done = fullGroups * GROUP_SIZE;
+			return decodePlaneScalar(src, end, count - done, plane + done);
+		}
+#endif
+
+		const uint8_t* decodePlane(const uint8_t* src, const uint8_t* end, size_t count, uint8_t* plane) {
+#ifdef VCU_CODEC_SSSE3
+			static const bool ssse3 = hasSsse3();
+			if (ssse3) return decodePlaneSsse3(src, end, count, plane);
+#endif
+			return decodePlaneScalar(src, end, count, plane);
+		}
+
+		template<typename T>
+		std::vector<uint8_t> encodeRecords(const T* values, size_t recordCount, size_t channelCount) {
+			std::vector<uint8_t> out;
+			out.reserve(recordCount * channelCount * sizeof(T) / 2);
+			std::vector<T> coded(recordCount);
+			std::vector<uint8_t> plane(recordCount);
+
+			for (size_t channel = 0; channel < channelCount; channel++) {
+				T previous = 0;
+				for (size_t i = 0; i < recordCount; i++) {
+					const T value = values[i * channelCount + channel];
+					coded[i] = zigzag(static_cast<T>(value - previous));
+					previous = value;
+				}
+
+				for (size_t byte = 0; byte < sizeof(T); byte++) {
+					for (size_t i = 0; i < recordCount; i++) {
+						plane[i] = static_cast<uint8_t>(coded[i] >> (byte * CHAR_BIT));
+					}
+					encodePlane(plane.data(), recordCount, out);
+				}
+			}
+			return out;
+		}
+
+		template<typename T>
+		bool decodeRecords(const uint8_t* data, size_t size, T* values, size_t recordCount, size_t channelCount) {
+			const uint8_t* src = data;
+			const uint8_t* end = data + size;
+			std::vector<T> coded(recordCount);
+			std::vector<uint8_t> plane(recordCount + GROUP_SIZE);
+
+			for (size_t channel = 0; channel < channelCount; channel++) {
+				std::fill(coded.begin(), coded.end(), T{ 0 });
+				for (size_t byte = 0; byte < sizeof(T); byte++) {
+					src = decodePlane(src, end, recordCount, plane.data());
+					if (src == nullptr) return false;
+					for (size_t i = 0; i < recordCount; i++) {
+						coded[i] |= static_cast<T>(static_cast<T>(plane[i]) << (byte * CHAR_BIT));
+					}
+				}
+
+				T previous = 0;
+				for (size_t i = 0; i < recordCount; i++) {
+					previous = static_cast<T>(previous + unzigzag(coded[i]));
+					values[i * channelCount + channel] = previous;
+				}
+			}
+			return src == end;
+		}
+	}
+
+	std::vector<uint8_t> VcuMeshCodec::encode(const uint16_t* values, size_t recordCount, size_t channelCount) {
+		return encodeRecords(values, recordCount, channelCount);
+	}
+
+	std::vector<uint8_t> VcuMeshCodec::encode(const uint32_t* values, size_t recordCount, size_t channelCount) {
+		return encodeRecords(values, recordCount, channelCount);
+	}
+
+	bool VcuMeshCodec::decode(const uint8_t* data, size_t size, uint16_t* values, size_t recordCount, size_t channelCount) {
+		return decodeRecords(data, size, values, recordCount, channelCount);
+	}
+
+	bool VcuMeshCodec::decode(const uint8_t* data, size_t size, uint32_t* values, size_t recordCount, size_t channelCount) {
+		return decodeRecords(data, size, values, recordCount, channelCount);
+	}
+}
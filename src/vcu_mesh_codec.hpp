@@ -0,0 +1,25 @@
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vcu {
+	// Lossless coding of interleaved integer records such as quantized vertices or index lists.
+	// Every channel is delta coded against the previous record and zigzagged, the results are split
+	// into byte planes and each plane is stored in groups of 16 bytes: a 16 bit mask of the non zero
+	// bytes followed by those bytes. Smooth data leaves the high planes almost empty.
+	class VcuMeshCodec {
+	public:
+		// the decoder may read this many bytes past the end of the encoded data
+		static constexpr size_t DECODE_PADDING = 16;
+
+		static std::vector<uint8_t> encode(const uint16_t* values, size_t recordCount, size_t channelCount);
+		static std::vector<uint8_t> encode(const uint32_t* values, size_t recordCount, size_t channelCount);
+
+		// returns false if data is truncated or does not match the record layout
+		static bool decode(const uint8_t* data, size_t size, uint16_t* values, size_t recordCount, size_t channelCount);
+		static bool decode(const uint8_t* data, size_t size, uint32_t* values, size_t recordCount, size_t channelCount);
+	};
+}
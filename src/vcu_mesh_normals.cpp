@@ -0,0 +1,205 @@
+#include "vcu_mesh_normals.hpp"
+#include "vcu_thread_pool.hpp"
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+namespace vcu {
+
+	namespace {
+		constexpr size_t PARALLEL_GRAIN = 16 * 1024;
+		constexpr uint32_t NO_BUCKET = ~0u;
+
+		float cornerAngle(const glm::vec3& corner, const glm::vec3& a, const glm::vec3& b) {
+			const glm::vec3 edge0 = a - corner;
+			const glm::vec3 edge1 = b - corner;
+			const float lengths = glm::length(edge0) * glm::length(edge1);
+			if (lengths <= 0.f) return 0.f;
+			return std::acos(std::clamp(glm::dot(edge0, edge1) / lengths, -1.f, 1.f));
+		}
+
+		// counting sort of corners by the vertex they reference, corners of vertex v end up in
+		// corners[offsets[v]] .. corners[offsets[v + 1] - 1]. This is what lets every vertex be
+		// accumulated by a single thread without atomics.
+		void groupCornersByVertex(const std::vector<uint32_t>& indices, size_t vertexCount,
+			std::vector<uint32_t>& offsets, std::vector<uint32_t>& corners) {
+			offsets.assign(vertexCount + 1, 0);
+			for (uint32_t index : indices) offsets[index + 1]++;
+			for (size_t v = 0; v < vertexCount; v++) offsets[v + 1] += offsets[v];
+
+			corners.resize(indices.size());
+			std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < indices.size(); i++) {
+				corners[fill[indices[i]]++] = static_cast<uint32_t>(i);
+			}
+		}
+
+		glm::vec3 anyPerpendicular(const glm::vec3& normal) {
+			const glm::vec3 axis = std::abs(normal.x) < 0.9f ? glm::vec3{ 1.f, 0.f, 0.f } : glm::vec3{ 0.f, 1.f, 0.f };
+			return glm::normalize(glm::cross(normal, axis));
+		}
+	}
+
+	std::vector<glm::vec3> VcuMeshNormals::generateCornerNormals(const std::vector<uint32_t>& indices,
+		const std::vector<glm::vec3>& positions, float creaseAngle) {
+		assert(indices.size() % 3 == 0 && "Index count must be a multiple of 3");
+		const size_t triangleCount = indices.size() / 3;
+		VcuThreadPool& pool = VcuThreadPool::shared();
+
+		// face normals keep their length, twice the triangle area
+		std::vector<glm::vec3> faceNormals(triangleCount);
+		std::vector<float> angles(indices.size());
+		pool.parallelFor(triangleCount, PARALLEL_GRAIN, [&](size_t begin, size_t end) {
+			for (size_t t = begin; t < end; t++) {
+				const glm::vec3& p0 = positions[indices[t * 3 + 0]];
+				const glm::vec3& p1 = positions[indices[t * 3 + 1]];
+				const glm::vec3& p2 = positions[indices[t * 3 + 2]];
+				faceNormals[t] = glm::cross(p1 - p0, p2 - p0);
+				angles[t * 3 + 0] = cornerAngle(p0, p1, p2);
+				angles[t * 3 + 1] = cornerAngle(p1, p2, p0);
+				angles[t * 3 + 2] = cornerAngle(p2, p0, p1);
+			}
+		});
+
+		std::vector<uint32_t> offsets;
+		std::vector<uint32_t> corners;
+		groupCornersByVertex(indices, positions.size(), offsets, corners);
+
+		const float cosCrease = std::cos(creaseAngle);
+		std::vector<glm::vec3> normals(indices.size());
+		pool.parallelFor(positions.size(), PARALLEL_GRAIN, [&](size_t begin, size_t end) {
+			// corners of a vertex are bucketed by the direction of the face that opened the bucket, which
+			// costs valence times the bucket count (one per crease sector) instead of valence squared
+			struct Bucket {
+				glm::vec3 direction;
+				glm::vec3 sum;
+			};
+			std::vector<Bucket> buckets;
+			std::vector<uint32_t> bucketOf;
+			for (size_t v = begin; v < end; v++) {
+				const uint32_t first = offsets[v];
+				const uint32_t count = offsets[v + 1] - first;
+				buckets.clear();
+				bucketOf.assign(count, NO_BUCKET);
+
+				for (uint32_t c = 0; c < count; c++) {
+					const uint32_t corner = corners[first + c];
+					const glm::vec3& face = faceNormals[corner / 3];
+					const float faceLength = glm::length(face);
+					if (faceLength <= 0.f) continue;
+
+					const glm::vec3 direction = face / faceLength;
+					uint32_t b = 0;
+					while (b < buckets.size() && glm::dot(direction, buckets[b].direction) < cosCrease) b++;
+					if (b == buckets.size()) buckets.push_back({ direction, glm::vec3{ 0.f } });
+					buckets[b].sum += face * angles[corner];
+					bucketOf[c] = b;
+				}
+
+				for (uint32_t c = 0; c < count; c++) {
+					const uint32_t corner = corners[first + c];
+					if (buckets.empty()) {
+						normals[corner] = glm::vec3{ 0.f, 1.f, 0.f };
+						continue;
+					}
+					// corners of degenerate faces have no direction and take the first bucket
+					const Bucket& bucket = buckets[bucketOf[c] != NO_BUCKET ? bucketOf[c] : 0];
+					const float length = glm::length(bucket.sum);
+					normals[corner] = length > 0.f ? bucket.sum / length : bucket.direction;
+				}
+			}
+		});
+		return normals;
+	}
+
+	std::vector<glm::vec4> VcuMeshNormals::generateTangents(std::vector<uint32_t>& indices, const std::vector<glm::vec3>& positions,
+		const std::vector<glm::vec3>& normals, const std::vector<glm::vec2>& uvs, std::vector<uint32_t>& splitVertices) {
+		assert(indices.size() % 3 == 0 && "Index count must be a multiple of 3");
+		const size_t triangleCount = indices.size() / 3;
+		const size_t vertexCount = positions.size();
+		VcuThreadPool& pool = VcuThreadPool::shared();
+
+		// per corner: face tangent projected onto the vertex normal, angle weighted, and handedness
+		std::vector<glm::vec3> cornerTangents(indices.size());
+		std::vector<float> cornerSigns(indices.size());
+		pool.parallelFor(triangleCount, PARALLEL_GRAIN, [&](size_t begin, size_t end) {
+			for (size_t t = begin; t < end; t++) {
+				const uint32_t* tri = &indices[t * 3];
+				const glm::vec3 edge1 = positions[tri[1]] - positions[tri[0]];
+				const glm::vec3 edge2 = positions[tri[2]] - positions[tri[0]];
+				const glm::vec2 uvEdge1 = uvs[tri[1]] - uvs[tri[0]];
+				const glm::vec2 uvEdge2 = uvs[tri[2]] - uvs[tri[0]];
+				const float det = uvEdge1.x * uvEdge2.y - uvEdge2.x * uvEdge1.y;
+
+				glm::vec3 faceTangent{ 0.f };
+				float sign = 1.f;
+				if (std::abs(det) > std::numeric_limits<float>::min()) {
+					faceTangent = (edge1 * uvEdge2.y - edge2 * uvEdge1.y) / det;
+					const glm::vec3 faceBitangent = (edge2 * uvEdge1.x - edge1 * uvEdge2.x) / det;
+					sign = glm::dot(glm::cross(glm::cross(edge1, edge2), faceTangent), faceBitangent) < 0.f ? -1.f : 1.f;
+				}
+
+				for (size_t k = 0; k < 3; k++) {
+					const glm::vec3& normal = normals[tri[k]];
+					const glm::vec3 projected = faceTangent - normal * glm::dot(normal, faceTangent);
+					const float length = glm::length(projected);
+					const float angle = cornerAngle(positions[tri[k]], positions[tri[(k + 1) % 3]], positions[tri[(k + 2) % 3]]);
+					cornerTangents[t * 3 + k] = length > 0.f ? projected * (angle / length) : glm::vec3{ 0.f };
+					cornerSigns[t * 3 + k] = sign;
+				}
+			}
+		});
+
+		std::vector<uint32_t> offsets;
+		std::vector<uint32_t> corners;
+		groupCornersByVertex(indices, vertexCount, offsets, corners);
+
+		// a vertex keeps the handedness of its first corner, corners with the other one move to a copy
+		constexpr uint32_t NO_SPLIT = std::numeric_limits<uint32_t>::max();
+		std::vector<uint32_t> splitOf(vertexCount, NO_SPLIT);
+		splitVertices.clear();
+		for (size_t v = 0; v < vertexCount; v++) {
+			for (uint32_t c = offsets[v] + 1; c < offsets[v + 1]; c++) {
+				if (cornerSigns[corners[c]] != cornerSigns[corners[offsets[v]]]) {
+					splitOf[v] = static_cast<uint32_t>(vertexCount + splitVertices.size());
+					splitVertices.push_back(static_cast<uint32_t>(v));
+					break;
+				}
+			}
+		}
+
+		std::vector<glm::vec4> tangents(vertexCount + splitVertices.size(), glm::vec4{ 1.f, 0.f, 0.f, 1.f });
+		pool.parallelFor(vertexCount, PARALLEL_GRAIN, [&](size_t begin, size_t end) {
+			for (size_t v = begin; v < end; v++) {
+				if (offsets[v] == offsets[v + 1]) continue;
+
+				const float keptSign = cornerSigns[corners[offsets[v]]];
+				glm::vec3 kept{ 0.f };
+				glm::vec3 moved{ 0.f };
+				for (uint32_t c = offsets[v]; c < offsets[v + 1]; c++) {
+					const uint32_t corner = corners[c];
+					if (cornerSigns[corner] == keptSign) {
+						kept += cornerTangents[corner];
+					}
+					else {
+						moved += cornerTangents[corner];
+						indices[corner] = splitOf[v];
+					}
+				}
+
+				auto finish = [&](const glm::vec3& sum, float sign) {
+					const float length = glm::length(sum);
+					return glm::vec4{ length > 0.f ? sum / length : anyPerpendicular(normals[v]), sign };
+				};
+				tangents[v] = finish(kept, keptSign);
+				if (splitOf[v] != NO_SPLIT) {
+					tangents[splitOf[v]] = finish(moved, -keptSign);
+				}
+			}
+		});
+		return tangents;
+	}
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+// libs
+#include <glm/glm.hpp>
+
+// std
+#include <cstdint>
+#include <vector>
+
+namespace vcu {
+	class VcuMeshNormals {
+	public:
+		// Smooth normals for every corner of an indexed triangle list, weighted by face area and
+		// corner angle. Corners on the same position are smoothed together when their faces are
+		// within creaseAngle (radians) of the first face of their group. Runs on VcuThreadPool::shared().
+		static std::vector<glm::vec3> generateCornerNormals(const std::vector<uint32_t>& indices,
+			const std::vector<glm::vec3>& positions, float creaseAngle);
+
+		// Per vertex tangents with the bitangent sign in w, following the MikkTSpace rules: face
+		// tangents from the uv gradient are projected onto the vertex normal and weighted by corner
+		// angle. Vertices used with both handedness are split. The appended vertices copy
+		// splitVertices[i] and the indices are rewritten to use them, so the returned vector has
+		// positions.size() + splitVertices.size() entries.
+		static std::vector<glm::vec4> generateTangents(std::vector<uint32_t>& indices, const std::vector<glm::vec3>& positions,
+			const std::vector<glm::vec3>& normals, const std::vector<glm::vec2>& uvs, std::vector<uint32_t>& splitVertices);
+	};
+}
@@ -0,0 +1,304 @@
+#include "vcu_mesh_optimizer.hpp"
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <numeric>
+
+namespace vcu {
+
+	namespace {
+		// scoring constants from Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+		constexpr uint32_t MAX_CACHE_SIZE = 32;
+		constexpr float CACHE_DECAY_POWER = 1.5f;
+		constexpr float LAST_TRI_SCORE = 0.75f;
+		constexpr float VALENCE_BOOST_SCALE = 2.0f;
+		constexpr float VALENCE_BOOST_POWER = 0.5f;
+
+		float vertexScore(int cachePosition, uint32_t liveTriangles) {
+			if (liveTriangles == 0) return -1.f;
+
+			float score = 0.f;
+			if (cachePosition >= 0) {
+				if (cachePosition < 3) {
+					score = LAST_TRI_SCORE;
+				}
+				else {
+					const float scaler = 1.f / (MAX_CACHE_SIZE - 3);
+					score = std::pow(1.f - (cachePosition - 3) * scaler, CACHE_DECAY_POWER);
+				}
+			}
+			return score + VALENCE_BOOST_SCALE * std::pow(static_cast<float>(liveTriangles), -VALENCE_BOOST_POWER);
+		}
+
+		// FIFO cache simulation based on timestamps, bumping time by cacheSize + 1 flushes the cache
+		class FifoCache {
+		public:
+			FifoCache(size_t vertexCount, uint32_t cacheSize) : timestamps(vertexCount, 0), cacheSize{ cacheSize }, time{ cacheSize + 1 } {}
+
+			uint32_t access(uint32_t a, uint32_t b, uint32_t c) { return access(a) + access(b) + access(c); }
+			void flush() { time += cacheSize + 1; }
+
+		private:
+			uint32_t access(uint32_t v) {
+				if (time - timestamps[v] > cacheSize) {
+					timestamps[v] = time++;
+					return 1;
+				}
+				return 0;
+			}
+
+			std::vector<uint32_t> timestamps;
+			uint32_t cacheSize;
+			uint32_t time;
+		};
+	}
+
+	VcuMeshOptimizer::CacheStats VcuMeshOptimizer::analyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize) {
+		CacheStats stats{};
+		if (indices.empty()) return stats;
+
+		FifoCache cache{ vertexCount, cacheSize };
+		std::vector<bool> referenced(vertexCount, false);
+		size_t uniqueVertices = 0;
+		size_t misses = 0;
+
+		for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+			misses += cache.access(indices[i], indices[i + 1], indices[i + 2]);
+			for (size_t k = 0; k < 3; k++) {
+				if (!referenced[indices[i + k]]) {
+					referenced[indices[i + k]] = true;
+					uniqueVertices++;
+				}
+			}
+		}
+
+		stats.acmr = static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+		stats.atvr = static_cast<float>(misses) / static_cast<float>(uniqueVertices);
+		return stats;
+	}
+
+	void VcuMeshOptimizer::optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount) {
+		assert(indices.size() % 3 == 0 && "Index count must be a multiple of 3");
+		const size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0) return;
+
+		// vertex -> triangle adjacency, each vertex owns [adjacencyOffsets[v], adjacencyOffsets[v] + liveTriangles[v])
+		std::vector<uint32_t> liveTriangles(vertexCount, 0);
+		for (uint32_t index : indices) {
+			liveTriangles[index]++;
+		}
+
+		std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+		for (size_t v = 0; v < vertexCount; v++) {
+			adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+		}
+
+		std::vector<uint32_t> adjacency(indices.size());
+		std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++) {
+			adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+
+		std::vector<int> cachePosition(vertexCount, -1);
+		std::vector<float> vertexScores(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++) {
+			vertexScores[v] = vertexScore(-1, liveTriangles[v]);
+		}
+
+		std::vector<float> triangleScores(triangleCount);
+		std::vector<bool> emitted(triangleCount, false);
+		for (size_t t = 0; t < triangleCount; t++) {
+			triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+		}
+
+		std::vector<uint32_t> result;
+		result.reserve(indices.size());
+		std::vector<uint32_t> cache;
+		std::vector<uint32_t> newCache;
+		cache.reserve(MAX_CACHE_SIZE + 3);
+		newCache.reserve(MAX_CACHE_SIZE + 3);
+
+		size_t scanCursor = 0;
+		int64_t bestTriangle = -1;
+
+		for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++) {
+			if (bestTriangle < 0) {
+				// nothing adjacent to the cache is left, continue with the next triangle in input order
+				while (emitted[scanCursor]) scanCursor++;
+				bestTriangle = static_cast<int64_t>(scanCursor);
+			}
+
+			const uint32_t* tri = &indices[static_cast<size_t>(bestTriangle) * 3];
+			emitted[static_cast<size_t>(bestTriangle)] = true;
+			result.insert(result.end(), tri, tri + 3);
+
+			// the emitted triangle moves to the front of the LRU cache
+			newCache.assign(tri, tri + 3);
+			for (uint32_t v : cache) {
+				if (v != tri[0] && v != tri[1] && v != tri[2]) newCache.push_back(v);
+			}
+
+			for (size_t k = 0; k < 3; k++) {
+				const uint32_t v = tri[k];
+				uint32_t* begin = &adjacency[adjacencyOffsets[v]];
+				uint32_t* end = begin + liveTriangles[v];
+				uint32_t* it = std::find(begin, end, static_cast<uint32_t>(bestTriangle));
+				assert(it != end && "Triangle missing from vertex adjacency");
+				std::swap(*it, *(end - 1));
+				liveTriangles[v]--;
+			}
+
+			for (size_t i = 0; i < newCache.size(); i++) {
+				cachePosition[newCache[i]] = i < MAX_CACHE_SIZE ? static_cast<int>(i) : -1;
+			}
+
+			// rescore every vertex whose cache position changed, including the evicted ones
+			for (uint32_t v : newCache) {
+				const float score = vertexScore(cachePosition[v], liveTriangles[v]);
+				const float delta = score - vertexScores[v];
+				vertexScores[v] = score;
+
+				const uint32_t* adjacent = &adjacency[adjacencyOffsets[v]];
+				for (uint32_t i = 0; i < liveTriangles[v]; i++) {
+					triangleScores[adjacent[i]] += delta;
+				}
+			}
+
+			bestTriangle = -1;
+			float bestScore = -1.f;
+			const size_t cacheSize = std::min<size_t>(newCache.size(), MAX_CACHE_SIZE);
+			for (size_t i = 0; i < cacheSize; i++) {
+				const uint32_t v = newCache[i];
+				const uint32_t* adjacent = &adjacency[adjacencyOffsets[v]];
+				for (uint32_t j = 0; j < liveTriangles[v]; j++) {
+					if (triangleScores[adjacent[j]] > bestScore) {
+						bestScore = triangleScores[adjacent[j]];
+						bestTriangle = adjacent[j];
+					}
+				}
+			}
+
+			newCache.resize(cacheSize);
+			cache.swap(newCache);
+		}
+
+		indices.swap(result);
+	}
+
+	void VcuMeshOptimizer::optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<glm::vec3>& positions, float threshold) {
+		assert(indices.size() % 3 == 0 && "Index count must be a multiple of 3");
+		const size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0) return;
+
+		// hard boundaries: triangles that miss the cache with all three vertices start a new cluster
+		std::vector<uint32_t> hardClusters;
+		{
+			FifoCache cache{ positions.size(), STATS_CACHE_SIZE };
+			for (size_t t = 0; t < triangleCount; t++) {
+				if (cache.access(indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2]) == 3) {
+					hardClusters.push_back(static_cast<uint32_t>(t));
+				}
+			}
+		}
+		hardClusters.push_back(static_cast<uint32_t>(triangleCount));
+
+		// soft boundaries: split a cluster further as long as the prefix ACMR stays within threshold
+		std::vector<uint32_t> clusters;
+		FifoCache cache{ positions.size(), STATS_CACHE_SIZE };
+		for (size_t c = 0; c + 1 < hardClusters.size(); c++) {
+			const uint32_t start = hardClusters[c];
+			const uint32_t end = hardClusters[c + 1];
+
+			cache.flush();
+			uint32_t clusterMisses = 0;
+			for (uint32_t t = start; t < end; t++) {
+				clusterMisses += cache.access(indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2]);
+			}
+			const float clusterAcmr = static_cast<float>(clusterMisses) / static_cast<float>(end - start);
+
+			cache.flush();
+			clusters.push_back(start);
+			uint32_t misses = 0;
+			uint32_t size = 0;
+			for (uint32_t t = start; t < end; t++) {
+				misses += cache.access(indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2]);
+				size++;
+
+				if (t + 1 < end && static_cast<float>(misses) / static_cast<float>(size) <= threshold * clusterAcmr) {
+					clusters.push_back(t + 1);
+					cache.flush();
+					misses = 0;
+					size = 0;
+				}
+			}
+		}
+		clusters.push_back(static_cast<uint32_t>(triangleCount));
+
+		// area weighted centroid of the whole mesh
+		glm::vec3 meshCentroid{ 0.f };
+		float meshArea = 0.f;
+		for (size_t t = 0; t < triangleCount; t++) {
+			const glm::vec3& p0 = positions[indices[t * 3]];
+			const glm::vec3& p1 = positions[indices[t * 3 + 1]];
+			const glm::vec3& p2 = positions[indices[t * 3 + 2]];
+			const float area = glm::length(glm::cross(p1 - p0, p2 - p0));
+			meshCentroid += (p0 + p1 + p2) * (area / 3.f);
+			meshArea += area;
+		}
+		if (meshArea > 0.f) meshCentroid /= meshArea;
+
+		const size_t clusterCount = clusters.size() - 1;
+		std::vector<float> sortKeys(clusterCount);
+		for (size_t c = 0; c < clusterCount; c++) {
+			glm::vec3 centroid{ 0.f };
+			glm::vec3 normal{ 0.f };
+			float area = 0.f;
+			for (uint32_t t = clusters[c]; t < clusters[c + 1]; t++) {
+				const glm::vec3& p0 = positions[indices[t * 3]];
+				const glm::vec3& p1 = positions[indices[t * 3 + 1]];
+				const glm::vec3& p2 = positions[indices[t * 3 + 2]];
+				const glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+				const float triangleArea = glm::length(n);
+				centroid += (p0 + p1 + p2) * (triangleArea / 3.f);
+				normal += n;
+				area += triangleArea;
+			}
+			if (area > 0.f) centroid /= area;
+
+			const float normalLength = glm::length(normal);
+			sortKeys[c] = normalLength > 0.f ? glm::dot(centroid - meshCentroid, normal / normalLength) : 0.f;
+		}
+
+		// clusters facing away from the centre are the likely occluders, draw them first
+		std::vector<uint32_t> order(clusterCount);
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+		std::vector<uint32_t> result;
+		result.reserve(indices.size());
+		for (uint32_t c : order) {
+			result.insert(result.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+		}
+		indices.swap(result);
+	}
+
+	std::vector<uint32_t> VcuMeshOptimizer::optimizeVertexFetch(std::vector<uint32_t>& indices, size_t vertexCount) {
+		constexpr uint32_t UNUSED = ~0u;
+		std::vector<uint32_t> remap(vertexCount, UNUSED);
+
+		uint32_t next = 0;
+		for (uint32_t& index : indices) {
+			if (remap[index] == UNUSED) {
+				remap[index] = next++;
+			}
+			index = remap[index];
+		}
+
+		for (uint32_t& target : remap) {
+			if (target == UNUSED) target = next++;
+		}
+		return remap;
+	}
+}
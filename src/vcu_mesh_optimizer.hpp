@@ -0,0 +1,36 @@
+#pragma once
+
+// libs
+#include <glm/glm.hpp>
+
+// std
+#include <cstdint>
+#include <vector>
+
+namespace vcu {
+	class VcuMeshOptimizer {
+	public:
+		// FIFO size used when reporting statistics, close to the post-transform cache of current GPUs
+		static constexpr uint32_t STATS_CACHE_SIZE = 16;
+
+		struct CacheStats {
+			float acmr = 0.f; // average cache miss ratio: transformed vertices per triangle
+			float atvr = 0.f; // average transform to vertex ratio: transformed vertices per unique vertex
+		};
+
+		static CacheStats analyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount,
+			uint32_t cacheSize = STATS_CACHE_SIZE);
+
+		// Tom Forsyth's linear-speed vertex cache optimisation, reorders triangles in place
+		static void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount);
+
+		// Splits a cache optimised index list into clusters and sorts them so that outward facing
+		// clusters are drawn first. threshold bounds how much ACMR may be sacrificed (1.05 = 5%)
+		static void optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<glm::vec3>& positions,
+			float threshold = 1.05f);
+
+		// Returns a remap table (old index -> new index) that orders vertices by first use and
+		// rewrites the indices accordingly. Unreferenced vertices are moved to the end.
+		static std::vector<uint32_t> optimizeVertexFetch(std::vector<uint32_t>& indices, size_t vertexCount);
+	};
+}
@@ -0,0 +1,238 @@
+#include "vcu_mesh_simplifier.hpp"
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+
+namespace vcu {
+
+	namespace {
+		// symmetric 4x4 error quadric, accumulated in double to keep small planes from vanishing
+		struct Quadric {
+			double a00 = 0.0, a11 = 0.0, a22 = 0.0;
+			double a01 = 0.0, a02 = 0.0, a12 = 0.0;
+			double b0 = 0.0, b1 = 0.0, b2 = 0.0;
+			double c = 0.0;
+
+			void addPlane(double nx, double ny, double nz, double d, double weight) {
+				a00 += weight * nx * nx;
+				a11 += weight * ny * ny;
+				a22 += weight * nz * nz;
+				a01 += weight * nx * ny;
+				a02 += weight * nx * nz;
+				a12 += weight * ny * nz;
+				b0 += weight * nx * d;
+				b1 += weight * ny * d;
+				b2 += weight * nz * d;
+				c += weight * d * d;
+			}
+
+			void add(const Quadric& other) {
+				a00 += other.a00; a11 += other.a11; a22 += other.a22;
+				a01 += other.a01; a02 += other.a02; a12 += other.a12;
+				b0 += other.b0; b1 += other.b1; b2 += other.b2;
+				c += other.c;
+			}
+
+			double error(const glm::vec3& p) const {
+				const double x = p.x, y = p.y, z = p.z;
+				const double e = a00 * x * x + a11 * y * y + a22 * z * z
+					+ 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z)
+					+ 2.0 * (b0 * x + b1 * y + b2 * z) + c;
+				return std::max(e, 0.0);
+			}
+		};
+
+		struct Collapse {
+			uint32_t from;
+			uint32_t to;
+			float error;
+		};
+
+		struct PositionHash {
+			size_t operator()(const glm::vec3& p) const {
+				uint32_t bits[3];
+				std::memcpy(bits, &p, sizeof(bits));
+				return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+			}
+		};
+
+		glm::vec3 triangleNormal(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2) {
+			return glm::cross(p1 - p0, p2 - p0);
+		}
+
+		// vertices that have to stay in place: open borders and attribute seams
+		std::vector<bool> findLockedVertices(const std::vector<uint32_t>& indices, const std::vector<glm::vec3>& positions) {
+			const size_t vertexCount = positions.size();
+			std::vector<bool> locked(vertexCount, false);
+
+			std::unordered_map<glm::vec3, uint32_t, PositionHash> firstWithPosition;
+			firstWithPosition.reserve(vertexCount);
+			std::vector<uint32_t> positionUses(vertexCount, 0);
+			std::vector<uint32_t> positionClass(vertexCount);
+			for (uint32_t v = 0; v < vertexCount; v++) {
+				auto it = firstWithPosition.emplace(positions[v], v).first;
+				positionClass[v] = it->second;
+				positionUses[it->second]++;
+			}
+			for (uint32_t v = 0; v < vertexCount; v++) {
+				if (positionUses[positionClass[v]] > 1) locked[v] = true;
+			}
+
+			// a directed edge without its opposite lies on a border
+			std::unordered_map<uint64_t, uint32_t> directedEdges;
+			directedEdges.reserve(indices.size());
+			for (size_t i = 0; i < indices.size(); i += 3) {
+				for (size_t k = 0; k < 3; k++) {
+					const uint64_t a = indices[i + k];
+					const uint64_t b = indices[i + (k + 1) % 3];
+					directedEdges[(a << 32) | b]++;
+				}
+			}
+			for (const auto& kv : directedEdges) {
+				const uint64_t a = kv.first >> 32;
+				const uint64_t b = kv.first & 0xffffffffu;
+				if (directedEdges.count((b << 32) | a) == 0) {
+					locked[a] = true;
+					locked[b] = true;
+				}
+			}
+			return locked;
+		}
+	}
+
+	std::vector<uint32_t> VcuMeshSimplifier::simplify(const std::vector<uint32_t>& indices, const std::vector<glm::vec3>& positions,
+		size_t targetIndexCount, float targetError, float* resultError) {
+		assert(indices.size() % 3 == 0 && "Index count must be a multiple of 3");
+		const size_t vertexCount = positions.size();
+		std::vector<uint32_t> result = indices;
+		if (resultError) *resultError = 0.f;
+		if (result.size() <= targetIndexCount || vertexCount == 0) return result;
+
+		// work in coordinates normalized to the mesh extent so errors are scale independent
+		glm::vec3 minPosition = positions[0];
+		glm::vec3 maxPosition = positions[0];
+		for (const auto& p : positions) {
+			minPosition = glm::min(minPosition, p);
+			maxPosition = glm::max(maxPosition, p);
+		}
+		const glm::vec3 extent = maxPosition - minPosition;
+		const float scale = std::max(extent.x, std::max(extent.y, extent.z));
+		if (scale <= 0.f) return result;
+
+		std::vector<glm::vec3> points(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++) {
+			points[v] = (positions[v] - minPosition) / scale;
+		}
+
+		const std::vector<bool> locked = findLockedVertices(indices, positions);
+
+		std::vector<Quadric> quadrics(vertexCount);
+		for (size_t i = 0; i < result.size(); i += 3) {
+			const glm::vec3& p0 = points[result[i]];
+			const glm::vec3 n = triangleNormal(p0, points[result[i + 1]], points[result[i + 2]]);
+			const float area = glm::length(n);
+			if (area <= 0.f) continue;
+
+			const glm::vec3 unit = n / area;
+			const float d = -glm::dot(unit, p0);
+			for (size_t k = 0; k < 3; k++) {
+				quadrics[result[i + k]].addPlane(unit.x, unit.y, unit.z, d, area);
+			}
+		}
+
+		const double maxError = static_cast<double>(targetError) * targetError;
+		double reachedError = 0.0;
+
+		std::vector<Collapse> collapses;
+		std::vector<uint32_t> remap(vertexCount);
+		std::vector<bool> touched(vertexCount);
+		std::vector<uint32_t> adjacencyOffsets(vertexCount + 1);
+		std::vector<uint32_t> adjacency;
+
+		while (result.size() > targetIndexCount) {
+			collapses.clear();
+			for (size_t i = 0; i < result.size(); i += 3) {
+				for (size_t k = 0; k < 3; k++) {
+					const uint32_t from = result[i + k];
+					const uint32_t to = result[i + (k + 1) % 3];
+					if (locked[from]) continue;
+
+					Quadric q = quadrics[from];
+					q.add(quadrics[to]);
+					collapses.push_back({ from, to, static_cast<float>(q.error(points[to])) });
+				}
+			}
+			if (collapses.empty()) break;
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+			// vertex -> triangle adjacency of the current index list for the flip test
+			std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+			for (uint32_t index : result) adjacencyOffsets[index + 1]++;
+			for (size_t v = 0; v < vertexCount; v++) adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+			adjacency.resize(result.size());
+			std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+			for (size_t i = 0; i < result.size(); i++) {
+				adjacency[fill[result[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+
+			// every interior collapse removes two triangles
+			const size_t collapseGoal = (result.size() - targetIndexCount) / 6 + 1;
+			std::iota(remap.begin(), remap.end(), 0);
+			std::fill(touched.begin(), touched.end(), false);
+			size_t performed = 0;
+
+			for (const Collapse& collapse : collapses) {
+				if (collapse.error > maxError) break;
+				if (touched[collapse.from] || touched[collapse.to]) continue;
+
+				bool flips = false;
+				for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1] && !flips; a++) {
+					const uint32_t* tri = &result[adjacency[a] * 3];
+					if (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to) continue;
+
+					glm::vec3 moved[3];
+					for (size_t k = 0; k < 3; k++) {
+						moved[k] = tri[k] == collapse.from ? points[collapse.to] : points[tri[k]];
+					}
+					const glm::vec3 before = triangleNormal(points[tri[0]], points[tri[1]], points[tri[2]]);
+					const glm::vec3 after = triangleNormal(moved[0], moved[1], moved[2]);
+					flips = glm::dot(before, after) <= 0.f;
+				}
+				if (flips) continue;
+
+				// freeze the neighbourhood so the flip test above stays valid for the rest of the pass
+				for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1]; a++) {
+					const uint32_t* tri = &result[adjacency[a] * 3];
+					touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = true;
+				}
+
+				remap[collapse.from] = collapse.to;
+				quadrics[collapse.to].add(quadrics[collapse.from]);
+				reachedError = std::max(reachedError, static_cast<double>(collapse.error));
+				if (++performed >= collapseGoal) break;
+			}
+			if (performed == 0) break;
+
+			size_t write = 0;
+			for (size_t i = 0; i < result.size(); i += 3) {
+				const uint32_t a = remap[result[i]];
+				const uint32_t b = remap[result[i + 1]];
+				const uint32_t c = remap[result[i + 2]];
+				if (a == b || b == c || a == c) continue;
+
+				result[write++] = a;
+				result[write++] = b;
+				result[write++] = c;
+			}
+			result.resize(write);
+		}
+
+		if (resultError) *resultError = static_cast<float>(std::sqrt(reachedError));
+		return result;
+	}
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+// libs
+#include <glm/glm.hpp>
+
+// std
+#include <cstdint>
+#include <vector>
+
+namespace vcu {
+	class VcuMeshSimplifier {
+	public:
+		// Quadric error metric edge collapse. Vertices are only ever collapsed onto other existing
+		// vertices, so the result indexes the same vertex buffer as the input. Border vertices and
+		// vertices on attribute seams (same position, different attributes) are never moved.
+		// targetError is a distance relative to the mesh extent, the error actually reached is
+		// written to resultError.
+		static std::vector<uint32_t> simplify(const std::vector<uint32_t>& indices, const std::vector<glm::vec3>& positions,
+			size_t targetIndexCount, float targetError, float* resultError = nullptr);
+	};
+}
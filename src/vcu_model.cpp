@@ -1,6 +1,11 @@
 #include "vcu_model.hpp"
 #include "bezier.hpp"
 #include "vcu_utils.hpp"
+#include "vcu_mesh_codec.hpp"
+#include "vcu_mesh_normals.hpp"
+#include "vcu_mesh_optimizer.hpp"
+#include "vcu_mesh_simplifier.hpp"
+#include "vcu_thread_pool.hpp"
 
 // libs
 #define TINYOBJLOADER_IMPLEMENTATION
@@ -9,20 +14,305 @@
 #include <glm/gtx/hash.hpp>
 
 // std
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <chrono>
+#include <cstddef>
 #include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
 #include <unordered_map>
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define VCU_MODEL_SSE
+#endif
+
 #ifndef ENGINE_DIR
 #define ENGINE_DIR "../"
 #endif
 
+namespace {
+	constexpr uint32_t MESH_CACHE_MAGIC = 0x4d554356; // "VCUM"
+	constexpr uint32_t MESH_CACHE_VERSION = 6;
+	constexpr uint32_t MESH_CACHE_OPTIMIZED = 1u << 0;
+	constexpr uint32_t MESH_CACHE_TANGENTS = 1u << 1;
+	constexpr uint32_t MESH_CACHE_QUANTIZED = 1u << 2; // 16 bit vertex channels, only used for the packed format
+	constexpr uint32_t MESH_CACHE_LOD_SHIFT = 8;
+	// MeshCacheHeader::properties, results of the analysis done when the cache was written
+	constexpr uint32_t MESH_PROPERTY_CLOSED = 1u << 0;
+	constexpr uint32_t MESH_PROPERTY_CLOCKWISE = 1u << 1;
+	constexpr uint32_t MESH_CACHE_MAX_STRING = 4096;
+
+	// each LOD targets half the triangles of the previous one within this relative error
+	constexpr float LOD_MAX_ERROR = 0.02f;
+	// screen space error, as a fraction of the viewport height, at which a coarser LOD is accepted
+	constexpr float LOD_SCREEN_ERROR = 0.001f;
+	// a coarser LOD is only picked once its error is this far below the threshold
+	constexpr float LOD_HYSTERESIS = 0.75f;
+
+	// faces meeting at a sharper angle keep separate normals when normals are generated
+	constexpr float NORMAL_CREASE_ANGLE = 1.0471976f; // 60 degrees
+
+	// OBJ files above this size are parsed line by line instead of being loaded whole by tinyobj
+	constexpr std::uintmax_t STREAMING_OBJ_SIZE = 64ull * 1024 * 1024;
+
+	// closed meshes whose signed volume is below this fraction of the bounding cube are treated as flat
+	constexpr double CLOSED_MIN_VOLUME = 1e-6;
+
+	bool hasExtension(const std::string& filepath, const std::string& extension) {
+		return filepath.size() >= extension.size() &&
+			filepath.compare(filepath.size() - extension.size(), extension.size(), extension) == 0;
+	}
+
+	// triangles whose edges are closer than this sine to parallel have no reliable face normal
+	constexpr float DEGENERATE_SINE = 1e-6f;
+
+	// the normal cone is only built when the faces have a known outward winding, for meshes drawn
+	// without back face culling both sides are visible and the cone is left disabled
+	void computeMeshletBounds(vcu::VcuModel::Meshlet& meshlet, const std::vector<vcu::VcuModel::Vertex>& vertices,
+		const std::vector<uint32_t>& indices, bool buildCone, bool clockwise) {
+		const uint32_t end = meshlet.firstIndex + meshlet.indexCount;
+		auto positionAt = [&](uint32_t i) -> const glm::vec3& { return vertices[meshlet.vertexOffset + indices[i]].position; };
+
+		glm::vec3 minPosition = positionAt(meshlet.firstIndex);
+		glm::vec3 maxPosition = minPosition;
+		for (uint32_t i = meshlet.firstIndex; i < end; i++) {
+			minPosition = glm::min(minPosition, positionAt(i));
+			maxPosition = glm::max(maxPosition, positionAt(i));
+		}
+
+		meshlet.center = (minPosition + maxPosition) * 0.5f;
+		float radiusSquared = 0.f;
+		for (uint32_t i = meshlet.firstIndex; i < end; i++) {
+			const glm::vec3 offset = positionAt(i) - meshlet.center;
+			radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+		}
+		meshlet.radius = std::sqrt(radiusSquared);
+
+		meshlet.coneCutoff = 1.f;
+		if (!buildCone) return;
+
+		std::vector<glm::vec3> faceNormals{};
+		faceNormals.reserve(meshlet.indexCount / 3);
+		glm::vec3 normalSum{ 0.f };
+		for (uint32_t i = meshlet.firstIndex; i + 2 < end; i += 3) {
+			const glm::vec3 edge1 = positionAt(i + 1) - positionAt(i);
+			const glm::vec3 edge2 = positionAt(i + 2) - positionAt(i);
+			const glm::vec3 normal = clockwise ? glm::cross(edge2, edge1) : glm::cross(edge1, edge2);
+			const float length = glm::length(normal);
+			if (length <= DEGENERATE_SINE * glm::length(edge1) * glm::length(edge2)) continue;
+
+			faceNormals.push_back(normal / length);
+			normalSum += faceNormals.back();
+		}
+		const float sumLength = glm::length(normalSum);
+		if (faceNormals.empty() || sumLength <= 0.f) return;
+
+		meshlet.coneAxis = normalSum / sumLength;
+		float minDot = 1.f;
+		for (const glm::vec3& normal : faceNormals) {
+			minDot = std::min(minDot, glm::dot(normal, meshlet.coneAxis));
+		}
+		// normals spread over more than a hemisphere can always face the camera
+		if (minDot > 0.f) {
+			meshlet.coneCutoff = std::sqrt(1.f - minDot * minDot);
+		}
+	}
+
+	void loadMeshFile(vcu::VcuModel::Builder& builder, const std::string& filepath) {
+		if (hasExtension(filepath, ".gltf") || hasExtension(filepath, ".glb")) {
+			builder.loadGltf(filepath);
+		}
+		else if (std::filesystem::file_size(filepath) > STREAMING_OBJ_SIZE) {
+			builder.loadModelStreaming(filepath);
+		}
+		else {
+			builder.loadModel(filepath);
+		}
+		builder.generateNormals();
+		builder.computeBounds();
+		builder.analyzeClosedness();
+	}
+
+	struct MeshCacheHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t flags;
+		uint32_t vertexSize;
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		uint32_t rangeCount;
+		uint32_t lodCount;
+		uint32_t vertexBytes; // size of the encoded vertex stream
+		uint32_t indexBytes; // size of the encoded index stream
+		uint32_t properties;
+		uint32_t materialCount; // materials follow the LOD table
+	};
+
+	// follows the header of quantized caches
+	struct MeshCacheQuantization {
+		glm::vec3 positionMin;
+		glm::vec3 positionExtent;
+		glm::vec2 uvMin;
+		glm::vec2 uvExtent;
+	};
+
+	// material names and texture paths are stored as a length and the bytes
+	void writeCacheString(std::ofstream& file, const std::string& value) {
+		const uint32_t length = static_cast<uint32_t>(value.size());
+		file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+		file.write(value.data(), length);
+	}
+
+	void readCacheString(std::ifstream& file, std::string& value) {
+		uint32_t length = 0;
+		file.read(reinterpret_cast<char*>(&length), sizeof(length));
+		if (!file || length > MESH_CACHE_MAX_STRING) {
+			file.setstate(std::ios::failbit);
+			return;
+		}
+		value.resize(length);
+		file.read(value.data(), length);
+	}
+
+	uint16_t quantizeUnorm16(float v) {
+		return static_cast<uint16_t>(std::round(std::clamp(v, 0.f, 1.f) * 65535.f));
+	}
+
+	int16_t quantizeSnorm16(float v) {
+		return static_cast<int16_t>(std::round(std::clamp(v, -1.f, 1.f) * 32767.f));
+	}
+
+	uint8_t quantizeUnorm8(float v) {
+		return static_cast<uint8_t>(std::round(std::clamp(v, 0.f, 1.f) * 255.f));
+	}
+
+	glm::vec2 octahedralEncode(glm::vec3 n) {
+		const float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+		if (sum == 0.f) return glm::vec2{ 0.f };
+
+		n /= sum;
+		if (n.z >= 0.f) return glm::vec2{ n.x, n.y };
+
+		return glm::vec2{
+			(1.f - std::abs(n.y)) * (n.x >= 0.f ? 1.f : -1.f),
+			(1.f - std::abs(n.x)) * (n.y >= 0.f ? 1.f : -1.f) };
+	}
+
+	glm::vec3 octahedralDecode(glm::vec2 e) {
+		glm::vec3 n{ e.x, e.y, 1.f - std::abs(e.x) - std::abs(e.y) };
+		if (n.z < 0.f) {
+			n.x = (1.f - std::abs(e.y)) * (e.x >= 0.f ? 1.f : -1.f);
+			n.y = (1.f - std::abs(e.x)) * (e.y >= 0.f ? 1.f : -1.f);
+		}
+		const float length = glm::length(n);
+		return length > 0.f ? n / length : n;
+	}
+
+	float dequantizeUnorm16(uint16_t v) {
+		return v / 65535.f;
+	}
+
+	float dequantizeSnorm16(uint16_t v) {
+		return std::max(static_cast<int16_t>(v) / 32767.f, -1.f);
+	}
+
+	uint16_t snorm16Bits(float v) {
+		return static_cast<uint16_t>(quantizeSnorm16(v));
+	}
+
+	// channels of a quantized cache vertex: position 3, normal 2, uv 2, color 3 and optionally tangent 3
+	constexpr size_t QUANTIZED_CHANNELS = 10;
+	constexpr size_t QUANTIZED_TANGENT_CHANNELS = 3;
+
+	std::vector<uint16_t> quantizeCacheVertices(const std::vector<vcu::VcuModel::Vertex>& vertices, bool tangents,
+		MeshCacheQuantization& quantization) {
+		glm::vec3 positionMin{ vertices[0].position };
+		glm::vec3 positionMax{ vertices[0].position };
+		glm::vec2 uvMin{ vertices[0].uv };
+		glm::vec2 uvMax{ vertices[0].uv };
+		for (const auto& vertex : vertices) {
+			positionMin = glm::min(positionMin, vertex.position);
+			positionMax = glm::max(positionMax, vertex.position);
+			uvMin = glm::min(uvMin, vertex.uv);
+			uvMax = glm::max(uvMax, vertex.uv);
+		}
+		quantization.positionMin = positionMin;
+		quantization.positionExtent = positionMax - positionMin;
+		quantization.uvMin = uvMin;
+		quantization.uvExtent = uvMax - uvMin;
+		for (int i = 0; i < 3; i++) {
+			if (quantization.positionExtent[i] <= 0.f) quantization.positionExtent[i] = 1.f;
+		}
+		for (int i = 0; i < 2; i++) {
+			if (quantization.uvExtent[i] <= 0.f) quantization.uvExtent[i] = 1.f;
+		}
+
+		const size_t channels = QUANTIZED_CHANNELS + (tangents ? QUANTIZED_TANGENT_CHANNELS : 0);
+		std::vector<uint16_t> records(vertices.size() * channels);
+		for (size_t i = 0; i < vertices.size(); i++) {
+			const auto& vertex = vertices[i];
+			uint16_t* out = &records[i * channels];
+
+			const glm::vec3 position = (vertex.position - quantization.positionMin) / quantization.positionExtent;
+			const glm::vec2 normal = octahedralEncode(vertex.normal);
+			const glm::vec2 uv = (vertex.uv - quantization.uvMin) / quantization.uvExtent;
+			out[0] = quantizeUnorm16(position.x);
+			out[1] = quantizeUnorm16(position.y);
+			out[2] = quantizeUnorm16(position.z);
+			out[3] = snorm16Bits(normal.x);
+			out[4] = snorm16Bits(normal.y);
+			out[5] = quantizeUnorm16(uv.x);
+			out[6] = quantizeUnorm16(uv.y);
+			out[7] = quantizeUnorm16(vertex.color.x);
+			out[8] = quantizeUnorm16(vertex.color.y);
+			out[9] = quantizeUnorm16(vertex.color.z);
+			if (tangents) {
+				const glm::vec2 tangent = octahedralEncode(glm::vec3{ vertex.tangent });
+				out[10] = snorm16Bits(tangent.x);
+				out[11] = snorm16Bits(tangent.y);
+				out[12] = vertex.tangent.w < 0.f ? 1 : 0;
+			}
+		}
+		return records;
+	}
+
+	void dequantizeCacheVertices(const std::vector<uint16_t>& records, bool tangents, const MeshCacheQuantization& quantization,
+		std::vector<vcu::VcuModel::Vertex>& vertices) {
+		const size_t channels = QUANTIZED_CHANNELS + (tangents ? QUANTIZED_TANGENT_CHANNELS : 0);
+		for (size_t i = 0; i < vertices.size(); i++) {
+			const uint16_t* in = &records[i * channels];
+			auto& vertex = vertices[i];
+
+			vertex.position = quantization.positionMin + quantization.positionExtent *
+				glm::vec3{ dequantizeUnorm16(in[0]), dequantizeUnorm16(in[1]), dequantizeUnorm16(in[2]) };
+			vertex.normal = octahedralDecode(glm::vec2{ dequantizeSnorm16(in[3]), dequantizeSnorm16(in[4]) });
+			vertex.uv = quantization.uvMin + quantization.uvExtent * glm::vec2{ dequantizeUnorm16(in[5]), dequantizeUnorm16(in[6]) };
+			vertex.color = glm::vec3{ dequantizeUnorm16(in[7]), dequantizeUnorm16(in[8]), dequantizeUnorm16(in[9]) };
+			vertex.tangent = glm::vec4{ 0.f };
+			if (tangents) {
+				const glm::vec3 tangent = octahedralDecode(glm::vec2{ dequantizeSnorm16(in[10]), dequantizeSnorm16(in[11]) });
+				vertex.tangent = glm::vec4{ tangent.x, tangent.y, tangent.z, in[12] ? -1.f : 1.f };
+			}
+		}
+	}
+
+	// float vertices are coded losslessly as their bit patterns
+	constexpr size_t FLOAT_CHANNELS = sizeof(vcu::VcuModel::Vertex) / sizeof(float);
+	static_assert(sizeof(vcu::VcuModel::Vertex) == FLOAT_CHANNELS * sizeof(float), "Vertex must only contain floats");
+}
+
 namespace std {
 	template<> 
 	struct hash<vcu::VcuModel::Vertex> {
 		size_t operator()(vcu::VcuModel::Vertex const& vertex) const {
 			size_t seed = 0;
-			vcu::hashCombine(seed, vertex.position, vertex.color, vertex.normal, vertex.uv);
+			vcu::hashCombine(seed, vertex.position, vertex.color, vertex.normal, vertex.uv, vertex.tangent);
 			return seed;
 		}
 	}; 
@@ -31,43 +321,183 @@ namespace std {
 
 namespace vcu {
 
-	VcuModel::VcuModel(VcuDevice& device, const VcuModel::Builder& builder) : vcuDevice{ device } {
-		createVertexBuffers(builder.vertices);
+	static_assert(sizeof(VcuModel::PackedVertex) == VcuModel::PackedVertexLayout::stride &&
+		offsetof(VcuModel::PackedVertex, normal) == VcuModel::PackedVertexLayout::offsetOf(2) &&
+		offsetof(VcuModel::PackedVertex, uv) == VcuModel::PackedVertexLayout::offsetOf(3) &&
+		offsetof(VcuModel::PackedVertex, color) == VcuModel::PackedVertexLayout::offsetOf(1),
+		"PackedVertex does not match PackedVertexLayout");
+
+	VcuModel::VcuModel(VcuGeometryPool& pool, const VcuModel::Builder& builder)
+		: geometryPool{ pool }, vertexFormat{ builder.vertexFormat }, boundingBox{ builder.boundingBox }, boundingSphere{ builder.boundingSphere },
+		backfaceCullable{ builder.canBackfaceCull }, frontFace{ builder.frontFace }, positionStream{ builder.positionStream } {
+		if (vertexFormat == VertexFormat::Packed) {
+			createPackedVertexBuffers(builder.vertices);
+		}
+		else {
+			createVertexBuffers(builder.vertices);
+		}
 		createIndexBuffer(builder.indices);
+
+		indexRanges = builder.indexRanges;
+		lods = builder.lods;
+		meshlets = builder.meshlets;
+		materials = builder.materials;
+		if (indexRanges.empty() && hasIndexBuffer) {
+			indexRanges.push_back({ 0, indexCount, 0 });
+		}
+		if (lods.empty()) {
+			lods.push_back({ 0, static_cast<uint32_t>(indexRanges.size()), 0.f });
+		}
 	}
 
-	VcuModel::~VcuModel() {}
+	VcuModel::~VcuModel() {
+		geometryPool.freeVertices(vertexAllocation);
+		geometryPool.freeVertices(positionAllocation);
+		geometryPool.freeIndices(indexAllocation);
+	}
 
-	std::unique_ptr<VcuModel> VcuModel::createModelFromFile(VcuDevice& device, const std::string& filepath) {
+	std::unique_ptr<VcuModel> VcuModel::createModelFromFile(VcuGeometryPool& pool, const std::string& filepath) {
 		Builder builder{};
-		builder.loadModel(ENGINE_DIR + filepath);
-		return std::make_unique<VcuModel>(device, builder);
+		loadMeshFile(builder, ENGINE_DIR + filepath);
+		return std::make_unique<VcuModel>(pool, builder);
 	}
 
-	std::unique_ptr<VcuModel> VcuModel::createModelBezier(VcuDevice& device) {
+	std::unique_ptr<VcuModel> VcuModel::createModelFromFile(VcuGeometryPool& pool, const std::string& filepath, const LoadOptions& options) {
+		Builder builder{};
+		builder.loadFromFile(ENGINE_DIR + filepath, options);
+		return std::make_unique<VcuModel>(pool, builder);
+	}
+
+	std::shared_ptr<VcuModel::AsyncLoad> VcuModel::createModelFromFileAsync(VcuGeometryPool& pool, const std::string& filepath, const LoadOptions& options) {
+		const std::string sourcePath = ENGINE_DIR + filepath;
+		auto builder = VcuThreadPool::shared().submit([sourcePath, options]() {
+			auto builder = std::make_unique<Builder>();
+			builder->loadFromFile(sourcePath, options);
+			return builder;
+		});
+		return std::make_shared<AsyncLoad>(pool, std::move(builder));
+	}
+
+	VcuModel::AsyncLoad::AsyncLoad(VcuGeometryPool& pool, std::future<std::unique_ptr<Builder>> builder)
+		: geometryPool{ pool }, pendingBuilder{ std::move(builder) } {}
+
+	std::shared_ptr<VcuModel> VcuModel::AsyncLoad::poll() {
+		if (model != nullptr || !pendingBuilder.valid()) return model;
+		if (pendingBuilder.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return nullptr;
+
+		// rethrows anything the loader threw on the worker
+		std::unique_ptr<Builder> builder = pendingBuilder.get();
+		model = std::make_shared<VcuModel>(geometryPool, *builder);
+		return model;
+	}
+
+	std::unique_ptr<VcuModel> VcuModel::createModelBezier(VcuGeometryPool& pool) {
 		Builder builder{};
 		builder.loadBezier();
-		return std::make_unique<VcuModel>(device, builder);
+		return std::make_unique<VcuModel>(pool, builder);
 	}
 
 
 	void VcuModel::createVertexBuffers(const std::vector<Vertex>& vertices) {
 		vertexCount = static_cast<uint32_t>(vertices.size());
 		assert(vertexCount >= 3 && "Vertex count must be at least 3");
-		VkDeviceSize bufferSize = sizeof(vertices[0]) * vertexCount;
-		uint32_t vertexSize = sizeof(vertices[0]);
 
-		VcuBuffer stagingBuffer{ vcuDevice, vertexSize, vertexCount, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT }; 
+		// the tangent is not read by any shader yet, so it stays on the CPU
+		std::vector<char> stream(StandardVertexLayout::stride * vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++) {
+			const Vertex& vertex = vertices[i];
+			StandardVertexLayout::write(&stream[i * StandardVertexLayout::stride], vertex.position, vertex.color, vertex.normal, vertex.uv);
+		}
+		uploadVertexData(stream.data(), StandardVertexLayout::stride);
+
+		if (positionStream) {
+			std::vector<char> positions(StandardPositionLayout::stride * vertices.size());
+			for (size_t i = 0; i < vertices.size(); i++) {
+				StandardPositionLayout::write(&positions[i * StandardPositionLayout::stride], vertices[i].position);
+			}
+			uploadPositionData(positions.data(), StandardPositionLayout::stride);
+		}
+	}
+
+	void VcuModel::createPackedVertexBuffers(const std::vector<Vertex>& vertices) {
+		vertexCount = static_cast<uint32_t>(vertices.size());
+		assert(vertexCount >= 3 && "Vertex count must be at least 3");
+
+		// quantization ranges come from the vertices themselves, not from the builder's culling bounds
+		glm::vec3 positionMin{ vertices[0].position };
+		glm::vec3 positionMax{ vertices[0].position };
+		glm::vec2 uvMin{ vertices[0].uv };
+		glm::vec2 uvMax{ vertices[0].uv };
+		for (const auto& vertex : vertices) {
+			positionMin = glm::min(positionMin, vertex.position);
+			positionMax = glm::max(positionMax, vertex.position);
+			uvMin = glm::min(uvMin, vertex.uv);
+			uvMax = glm::max(uvMax, vertex.uv);
+		}
+
+		glm::vec3 positionExtent = positionMax - positionMin;
+		glm::vec2 uvExtent = uvMax - uvMin;
+		for (int i = 0; i < 3; i++) {
+			if (positionExtent[i] <= 0.f) positionExtent[i] = 1.f;
+		}
+		for (int i = 0; i < 2; i++) {
+			if (uvExtent[i] <= 0.f) uvExtent[i] = 1.f;
+		}
+
+		std::vector<PackedVertex> packed(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++) {
+			const Vertex& vertex = vertices[i];
+			PackedVertex& out = packed[i];
 
-		stagingBuffer.map();
-		stagingBuffer.writeToBuffer((void *)vertices.data());
+			const glm::vec3 position = (vertex.position - positionMin) / positionExtent;
+			out.position[0] = quantizeUnorm16(position.x);
+			out.position[1] = quantizeUnorm16(position.y);
+			out.position[2] = quantizeUnorm16(position.z);
+			out.position[3] = 0;
 
-		vertexBuffer = std::make_unique<VcuBuffer>(vcuDevice, vertexSize, vertexCount,
-						VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-						VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			const glm::vec2 normal = octahedralEncode(vertex.normal);
+			out.normal[0] = quantizeSnorm16(normal.x);
+			out.normal[1] = quantizeSnorm16(normal.y);
 
-		vcuDevice.copyBuffer(stagingBuffer.getBuffer(), vertexBuffer->getBuffer(), bufferSize);
+			const glm::vec2 uv = (vertex.uv - uvMin) / uvExtent;
+			out.uv[0] = quantizeUnorm16(uv.x);
+			out.uv[1] = quantizeUnorm16(uv.y);
+
+			out.color[0] = quantizeUnorm8(vertex.color.x);
+			out.color[1] = quantizeUnorm8(vertex.color.y);
+			out.color[2] = quantizeUnorm8(vertex.color.z);
+			out.color[3] = 255;
+		}
+
+		// position decode is folded into the model matrix by the render systems
+		positionDecode = glm::mat4{ 1.f };
+		positionDecode[0][0] = positionExtent.x;
+		positionDecode[1][1] = positionExtent.y;
+		positionDecode[2][2] = positionExtent.z;
+		positionDecode[3] = glm::vec4{ positionMin, 1.f };
+		uvDecode = glm::vec4{ uvMin.x, uvMin.y, uvExtent.x, uvExtent.y };
+
+		uploadVertexData(packed.data(), sizeof(PackedVertex));
+
+		if (positionStream) {
+			std::vector<char> positions(PackedPositionLayout::stride * packed.size());
+			for (size_t i = 0; i < packed.size(); i++) {
+				PackedPositionLayout::write(&positions[i * PackedPositionLayout::stride], packed[i].position);
+			}
+			uploadPositionData(positions.data(), PackedPositionLayout::stride);
+		}
+	}
+
+	void VcuModel::uploadVertexData(const void* data, uint32_t vertexSize) {
+		VkDeviceSize bufferSize = static_cast<VkDeviceSize>(vertexSize) * vertexCount;
+		vertexAllocation = geometryPool.allocateVertices(data, bufferSize, vertexSize);
+		baseVertex = static_cast<int32_t>(vertexAllocation.offset / vertexSize);
+	}
+
+	void VcuModel::uploadPositionData(const void* data, uint32_t positionSize) {
+		VkDeviceSize bufferSize = static_cast<VkDeviceSize>(positionSize) * vertexCount;
+		positionAllocation = geometryPool.allocateVertices(data, bufferSize, positionSize);
+		positionBaseVertex = static_cast<int32_t>(positionAllocation.offset / positionSize);
 	}
 
 	void VcuModel::createIndexBuffer(const std::vector<uint32_t>& indices) {
@@ -76,73 +506,182 @@ namespace vcu {
 
 		if (!hasIndexBuffer) return;
 
-		VkDeviceSize bufferSize = sizeof(indices[0]) * indexCount;
-		uint32_t indexSize = sizeof(indices[0]);
+		const uint32_t maxIndex = *std::max_element(indices.begin(), indices.end());
+		if (maxIndex <= std::numeric_limits<uint16_t>::max()) {
+			std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+			indexType = VK_INDEX_TYPE_UINT16;
+			uploadIndexData(shortIndices.data(), sizeof(uint16_t));
+		}
+		else {
+			indexType = VK_INDEX_TYPE_UINT32;
+			uploadIndexData(indices.data(), sizeof(uint32_t));
+		}
+	}
 
-		VcuBuffer stagingBuffer{ vcuDevice, indexSize, indexCount, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-							VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT };
+	void VcuModel::uploadIndexData(const void* data, uint32_t indexSize) {
+		VkDeviceSize bufferSize = static_cast<VkDeviceSize>(indexSize) * indexCount;
+		indexAllocation = geometryPool.allocateIndices(data, bufferSize, indexSize);
+		baseIndex = static_cast<uint32_t>(indexAllocation.offset / indexSize);
+	}
 
-		stagingBuffer.map();
-		stagingBuffer.writeToBuffer((void *)indices.data());	
+	void VcuModel::bind(VkCommandBuffer commandBuffer) {
+		if (hasIndexBuffer) {
+			geometryPool.bindIndexType(commandBuffer, indexType);
+		}
+	}
+	void VcuModel::draw(VkCommandBuffer commandBuffer) {
+		draw(commandBuffer, 0);
+	}
 
-		indexBuffer = std::make_unique<VcuBuffer>(vcuDevice, indexSize, indexCount,
-										VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-										VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	void VcuModel::draw(VkCommandBuffer commandBuffer, uint32_t lod) {
+		drawLod(commandBuffer, lod, baseVertex);
+	}
+
+	void VcuModel::drawMaterial(VkCommandBuffer commandBuffer, uint32_t lod, uint32_t material) {
+		if (!hasIndexBuffer) {
+			if (material == 0) draw(commandBuffer, lod);
+			return;
+		}
 
-		vcuDevice.copyBuffer(stagingBuffer.getBuffer(), indexBuffer->getBuffer(), bufferSize);
+		const LodLevel& level = lods[std::min(lod, static_cast<uint32_t>(lods.size()) - 1)];
+		for (uint32_t i = level.firstRange; i < level.firstRange + level.rangeCount; i++) {
+			const IndexRange& range = indexRanges[i];
+			if (range.material < material) continue;
+			if (range.material > material) break;
+			vkCmdDrawIndexed(commandBuffer, range.indexCount, 1, baseIndex + range.firstIndex, baseVertex + range.vertexOffset, 0);
+		}
 	}
 
-	void VcuModel::bind(VkCommandBuffer commandBuffer) {
-		VkBuffer buffers[] = { vertexBuffer->getBuffer()};
-		VkDeviceSize offsets[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffers, offsets);
+	void VcuModel::drawPositions(VkCommandBuffer commandBuffer, uint32_t lod) {
+		assert(hasPositionStream() && "Model was loaded without LoadOptions::positionStream");
+		drawLod(commandBuffer, lod, positionBaseVertex);
+	}
 
-		if (hasIndexBuffer) {
-			vkCmdBindIndexBuffer(commandBuffer, indexBuffer->getBuffer(), 0, VK_INDEX_TYPE_UINT32);
+	bool VcuModel::isUploaded() const {
+		const uint64_t uploadValue = std::max({ vertexAllocation.uploadValue, positionAllocation.uploadValue, indexAllocation.uploadValue });
+		return geometryPool.getDevice().stagingRing().getAcquiredValue() >= uploadValue;
+	}
+
+	void VcuModel::drawLod(VkCommandBuffer commandBuffer, uint32_t lod, int32_t firstVertex) {
+		if (!hasIndexBuffer) {
+			vkCmdDraw(commandBuffer, vertexCount, 1, static_cast<uint32_t>(firstVertex), 0);
+			return;
+		}
+
+		const LodLevel& level = lods[std::min(lod, static_cast<uint32_t>(lods.size()) - 1)];
+		for (uint32_t i = level.firstRange; i < level.firstRange + level.rangeCount; i++) {
+			const IndexRange& range = indexRanges[i];
+			vkCmdDrawIndexed(commandBuffer, range.indexCount, 1, baseIndex + range.firstIndex, firstVertex + range.vertexOffset, 0);
 		}
 	}
-	void VcuModel::draw(VkCommandBuffer commandBuffer) {
-		if (hasIndexBuffer) {
-			vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, 0);
+
+	void VcuModel::drawCulled(VkCommandBuffer commandBuffer, uint32_t lod, const VcuCamera& camera, const glm::mat4& modelMatrix) {
+		const LodLevel& level = lods[std::min(lod, static_cast<uint32_t>(lods.size()) - 1)];
+		if (!hasIndexBuffer || level.meshletCount == 0) {
+			draw(commandBuffer, lod);
+			return;
 		}
-		else {
-			vkCmdDraw(commandBuffer, vertexCount, 1, 0, 0);
+
+		const Frustum frustum = camera.getFrustum();
+		const glm::vec3 cameraPosition = camera.getPosition();
+		const glm::mat3 linear{ modelMatrix };
+		const glm::mat3 axisMatrix = glm::transpose(glm::inverse(linear));
+		const float maxScale = std::max(glm::length(linear[0]), std::max(glm::length(linear[1]), glm::length(linear[2])));
+
+		// visible meshlets that follow each other in the index buffer are merged into one draw
+		IndexRange run{};
+		auto flush = [&]() {
+			if (run.indexCount == 0) return;
+			vkCmdDrawIndexed(commandBuffer, run.indexCount, 1, baseIndex + run.firstIndex, baseVertex + run.vertexOffset, 0);
+			run.indexCount = 0;
+		};
+
+		for (uint32_t i = level.firstMeshlet; i < level.firstMeshlet + level.meshletCount; i++) {
+			const Meshlet& meshlet = meshlets[i];
+			const glm::vec3 center{ modelMatrix * glm::vec4{ meshlet.center, 1.f } };
+			const float radius = meshlet.radius * maxScale;
+
+			bool visible = frustum.intersectsSphere(center, radius);
+			if (visible && meshlet.coneCutoff < 1.f) {
+				const glm::vec3 axis = glm::normalize(axisMatrix * meshlet.coneAxis);
+				const glm::vec3 toCenter = center - cameraPosition;
+				visible = glm::dot(toCenter, axis) < meshlet.coneCutoff * glm::length(toCenter) + radius;
+			}
+
+			if (!visible) {
+				flush();
+			}
+			else if (run.indexCount > 0 && run.firstIndex + run.indexCount == meshlet.firstIndex && run.vertexOffset == meshlet.vertexOffset) {
+				run.indexCount += meshlet.indexCount;
+			}
+			else {
+				flush();
+				run = { meshlet.firstIndex, meshlet.indexCount, meshlet.vertexOffset };
+			}
 		}
+		flush();
 	}
 
-	std::vector<VkVertexInputBindingDescription> VcuModel::Vertex::getBindingDescriptions() {
-		std::vector<VkVertexInputBindingDescription> bindingDescriptions(1);
-		bindingDescriptions[0].binding = 0;
-		bindingDescriptions[0].stride = sizeof(Vertex);
-		bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-		return bindingDescriptions;
+	bool VcuModel::canBackfaceCull(const glm::mat4& modelMatrix) const {
+		if (!backfaceCullable) return false;
+		// a mirroring transform turns the winding around
+		const bool mirrored = glm::determinant(glm::mat3{ modelMatrix }) < 0.f;
+		return (frontFace == VK_FRONT_FACE_COUNTER_CLOCKWISE) != mirrored;
 	}
 
-	std::vector<VkVertexInputAttributeDescription> VcuModel::Vertex::getAttributeDescriptions() {
-		std::vector<VkVertexInputAttributeDescription> attributeDescriptions{};
+	uint32_t VcuModel::selectLod(float projectedSize, uint32_t currentLod) const {
+		const uint32_t lodCount = static_cast<uint32_t>(lods.size());
+		currentLod = std::min(currentLod, lodCount - 1);
 
-		attributeDescriptions.push_back({ 0, 0,  VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, position) });
-		attributeDescriptions.push_back({ 1, 0,  VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, color) });
-		attributeDescriptions.push_back({ 2, 0,  VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, normal) });
-		attributeDescriptions.push_back({ 3, 0,  VK_FORMAT_R32G32_SFLOAT, offsetof(Vertex, uv) });
+		auto coarsestWithin = [&](float threshold) {
+			for (uint32_t lod = lodCount - 1; lod > 0; lod--) {
+				if (lods[lod].error * projectedSize <= threshold) return lod;
+			}
+			return 0u;
+		};
 
-		return attributeDescriptions;
+		// refine as soon as the current level is visibly wrong, coarsen only with some margin
+		if (lods[currentLod].error * projectedSize > LOD_SCREEN_ERROR) {
+			return coarsestWithin(LOD_SCREEN_ERROR);
+		}
+		return std::max(currentLod, coarsestWithin(LOD_SCREEN_ERROR * LOD_HYSTERESIS));
 	}
 
 	void VcuModel::Builder::loadModel(const std::string& filepath) {
 		tinyobj::attrib_t attrib;
 		std::vector<tinyobj::shape_t> shapes;
-		std::vector<tinyobj::material_t> materials;
+		std::vector<tinyobj::material_t> objMaterials;
 		std::string warn, err;
 
-		if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filepath.c_str())) {
+		const std::string materialDirectory = std::filesystem::path{ filepath }.parent_path().string();
+		if (!tinyobj::LoadObj(&attrib, &shapes, &objMaterials, &warn, &err, filepath.c_str(), materialDirectory.c_str())) {
 			throw std::runtime_error(warn + err);
 		}
 
+		size_t cornerCount = 0;
+		for (const auto& shape : shapes) {
+			cornerCount += shape.mesh.indices.size();
+		}
+
 		vertices.clear();
 		indices.clear();
+		indexRanges.clear();
+		indices.reserve(cornerCount);
+
+		materials.clear();
+		for (const auto& material : objMaterials) {
+			materials.push_back({ material.name,
+				glm::vec3{ material.diffuse[0], material.diffuse[1], material.diffuse[2] }, material.diffuse_texname });
+		}
+		// faces are triangulated by tinyobj, so there is one material id per triangle
+		std::vector<int> triangleMaterials{};
+		triangleMaterials.reserve(cornerCount / 3);
+		for (const auto& shape : shapes) {
+			triangleMaterials.insert(triangleMaterials.end(), shape.mesh.material_ids.begin(), shape.mesh.material_ids.end());
+		}
 
 		std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+		uniqueVertices.reserve(attrib.vertices.size() / 3);
 		for (const auto& shape : shapes) {
 			for (const auto& index : shape.mesh.indices) {
 				Vertex vertex{};
@@ -183,6 +722,50 @@ namespace vcu {
 				indices.push_back(uniqueVertices[vertex]);
 			}
 		}
+
+		if (triangleMaterials.size() * 3 == indices.size()) {
+			sortByMaterial(triangleMaterials);
+		}
+	}
+
+	void VcuModel::Builder::sortByMaterial(const std::vector<int>& triangleMaterials) {
+		assert(triangleMaterials.size() * 3 == indices.size() && "Need one material per triangle");
+
+		// used materials in id order, faces without usemtl get a default material
+		std::map<int, uint32_t> slotOf{};
+		for (int material : triangleMaterials) {
+			slotOf.emplace(material, 0);
+		}
+		std::vector<Material> fileMaterials{};
+		fileMaterials.swap(materials);
+		indexRanges.clear();
+		if (slotOf.empty() || (slotOf.size() == 1 && slotOf.begin()->first < 0)) return;
+
+		for (auto& [material, slot] : slotOf) {
+			slot = static_cast<uint32_t>(materials.size());
+			const bool known = material >= 0 && material < static_cast<int>(fileMaterials.size());
+			materials.push_back(known ? fileMaterials[material] : Material{ "default", glm::vec3{ 1.f }, {} });
+		}
+		if (materials.size() == 1) return;
+
+		// stable counting sort of the triangles by material
+		std::vector<uint32_t> firstTriangle(materials.size() + 1, 0);
+		for (int material : triangleMaterials) {
+			firstTriangle[slotOf[material] + 1]++;
+		}
+		for (size_t m = 0; m < materials.size(); m++) {
+			firstTriangle[m + 1] += firstTriangle[m];
+		}
+		for (uint32_t m = 0; m < materials.size(); m++) {
+			indexRanges.push_back({ firstTriangle[m] * 3, (firstTriangle[m + 1] - firstTriangle[m]) * 3, 0, m });
+		}
+
+		std::vector<uint32_t> sorted(indices.size());
+		for (size_t t = 0; t < triangleMaterials.size(); t++) {
+			const uint32_t target = firstTriangle[slotOf[triangleMaterials[t]]]++;
+			std::copy(indices.begin() + t * 3, indices.begin() + t * 3 + 3, sorted.begin() + target * 3);
+		}
+		indices.swap(sorted);
 	}
 
 	void VcuModel::Builder::loadBezier() {
@@ -197,6 +780,616 @@ namespace vcu {
 		bezier.generateBezierFaces();
 		
 		bezier.initVertices(vertices, indices);
-		
+		computeBounds();
+		analyzeClosedness();
+	}
+
+	void VcuModel::Builder::loadFromFile(const std::string& filepath, const LoadOptions& options) {
+		const std::string cachePath = filepath + ".vcumesh";
+		const uint32_t flags = (options.optimizeMesh ? MESH_CACHE_OPTIMIZED : 0) | (options.generateTangents ? MESH_CACHE_TANGENTS : 0) |
+			(options.vertexFormat == VertexFormat::Packed ? MESH_CACHE_QUANTIZED : 0) | (options.lodCount << MESH_CACHE_LOD_SHIFT);
+
+		vertexFormat = options.vertexFormat;
+		positionStream = options.positionStream;
+		if (!options.useMeshCache || !loadCache(cachePath, filepath, flags)) {
+			loadMeshFile(*this, filepath);
+			if (options.generateTangents) {
+				generateTangents();
+			}
+			if (options.optimizeMesh) {
+				optimizeMesh();
+			}
+			if (options.lodCount > 1) {
+				generateLods(options.lodCount);
+			}
+			if (options.useMeshCache) {
+				saveCache(cachePath, flags);
+			}
+		}
+
+		if (options.splitFor16BitIndices) {
+			splitFor16BitIndices();
+		}
+		if (options.buildMeshlets) {
+			buildMeshlets();
+		}
+	}
+
+	void VcuModel::Builder::computeBounds() {
+		boundingBox = {};
+		boundingSphere = {};
+		if (vertices.empty()) return;
+
+		const size_t count = vertices.size();
+#ifdef VCU_MODEL_SSE
+		// position is followed by color inside Vertex, so a 4 wide load never leaves the vertex
+		static_assert(offsetof(Vertex, position) == 0 && offsetof(Vertex, color) == sizeof(glm::vec3),
+			"Vertex position must come first and be followed by another float");
+		auto loadPosition = [&](size_t i) { return _mm_loadu_ps(&vertices[i].position.x); };
+
+		// two accumulators each to hide the latency of min/max
+		__m128 minA = loadPosition(0), maxA = minA;
+		__m128 minB = minA, maxB = minA;
+		size_t i = 1;
+		for (; i + 1 < count; i += 2) {
+			const __m128 a = loadPosition(i);
+			const __m128 b = loadPosition(i + 1);
+			minA = _mm_min_ps(minA, a);
+			maxA = _mm_max_ps(maxA, a);
+			minB = _mm_min_ps(minB, b);
+			maxB = _mm_max_ps(maxB, b);
+		}
+		if (i < count) {
+			const __m128 a = loadPosition(i);
+			minA = _mm_min_ps(minA, a);
+			maxA = _mm_max_ps(maxA, a);
+		}
+
+		float lanes[4];
+		_mm_storeu_ps(lanes, _mm_min_ps(minA, minB));
+		boundingBox.min = glm::vec3{ lanes[0], lanes[1], lanes[2] };
+		_mm_storeu_ps(lanes, _mm_max_ps(maxA, maxB));
+		boundingBox.max = glm::vec3{ lanes[0], lanes[1], lanes[2] };
+
+		// radius: four vertices at a time, transposed so every lane holds one squared distance
+		const glm::vec3 center = boundingBox.center();
+		const __m128 centerX = _mm_set1_ps(center.x);
+		const __m128 centerY = _mm_set1_ps(center.y);
+		const __m128 centerZ = _mm_set1_ps(center.z);
+		__m128 maxDistance = _mm_setzero_ps();
+		for (i = 0; i + 3 < count; i += 4) {
+			__m128 x = loadPosition(i);
+			__m128 y = loadPosition(i + 1);
+			__m128 z = loadPosition(i + 2);
+			__m128 unused = loadPosition(i + 3);
+			_MM_TRANSPOSE4_PS(x, y, z, unused);
+			x = _mm_sub_ps(x, centerX);
+			y = _mm_sub_ps(y, centerY);
+			z = _mm_sub_ps(z, centerZ);
+			const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+			maxDistance = _mm_max_ps(maxDistance, distance);
+		}
+		_mm_storeu_ps(lanes, maxDistance);
+		float radiusSquared = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#else
+		size_t i = 0;
+		boundingBox.min = vertices[0].position;
+		boundingBox.max = vertices[0].position;
+		for (const auto& vertex : vertices) {
+			boundingBox.min = glm::min(boundingBox.min, vertex.position);
+			boundingBox.max = glm::max(boundingBox.max, vertex.position);
+		}
+		const glm::vec3 center = boundingBox.center();
+		float radiusSquared = 0.f;
+#endif
+		for (; i < count; i++) {
+			const glm::vec3 offset = vertices[i].position - center;
+			radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+		}
+
+		boundingSphere.center = center;
+		boundingSphere.radius = std::sqrt(radiusSquared);
+	}
+
+	void VcuModel::Builder::analyzeClosedness() {
+		canBackfaceCull = false;
+		frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+		if (indices.empty()) return;
+
+		std::unordered_map<glm::vec3, uint32_t> positionIds{};
+		std::vector<uint32_t> positionOf(vertices.size());
+		for (size_t v = 0; v < vertices.size(); v++) {
+			positionOf[v] = positionIds.emplace(vertices[v].position, static_cast<uint32_t>(positionIds.size())).first->second;
+		}
+
+		// directed edges as (from << 32 | to), degenerate triangles have no inside and are skipped
+		std::vector<uint64_t> edges{};
+		edges.reserve(indices.size());
+		const glm::vec3 center = boundingBox.center();
+		double volume = 0.0;
+		for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+			const uint32_t a = positionOf[indices[i + 0]];
+			const uint32_t b = positionOf[indices[i + 1]];
+			const uint32_t c = positionOf[indices[i + 2]];
+			if (a == b || b == c || c == a) continue;
+
+			edges.push_back(static_cast<uint64_t>(a) << 32 | b);
+			edges.push_back(static_cast<uint64_t>(b) << 32 | c);
+			edges.push_back(static_cast<uint64_t>(c) << 32 | a);
+
+			// six times the signed volume of the tetrahedron with the bounds center
+			const glm::vec3 p0 = vertices[indices[i + 0]].position - center;
+			const glm::vec3 p1 = vertices[indices[i + 1]].position - center;
+			const glm::vec3 p2 = vertices[indices[i + 2]].position - center;
+			volume += glm::dot(p0, glm::cross(p1, p2));
+		}
+		if (edges.empty()) return;
+
+		// a directed edge used twice means a non manifold edge or two neighbours with opposite winding,
+		// one without its reverse is a hole
+		std::sort(edges.begin(), edges.end());
+		if (std::adjacent_find(edges.begin(), edges.end()) != edges.end()) return;
+		for (uint64_t edge : edges) {
+			const uint64_t reverse = (edge << 32) | (edge >> 32);
+			if (!std::binary_search(edges.begin(), edges.end(), reverse)) return;
+		}
+
+		// the sign of the enclosed volume tells whether the faces point out counter clockwise
+		const glm::vec3 size = boundingBox.max - boundingBox.min;
+		const double scale = std::max(size.x, std::max(size.y, size.z));
+		if (std::abs(volume) / 6.0 <= CLOSED_MIN_VOLUME * scale * scale * scale) return;
+
+		canBackfaceCull = true;
+		frontFace = volume > 0.0 ? VK_FRONT_FACE_COUNTER_CLOCKWISE : VK_FRONT_FACE_CLOCKWISE;
+	}
+
+	void VcuModel::Builder::generateNormals() {
+		const bool missingNormals = std::any_of(vertices.begin(), vertices.end(),
+			[](const Vertex& vertex) { return vertex.normal == glm::vec3{ 0.f }; });
+		if (!missingNormals || indices.empty()) return;
+
+		// smooth over positions rather than vertices, so uv and color seams do not show in the shading
+		std::unordered_map<glm::vec3, uint32_t> positionIds{};
+		std::vector<glm::vec3> positions{};
+		std::vector<uint32_t> positionOf(vertices.size());
+		for (size_t v = 0; v < vertices.size(); v++) {
+			auto it = positionIds.emplace(vertices[v].position, static_cast<uint32_t>(positions.size())).first;
+			if (it->second == positions.size()) positions.push_back(vertices[v].position);
+			positionOf[v] = it->second;
+		}
+
+		std::vector<uint32_t> positionIndices(indices.size());
+		for (size_t i = 0; i < indices.size(); i++) {
+			positionIndices[i] = positionOf[indices[i]];
+		}
+		const std::vector<glm::vec3> cornerNormals = VcuMeshNormals::generateCornerNormals(positionIndices, positions, NORMAL_CREASE_ANGLE);
+
+		// deduplicate again with the generated normals, corners on a crease get their own vertex
+		std::vector<Vertex> cornerVertices;
+		cornerVertices.swap(vertices);
+		std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+		uniqueVertices.reserve(cornerVertices.size());
+		for (size_t i = 0; i < indices.size(); i++) {
+			Vertex vertex = cornerVertices[indices[i]];
+			if (vertex.normal == glm::vec3{ 0.f }) {
+				vertex.normal = cornerNormals[i];
+			}
+
+			auto it = uniqueVertices.emplace(vertex, static_cast<uint32_t>(vertices.size())).first;
+			if (it->second == vertices.size()) vertices.push_back(vertex);
+			indices[i] = it->second;
+		}
+	}
+
+	void VcuModel::Builder::generateTangents() {
+		if (indices.empty()) return;
+
+		std::vector<glm::vec3> positions(vertices.size());
+		std::vector<glm::vec3> normals(vertices.size());
+		std::vector<glm::vec2> uvs(vertices.size());
+		for (size_t v = 0; v < vertices.size(); v++) {
+			positions[v] = vertices[v].position;
+			normals[v] = vertices[v].normal;
+			uvs[v] = vertices[v].uv;
+		}
+
+		std::vector<uint32_t> splitVertices;
+		const std::vector<glm::vec4> tangents = VcuMeshNormals::generateTangents(indices, positions, normals, uvs, splitVertices);
+
+		vertices.reserve(vertices.size() + splitVertices.size());
+		for (uint32_t v : splitVertices) {
+			vertices.push_back(vertices[v]);
+		}
+		for (size_t v = 0; v < vertices.size(); v++) {
+			vertices[v].tangent = tangents[v];
+		}
+	}
+
+	void VcuModel::Builder::optimizeMesh() {
+		if (indices.empty()) return;
+
+		const auto before = VcuMeshOptimizer::analyzeVertexCache(indices, vertices.size());
+
+		std::vector<glm::vec3> positions(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++) {
+			positions[i] = vertices[i].position;
+		}
+
+		// triangles are reordered within their material range only
+		std::vector<IndexRange> ranges = indexRanges;
+		if (ranges.empty()) {
+			ranges.push_back({ 0, static_cast<uint32_t>(indices.size()), 0 });
+		}
+		for (const auto& range : ranges) {
+			std::vector<uint32_t> rangeIndices(indices.begin() + range.firstIndex, indices.begin() + range.firstIndex + range.indexCount);
+			VcuMeshOptimizer::optimizeVertexCache(rangeIndices, vertices.size());
+			VcuMeshOptimizer::optimizeOverdraw(rangeIndices, positions);
+			std::copy(rangeIndices.begin(), rangeIndices.end(), indices.begin() + range.firstIndex);
+		}
+
+		const std::vector<uint32_t> remap = VcuMeshOptimizer::optimizeVertexFetch(indices, vertices.size());
+		std::vector<Vertex> reordered(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++) {
+			reordered[remap[i]] = vertices[i];
+		}
+		vertices.swap(reordered);
+
+		const auto after = VcuMeshOptimizer::analyzeVertexCache(indices, vertices.size());
+		std::cout << "Mesh optimized: ACMR " << before.acmr << " -> " << after.acmr
+			<< ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+	}
+
+	void VcuModel::Builder::generateLods(uint32_t lodCount) {
+		assert(std::all_of(indexRanges.begin(), indexRanges.end(), [](const IndexRange& range) { return range.vertexOffset == 0; }) &&
+			"LODs have to be generated before the mesh is split into 16 bit index ranges");
+		lods.clear();
+		if (indices.empty() || lodCount < 2) return;
+
+		std::vector<glm::vec3> positions(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++) {
+			positions[i] = vertices[i].position;
+		}
+
+		// one range per material, each material is simplified on its own so the ranges stay sorted
+		const std::vector<IndexRange> materialRanges = indexRanges;
+		if (indexRanges.empty()) {
+			indexRanges.push_back({ 0, static_cast<uint32_t>(indices.size()), 0 });
+		}
+		lods.push_back({ 0, static_cast<uint32_t>(indexRanges.size()), 0.f });
+
+		// every level is simplified from the previous one and appended to the shared index buffer
+		std::vector<std::vector<uint32_t>> lodIndices{};
+		for (const auto& range : indexRanges) {
+			lodIndices.emplace_back(indices.begin() + range.firstIndex, indices.begin() + range.firstIndex + range.indexCount);
+		}
+		float lodError = 0.f;
+		for (uint32_t lod = 1; lod < lodCount; lod++) {
+			std::vector<std::vector<uint32_t>> simplified(lodIndices.size());
+			size_t previousCount = 0;
+			size_t simplifiedCount = 0;
+			float error = 0.f;
+			for (size_t r = 0; r < lodIndices.size(); r++) {
+				const size_t targetIndexCount = lodIndices[r].size() / 6 * 3;
+				float rangeError = 0.f;
+				simplified[r] = VcuMeshSimplifier::simplify(lodIndices[r], positions, targetIndexCount, LOD_MAX_ERROR, &rangeError);
+				// a material that cannot be simplified any further is kept as it is
+				if (simplified[r].empty()) simplified[r] = lodIndices[r];
+				previousCount += lodIndices[r].size();
+				simplifiedCount += simplified[r].size();
+				error = std::max(error, rangeError);
+			}
+
+			// stop once the simplifier is stuck on locked borders and seams
+			if (simplifiedCount + previousCount / 10 >= previousCount) break;
+
+			lodError += error;
+			const uint32_t firstRange = static_cast<uint32_t>(indexRanges.size());
+			for (size_t r = 0; r < simplified.size(); r++) {
+				VcuMeshOptimizer::optimizeVertexCache(simplified[r], vertices.size());
+				indexRanges.push_back({ static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(simplified[r].size()), 0,
+					indexRanges[r].material });
+				indices.insert(indices.end(), simplified[r].begin(), simplified[r].end());
+			}
+			lods.push_back({ firstRange, static_cast<uint32_t>(simplified.size()), lodError });
+			lodIndices.swap(simplified);
+		}
+
+		if (lods.size() == 1) {
+			indexRanges = materialRanges;
+			lods.clear();
+			return;
+		}
+	}
+
+	void VcuModel::Builder::splitFor16BitIndices() {
+		constexpr uint32_t MAX_RANGE_VERTICES = 1u << 16;
+		constexpr uint32_t UNUSED = ~0u;
+
+		if (vertices.size() <= MAX_RANGE_VERTICES) return;
+
+		std::vector<IndexRange> sourceRanges = indexRanges;
+		if (sourceRanges.empty()) {
+			sourceRanges.push_back({ 0, static_cast<uint32_t>(indices.size()), 0 });
+		}
+
+		// walk the triangles of every range in order and start a new sub-range once the current one
+		// would need more than 65536 distinct vertices. Vertices shared between sub-ranges are duplicated.
+		std::vector<Vertex> splitVertices;
+		splitVertices.reserve(vertices.size());
+		std::vector<uint32_t> rangeOf(vertices.size(), UNUSED);
+		std::vector<uint32_t> localIndex(vertices.size());
+		std::vector<uint32_t> firstSplitRange(sourceRanges.size() + 1);
+
+		indexRanges.clear();
+		uint32_t rangeId = 0;
+
+		for (size_t r = 0; r < sourceRanges.size(); r++) {
+			const IndexRange& source = sourceRanges[r];
+			assert(source.vertexOffset == 0 && "Mesh is already split");
+			firstSplitRange[r] = static_cast<uint32_t>(indexRanges.size());
+
+			IndexRange range{ source.firstIndex, 0, static_cast<int32_t>(splitVertices.size()), source.material };
+			uint32_t rangeVertexCount = 0;
+			rangeId++;
+
+			for (uint32_t i = source.firstIndex; i + 2 < source.firstIndex + source.indexCount; i += 3) {
+				uint32_t newVertices = 0;
+				for (uint32_t k = 0; k < 3; k++) {
+					if (rangeOf[indices[i + k]] != rangeId) newVertices++;
+				}
+
+				if (rangeVertexCount + newVertices > MAX_RANGE_VERTICES) {
+					indexRanges.push_back(range);
+					range.firstIndex = i;
+					range.indexCount = 0;
+					range.vertexOffset = static_cast<int32_t>(splitVertices.size());
+					rangeId++;
+					rangeVertexCount = 0;
+				}
+
+				for (uint32_t k = 0; k < 3; k++) {
+					const uint32_t v = indices[i + k];
+					if (rangeOf[v] != rangeId) {
+						rangeOf[v] = rangeId;
+						localIndex[v] = rangeVertexCount++;
+						splitVertices.push_back(vertices[v]);
+					}
+					indices[i + k] = localIndex[v];
+				}
+				range.indexCount += 3;
+			}
+			indexRanges.push_back(range);
+		}
+		firstSplitRange[sourceRanges.size()] = static_cast<uint32_t>(indexRanges.size());
+
+		for (auto& level : lods) {
+			const uint32_t first = firstSplitRange[level.firstRange];
+			level.rangeCount = firstSplitRange[level.firstRange + level.rangeCount] - first;
+			level.firstRange = first;
+		}
+
+		vertices.swap(splitVertices);
+	}
+
+	void VcuModel::Builder::buildMeshlets() {
+		meshlets.clear();
+		if (indices.empty()) return;
+
+		if (indexRanges.empty()) {
+			indexRanges.push_back({ 0, static_cast<uint32_t>(indices.size()), 0 });
+		}
+		if (lods.empty()) {
+			lods.push_back({ 0, static_cast<uint32_t>(indexRanges.size()), 0.f });
+		}
+
+		const bool clockwise = frontFace == VK_FRONT_FACE_CLOCKWISE;
+
+		// triangles are taken in index order, which the vertex cache optimisation already made local
+		constexpr uint32_t UNUSED = ~0u;
+		std::vector<uint32_t> meshletOf(vertices.size(), UNUSED);
+		std::vector<uint32_t> firstMeshletOfRange(indexRanges.size() + 1);
+		uint32_t meshletId = 0;
+
+		for (size_t r = 0; r < indexRanges.size(); r++) {
+			const IndexRange& range = indexRanges[r];
+			firstMeshletOfRange[r] = static_cast<uint32_t>(meshlets.size());
+
+			Meshlet meshlet{};
+			meshlet.firstIndex = range.firstIndex;
+			meshlet.vertexOffset = range.vertexOffset;
+			uint32_t meshletVertexCount = 0;
+			meshletId++;
+
+			for (uint32_t i = range.firstIndex; i + 2 < range.firstIndex + range.indexCount; i += 3) {
+				uint32_t newVertices = 0;
+				for (uint32_t k = 0; k < 3; k++) {
+					if (meshletOf[range.vertexOffset + indices[i + k]] != meshletId) newVertices++;
+				}
+
+				if (meshlet.indexCount > 0 && (meshletVertexCount + newVertices > Meshlet::MAX_VERTICES ||
+					meshlet.indexCount / 3 + 1 > Meshlet::MAX_TRIANGLES)) {
+					computeMeshletBounds(meshlet, vertices, indices, canBackfaceCull, clockwise);
+					meshlets.push_back(meshlet);
+					meshlet.firstIndex = i;
+					meshlet.indexCount = 0;
+					meshletVertexCount = 0;
+					meshletId++;
+				}
+
+				for (uint32_t k = 0; k < 3; k++) {
+					uint32_t& owner = meshletOf[range.vertexOffset + indices[i + k]];
+					if (owner != meshletId) {
+						owner = meshletId;
+						meshletVertexCount++;
+					}
+				}
+				meshlet.indexCount += 3;
+			}
+
+			if (meshlet.indexCount > 0) {
+				computeMeshletBounds(meshlet, vertices, indices, canBackfaceCull, clockwise);
+				meshlets.push_back(meshlet);
+			}
+		}
+		firstMeshletOfRange[indexRanges.size()] = static_cast<uint32_t>(meshlets.size());
+
+		for (auto& level : lods) {
+			level.firstMeshlet = firstMeshletOfRange[level.firstRange];
+			level.meshletCount = firstMeshletOfRange[level.firstRange + level.rangeCount] - level.firstMeshlet;
+		}
+	}
+
+	bool VcuModel::Builder::loadCache(const std::string& cachePath, const std::string& sourcePath, uint32_t flags) {
+		std::error_code ec;
+		const auto cacheTime = std::filesystem::last_write_time(cachePath, ec);
+		if (ec) return false;
+		const auto sourceTime = std::filesystem::last_write_time(sourcePath, ec);
+		if (ec || cacheTime < sourceTime) return false;
+
+		std::ifstream file{ cachePath, std::ios::binary };
+		if (!file.is_open()) return false;
+
+		MeshCacheHeader header{};
+		file.read(reinterpret_cast<char*>(&header), sizeof(header));
+		if (!file || header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION ||
+			header.flags != flags || header.vertexSize != sizeof(Vertex)) {
+			return false;
+		}
+
+		const bool quantized = (flags & MESH_CACHE_QUANTIZED) != 0 && header.vertexCount > 0;
+		MeshCacheQuantization quantization{};
+
+		// the header is checked against the file size before anything is allocated. Every group of 16
+		// values in a byte plane stores at least its 2 byte mask, so a stream of n bytes holds at most 8n records
+		const std::uintmax_t fileSize = std::filesystem::file_size(cachePath, ec);
+		const std::uintmax_t minimumSize = sizeof(header) + (quantized ? sizeof(quantization) : 0) +
+			static_cast<std::uintmax_t>(header.vertexBytes) + header.indexBytes +
+			sizeof(IndexRange) * static_cast<std::uintmax_t>(header.rangeCount) +
+			sizeof(LodLevel) * static_cast<std::uintmax_t>(header.lodCount) +
+			(2 * sizeof(uint32_t) + sizeof(Material::diffuse)) * static_cast<std::uintmax_t>(header.materialCount);
+		if (ec || minimumSize > fileSize ||
+			header.vertexCount > 8ull * header.vertexBytes || header.indexCount > 8ull * header.indexBytes) {
+			return false;
+		}
+		if (quantized) {
+			file.read(reinterpret_cast<char*>(&quantization), sizeof(quantization));
+		}
+
+		// both streams are read in one go, the padding lets the decoder load whole groups at the end
+		std::vector<uint8_t> encoded(static_cast<size_t>(header.vertexBytes) + header.indexBytes + VcuMeshCodec::DECODE_PADDING);
+		file.read(reinterpret_cast<char*>(encoded.data()), static_cast<std::streamsize>(header.vertexBytes) + header.indexBytes);
+		indexRanges.resize(header.rangeCount);
+		lods.resize(header.lodCount);
+		file.read(reinterpret_cast<char*>(indexRanges.data()), sizeof(IndexRange) * indexRanges.size());
+		file.read(reinterpret_cast<char*>(lods.data()), sizeof(LodLevel) * lods.size());
+		materials.resize(header.materialCount);
+		for (auto& material : materials) {
+			readCacheString(file, material.name);
+			file.read(reinterpret_cast<char*>(&material.diffuse), sizeof(material.diffuse));
+			readCacheString(file, material.diffuseTexture);
+		}
+
+		vertices.resize(header.vertexCount);
+		indices.resize(header.indexCount);
+		bool decoded = static_cast<bool>(file);
+		if (decoded && quantized) {
+			const bool tangents = (flags & MESH_CACHE_TANGENTS) != 0;
+			const size_t channels = QUANTIZED_CHANNELS + (tangents ? QUANTIZED_TANGENT_CHANNELS : 0);
+			std::vector<uint16_t> records(vertices.size() * channels);
+			decoded = VcuMeshCodec::decode(encoded.data(), header.vertexBytes, records.data(), vertices.size(), channels);
+			if (decoded) {
+				dequantizeCacheVertices(records, tangents, quantization, vertices);
+			}
+		}
+		else if (decoded) {
+			decoded = VcuMeshCodec::decode(encoded.data(), header.vertexBytes,
+				reinterpret_cast<uint32_t*>(vertices.data()), vertices.size(), FLOAT_CHANNELS);
+		}
+		decoded = decoded && VcuMeshCodec::decode(encoded.data() + header.vertexBytes, header.indexBytes,
+			indices.data(), indices.size(), 1);
+
+		// a stale or corrupt cache must not let the mesh passes or the draws read outside the buffers
+		const auto rangeValid = [&](const IndexRange& range) {
+			if (static_cast<uint64_t>(range.firstIndex) + range.indexCount > indices.size() ||
+				(range.material != 0 && range.material >= materials.size())) {
+				return false;
+			}
+			const auto first = indices.begin() + range.firstIndex;
+			return std::all_of(first, first + range.indexCount, [&](uint32_t index) {
+				const int64_t vertex = static_cast<int64_t>(index) + range.vertexOffset;
+				return vertex >= 0 && vertex < static_cast<int64_t>(vertices.size());
+			});
+		};
+		decoded = decoded && std::all_of(indexRanges.begin(), indexRanges.end(), rangeValid) &&
+			(!indexRanges.empty() || rangeValid(IndexRange{ 0, static_cast<uint32_t>(indices.size()), 0, 0 }));
+		// without ranges the model draws the whole index buffer as one
+		const size_t rangeCount = indexRanges.empty() && !indices.empty() ? 1 : indexRanges.size();
+		decoded = decoded && std::all_of(lods.begin(), lods.end(), [&](const LodLevel& level) {
+			return static_cast<uint64_t>(level.firstRange) + level.rangeCount <= rangeCount;
+		});
+
+		if (!decoded) {
+			vertices.clear();
+			indices.clear();
+			indexRanges.clear();
+			lods.clear();
+			materials.clear();
+			return false;
+		}
+		computeBounds();
+		canBackfaceCull = (header.properties & MESH_PROPERTY_CLOSED) != 0;
+		frontFace = (header.properties & MESH_PROPERTY_CLOCKWISE) != 0 ? VK_FRONT_FACE_CLOCKWISE : VK_FRONT_FACE_COUNTER_CLOCKWISE;
+		return true;
+	}
+
+	void VcuModel::Builder::saveCache(const std::string& cachePath, uint32_t flags) const {
+		std::ofstream file{ cachePath, std::ios::binary | std::ios::trunc };
+		if (!file.is_open()) {
+			std::cout << "Could not write mesh cache " << cachePath << std::endl;
+			return;
+		}
+
+		const bool quantized = (flags & MESH_CACHE_QUANTIZED) != 0 && !vertices.empty();
+		MeshCacheQuantization quantization{};
+		std::vector<uint8_t> vertexStream;
+		if (quantized) {
+			const bool tangents = (flags & MESH_CACHE_TANGENTS) != 0;
+			const std::vector<uint16_t> records = quantizeCacheVertices(vertices, tangents, quantization);
+			vertexStream = VcuMeshCodec::encode(records.data(), vertices.size(),
+				QUANTIZED_CHANNELS + (tangents ? QUANTIZED_TANGENT_CHANNELS : 0));
+		}
+		else {
+			vertexStream = VcuMeshCodec::encode(reinterpret_cast<const uint32_t*>(vertices.data()), vertices.size(), FLOAT_CHANNELS);
+		}
+		const std::vector<uint8_t> indexStream = VcuMeshCodec::encode(indices.data(), indices.size(), 1);
+
+		MeshCacheHeader header{};
+		header.magic = MESH_CACHE_MAGIC;
+		header.version = MESH_CACHE_VERSION;
+		header.flags = flags;
+		header.vertexSize = sizeof(Vertex);
+		header.vertexCount = static_cast<uint32_t>(vertices.size());
+		header.indexCount = static_cast<uint32_t>(indices.size());
+		header.rangeCount = static_cast<uint32_t>(indexRanges.size());
+		header.lodCount = static_cast<uint32_t>(lods.size());
+		header.materialCount = static_cast<uint32_t>(materials.size());
+		header.vertexBytes = static_cast<uint32_t>(vertexStream.size());
+		header.indexBytes = static_cast<uint32_t>(indexStream.size());
+		header.properties = (canBackfaceCull ? MESH_PROPERTY_CLOSED : 0) |
+			(frontFace == VK_FRONT_FACE_CLOCKWISE ? MESH_PROPERTY_CLOCKWISE : 0);
+
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		if (quantized) {
+			file.write(reinterpret_cast<const char*>(&quantization), sizeof(quantization));
+		}
+		file.write(reinterpret_cast<const char*>(vertexStream.data()), vertexStream.size());
+		file.write(reinterpret_cast<const char*>(indexStream.data()), indexStream.size());
+		file.write(reinterpret_cast<const char*>(indexRanges.data()), sizeof(IndexRange) * indexRanges.size());
+		file.write(reinterpret_cast<const char*>(lods.data()), sizeof(LodLevel) * lods.size());
+		for (const auto& material : materials) {
+			writeCacheString(file, material.name);
+			file.write(reinterpret_cast<const char*>(&material.diffuse), sizeof(material.diffuse));
+			writeCacheString(file, material.diffuseTexture);
+		}
 	}
 }
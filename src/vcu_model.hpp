@@ -2,6 +2,9 @@
 
 #include "vcu_device.hpp"
 #include "vcu_buffer.hpp"
+#include "vcu_geometry_pool.hpp"
+#include "vcu_camera.hpp"
+#include "vcu_vertex_layout.hpp"
 
 // libs
 #define GLM_FORCE_RADIANS
@@ -9,57 +12,263 @@
 #include <glm/glm.hpp>
 
 // std
+#include <future>
 #include <memory>
+#include <string>
 #include <vector>
 
 namespace vcu {
 	class VcuModel {
 	public:
+		enum class VertexFormat {
+			Standard,
+			Packed
+		};
+
+		// vertex used while loading and processing, the GPU gets StandardVertexLayout or PackedVertexLayout
 		struct Vertex {
 			glm::vec3 position{};
 			glm::vec3 color{};
 			glm::vec3 normal{};
 			glm::vec2 uv{};
-
-			static std::vector<VkVertexInputBindingDescription> getBindingDescriptions();
-			static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions();
+			glm::vec4 tangent{}; // bitangent sign in w, zero unless LoadOptions::generateTangents is set
 
 			bool operator==(const Vertex& other) const {
-				return position == other.position && color == other.color && normal == other.normal && uv == other.uv;
+				return position == other.position && color == other.color && normal == other.normal && uv == other.uv &&
+					tangent == other.tangent;
 			}
 		};
 
+		// 20 byte vertex: position unorm16x4 relative to the mesh bounds, octahedral snorm16x2 normal,
+		// uv unorm16x2 relative to the uv bounds and unorm8x4 color. Decoded in the vertex shader.
+		struct PackedVertex {
+			uint16_t position[4];
+			int16_t normal[2];
+			uint16_t uv[2];
+			uint8_t color[4];
+		};
+
+		// vertex streams by shader input location: 0 position, 1 color, 2 normal, 3 uv
+		using StandardVertexLayout = VertexLayout<
+			VertexAttribute<0, glm::vec3, VK_FORMAT_R32G32B32_SFLOAT>,
+			VertexAttribute<1, glm::vec3, VK_FORMAT_R32G32B32_SFLOAT>,
+			VertexAttribute<2, glm::vec3, VK_FORMAT_R32G32B32_SFLOAT>,
+			VertexAttribute<3, glm::vec2, VK_FORMAT_R32G32_SFLOAT>>;
+		using PackedVertexLayout = VertexLayout<
+			VertexAttribute<0, uint16_t[4], VK_FORMAT_R16G16B16A16_UNORM>,
+			VertexAttribute<2, int16_t[2], VK_FORMAT_R16G16_SNORM>,
+			VertexAttribute<3, uint16_t[2], VK_FORMAT_R16G16_UNORM>,
+			VertexAttribute<1, uint8_t[4], VK_FORMAT_R8G8B8A8_UNORM>>;
+		// position only streams for depth passes, location 0 with the same encoding as above
+		using StandardPositionLayout = VertexLayout<VertexAttribute<0, glm::vec3, VK_FORMAT_R32G32B32_SFLOAT>>;
+		using PackedPositionLayout = VertexLayout<VertexAttribute<0, uint16_t[4], VK_FORMAT_R16G16B16A16_UNORM>>;
+
+		struct BoundingBox {
+			glm::vec3 min{ 0.f };
+			glm::vec3 max{ 0.f };
+
+			glm::vec3 center() const { return (min + max) * 0.5f; }
+			glm::vec3 extent() const { return (max - min) * 0.5f; } // half size along each axis
+		};
+
+		struct BoundingSphere {
+			glm::vec3 center{ 0.f };
+			float radius = 0.f;
+		};
+
+		struct LoadOptions {
+			bool optimizeMesh = false; // vertex cache, overdraw and vertex fetch reordering
+			bool useMeshCache = false; // reuse the processed mesh stored next to the source file
+			VertexFormat vertexFormat = VertexFormat::Standard;
+			bool splitFor16BitIndices = false; // split meshes above 65536 vertices into 16 bit index ranges
+			uint32_t lodCount = 1; // number of detail levels including the full mesh
+			bool buildMeshlets = false; // per meshlet frustum and backface culling, for dense closed meshes
+			bool generateTangents = false; // MikkTSpace style tangents for normal mapping
+			bool positionStream = false; // extra position only copy of the vertices for depth passes
+		};
+
+		// surface properties from the OBJ's .mtl file
+		struct Material {
+			std::string name;
+			glm::vec3 diffuse{ 1.f };
+			std::string diffuseTexture; // map_Kd as written in the .mtl, empty without texture
+		};
+
+		// part of the index buffer drawn with its own vertexOffset. The ranges of every LOD are sorted
+		// by material, so all triangles of a material can be drawn back to back.
+		struct IndexRange {
+			uint32_t firstIndex = 0;
+			uint32_t indexCount = 0;
+			int32_t vertexOffset = 0;
+			uint32_t material = 0; // index into the materials of the model
+		};
+
+		// detail level drawn from a run of index ranges, error is relative to the mesh extent
+		struct LodLevel {
+			uint32_t firstRange = 0;
+			uint32_t rangeCount = 0;
+			float error = 0.f;
+			uint32_t firstMeshlet = 0;
+			uint32_t meshletCount = 0;
+		};
+
+		// at most 64 vertices and 124 triangles, contiguous in the index buffer. Bounds are in model space,
+		// the cone bounds the face normals and coneCutoff is the sine of its half angle (1 disables it).
+		struct Meshlet {
+			static constexpr uint32_t MAX_VERTICES = 64;
+			static constexpr uint32_t MAX_TRIANGLES = 124;
+
+			uint32_t firstIndex = 0;
+			uint32_t indexCount = 0;
+			int32_t vertexOffset = 0;
+			glm::vec3 center{ 0.f };
+			float radius = 0.f;
+			glm::vec3 coneAxis{ 0.f };
+			float coneCutoff = 1.f;
+		};
+
 		struct Builder {
 			std::vector<Vertex> vertices{};
 			std::vector<uint32_t> indices{};
+			VertexFormat vertexFormat = VertexFormat::Standard;
+			std::vector<IndexRange> indexRanges{}; // empty when the mesh is drawn in one call
+			std::vector<LodLevel> lods{}; // empty when the mesh has a single detail level
+			std::vector<Meshlet> meshlets{};
+			std::vector<Material> materials{}; // empty for meshes without materials
+			BoundingBox boundingBox{};
+			BoundingSphere boundingSphere{};
+			bool canBackfaceCull = false; // closed with consistent winding, set by analyzeClosedness
+			VkFrontFace frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE; // winding of the outward faces in model space
+			bool positionStream = false; // see LoadOptions::positionStream
 
+			// loads an OBJ or glTF file and runs the processing selected in options
+			void loadFromFile(const std::string& filepath, const LoadOptions& options);
 			void loadModel(const std::string& filename);
+			// parses the OBJ line by line, never holding tinyobj's shapes or a Vertex keyed map
+			void loadModelStreaming(const std::string& filename);
+			void loadGltf(const std::string& filename); // .gltf or .glb, all meshes of the default scene
 			void loadBezier();
+
+			// Groups the triangles by triangleMaterials (one entry per triangle, index into materials or
+			// -1 for faces without usemtl) and makes one index range per material. Unused materials are
+			// dropped, and the mesh stays a single range if only one material is used.
+			void sortByMaterial(const std::vector<int>& triangleMaterials);
+			// smooth normals for vertices that came without one, vertices are split along creases
+			void generateNormals();
+			void generateTangents();
+			void optimizeMesh();
+			void generateLods(uint32_t lodCount);
+			void splitFor16BitIndices();
+			void buildMeshlets();
+			// model space bounds of all vertices, the loaders call this once the vertices are in place
+			void computeBounds();
+			// every edge has to be shared by exactly two triangles that use it in opposite directions.
+			// Positions are welded first so uv and normal seams do not count as open edges.
+			void analyzeClosedness();
+
+			bool loadCache(const std::string& cachePath, const std::string& sourcePath, uint32_t flags);
+			void saveCache(const std::string& cachePath, uint32_t flags) const;
+		};
+
+		// Returned by createModelFromFileAsync. The file is parsed on VcuThreadPool::shared(), the
+		// GPU upload happens on the thread that calls poll() once parsing has finished.
+		class AsyncLoad {
+		public:
+			AsyncLoad(VcuGeometryPool& pool, std::future<std::unique_ptr<Builder>> builder);
+
+			// model once it is uploaded, nullptr while the file is still being parsed
+			std::shared_ptr<VcuModel> poll();
+			bool isReady() const { return model != nullptr; }
+
+		private:
+			VcuGeometryPool& geometryPool;
+			std::future<std::unique_ptr<Builder>> pendingBuilder;
+			std::shared_ptr<VcuModel> model;
 		};
 
-		VcuModel(VcuDevice& device, const VcuModel::Builder &builder);
+		// vertices and indices are copied into the pool, which has to outlive the model
+		VcuModel(VcuGeometryPool& pool, const VcuModel::Builder &builder);
 		~VcuModel();
 
-		static std::unique_ptr<VcuModel> createModelFromFile(VcuDevice& device, const std::string& filepath);
-		static std::unique_ptr<VcuModel> createModelBezier(VcuDevice& device);
+		static std::unique_ptr<VcuModel> createModelFromFile(VcuGeometryPool& pool, const std::string& filepath);
+		static std::unique_ptr<VcuModel> createModelFromFile(VcuGeometryPool& pool, const std::string& filepath, const LoadOptions& options);
+		static std::shared_ptr<AsyncLoad> createModelFromFileAsync(VcuGeometryPool& pool, const std::string& filepath, const LoadOptions& options);
+		static std::unique_ptr<VcuModel> createModelBezier(VcuGeometryPool& pool);
 
 		VcuModel(const VcuModel&) = delete;
 		VcuModel& operator=(const VcuModel&) = delete;
 
+		// the pool buffers are bound once per frame, this only switches the index type when needed
 		void bind(VkCommandBuffer commandBuffer);
 		void draw(VkCommandBuffer commandBuffer);
+		void draw(VkCommandBuffer commandBuffer, uint32_t lod);
+		// draws only the ranges of one material, which sit next to each other in the LOD
+		void drawMaterial(VkCommandBuffer commandBuffer, uint32_t lod, uint32_t material);
+		// draws only the meshlets inside the frustum that face the camera, falls back to draw without meshlets
+		void drawCulled(VkCommandBuffer commandBuffer, uint32_t lod, const VcuCamera& camera, const glm::mat4& modelMatrix);
+		// Draws the position stream, for pipelines set up with VcuPipeline::enablePositionStream. It sits
+		// in the same pool buffer, so nothing has to be rebound between the passes.
+		void drawPositions(VkCommandBuffer commandBuffer, uint32_t lod);
+		bool hasPositionStream() const { return positionAllocation.size > 0; }
+		// false while the upload into the pool may still be running on the transfer queue, skip the model until then
+		bool isUploaded() const;
+
+		uint32_t getLodCount() const { return static_cast<uint32_t>(lods.size()); }
+		const std::vector<Material>& getMaterials() const { return materials; }
+		// projectedSize is the bounding sphere diameter as a fraction of the viewport height
+		uint32_t selectLod(float projectedSize, uint32_t currentLod) const;
+
+		const BoundingBox& getBoundingBox() const { return boundingBox; }
+		const BoundingSphere& getBoundingSphere() const { return boundingSphere; }
+
+		// true when the mesh is closed, so its back faces are hidden behind front faces
+		bool canBackfaceCull() const { return backfaceCullable; }
+		// also requires that modelMatrix leaves the outward faces counter clockwise, which is the
+		// front face of VcuPipeline::enableBackfaceCulling
+		bool canBackfaceCull(const glm::mat4& modelMatrix) const;
+
+		VertexFormat getVertexFormat() const { return vertexFormat; }
+		// the pool vertex buffer for vertex pulling, the draws index it with their vertex index
+		VkDeviceAddress getVertexAddress() const { return geometryPool.getVertexAddress(); }
+		// maps packed positions back to model space, identity for the standard format
+		const glm::mat4& getPositionDecodeMatrix() const { return positionDecode; }
+		// uv offset in xy and scale in zw
+		const glm::vec4& getUVDecode() const { return uvDecode; }
 
 	private:
 		void createVertexBuffers(const std::vector<Vertex> &vertices);
+		void createPackedVertexBuffers(const std::vector<Vertex> &vertices);
+		void uploadVertexData(const void* data, uint32_t vertexSize);
+		void uploadPositionData(const void* data, uint32_t positionSize);
+		void drawLod(VkCommandBuffer commandBuffer, uint32_t lod, int32_t firstVertex);
 		void createIndexBuffer(const std::vector<uint32_t> &indices);
+		void uploadIndexData(const void* data, uint32_t indexSize);
+
+		VcuGeometryPool& geometryPool;
 
-		VcuDevice& vcuDevice;
+		VertexFormat vertexFormat = VertexFormat::Standard;
+		glm::mat4 positionDecode{ 1.f };
+		glm::vec4 uvDecode{ 0.f, 0.f, 1.f, 1.f };
+		BoundingBox boundingBox{};
+		BoundingSphere boundingSphere{};
+		bool backfaceCullable = false;
+		VkFrontFace frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
 
-		std::unique_ptr<VcuBuffer> vertexBuffer;
+		VcuGeometryPool::Allocation vertexAllocation{};
+		int32_t baseVertex = 0; // first vertex of the model in the pool vertex buffer
+		bool positionStream = false;
+		VcuGeometryPool::Allocation positionAllocation{};
+		int32_t positionBaseVertex = 0; // the same for the position stream
 		uint32_t vertexCount;
 
 		bool hasIndexBuffer = false;
-		std::unique_ptr<VcuBuffer> indexBuffer;
+		VcuGeometryPool::Allocation indexAllocation{};
+		uint32_t baseIndex = 0; // first index of the model in the pool index buffer
 		uint32_t indexCount;
+		VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+		std::vector<IndexRange> indexRanges;
+		std::vector<LodLevel> lods;
+		std::vector<Meshlet> meshlets;
+		std::vector<Material> materials;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,290 @@
+#include "vcu_model.hpp"
+
+// libs
+#define TINYGLTF_IMPLEMENTATION
+#define TINYGLTF_NO_STB_IMAGE
+#define TINYGLTF_NO_STB_IMAGE_WRITE
+#define TINYGLTF_NO_EXTERNAL_IMAGE
+#include <tiny_gltf.h>
+
+// std
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace vcu {
+
+	namespace {
+		// only geometry is loaded, so embedded and referenced images are accepted and left undecoded
+		bool skipImage(tinygltf::Image*, const int, std::string*, std::string*, int, int,
+			const unsigned char*, int, void*) {
+			return true;
+		}
+
+		// first element and distance between elements of an accessor inside its buffer
+		struct AccessorView {
+			const unsigned char* data = nullptr;
+			size_t stride = 0;
+			size_t count = 0;
+			int componentType = 0;
+			int componentSize = 0;
+			int components = 0;
+			bool normalized = false;
+		};
+
+		AccessorView viewAccessor(const tinygltf::Model& model, int accessorIndex) {
+			const auto& accessor = model.accessors[accessorIndex];
+			if (accessor.sparse.isSparse || accessor.bufferView < 0) {
+				throw std::runtime_error("sparse glTF accessors are not supported!");
+			}
+
+			const auto& bufferView = model.bufferViews[accessor.bufferView];
+			const auto& buffer = model.buffers[bufferView.buffer];
+			const int stride = accessor.ByteStride(bufferView);
+			if (stride <= 0) {
+				throw std::runtime_error("invalid glTF accessor stride!");
+			}
+
+			AccessorView view{};
+			view.data = buffer.data.data() + bufferView.byteOffset + accessor.byteOffset;
+			view.stride = static_cast<size_t>(stride);
+			view.count = accessor.count;
+			view.componentType = accessor.componentType;
+			view.componentSize = tinygltf::GetComponentSizeInBytes(static_cast<uint32_t>(accessor.componentType));
+			view.components = tinygltf::GetNumComponentsInType(static_cast<uint32_t>(accessor.type));
+			view.normalized = accessor.normalized;
+
+			const size_t end = bufferView.byteOffset + accessor.byteOffset +
+				(view.count > 0 ? (view.count - 1) * view.stride + view.componentSize * view.components : 0);
+			if (end > buffer.data.size()) {
+				throw std::runtime_error("glTF accessor out of buffer bounds!");
+			}
+			return view;
+		}
+
+		float readComponent(const unsigned char* src, int componentType, bool normalized) {
+			switch (componentType) {
+			case TINYGLTF_COMPONENT_TYPE_FLOAT: {
+				float value;
+				std::memcpy(&value, src, sizeof(value));
+				return value;
+			}
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+				return normalized ? *src / 255.f : static_cast<float>(*src);
+			case TINYGLTF_COMPONENT_TYPE_BYTE: {
+				const float value = static_cast<float>(static_cast<int8_t>(*src));
+				return normalized ? std::max(value / 127.f, -1.f) : value;
+			}
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+				uint16_t value;
+				std::memcpy(&value, src, sizeof(value));
+				return normalized ? value / 65535.f : static_cast<float>(value);
+			}
+			case TINYGLTF_COMPONENT_TYPE_SHORT: {
+				int16_t value;
+				std::memcpy(&value, src, sizeof(value));
+				return normalized ? std::max(value / 32767.f, -1.f) : static_cast<float>(value);
+			}
+			default:
+				throw std::runtime_error("unsupported glTF component type!");
+			}
+		}
+
+		// copies the first N components of every element into dst, elements dstStride bytes apart.
+		// Float data is copied as is, quantized data goes through readComponent.
+		template<int N>
+		void copyAttribute(const AccessorView& view, float* dst, size_t dstStride) {
+			if (view.components < N) {
+				throw std::runtime_error("glTF attribute has too few components!");
+			}
+
+			unsigned char* out = reinterpret_cast<unsigned char*>(dst);
+			if (view.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT) {
+				for (size_t i = 0; i < view.count; i++) {
+					std::memcpy(out + i * dstStride, view.data + i * view.stride, N * sizeof(float));
+				}
+				return;
+			}
+
+			for (size_t i = 0; i < view.count; i++) {
+				float* element = reinterpret_cast<float*>(out + i * dstStride);
+				const unsigned char* src = view.data + i * view.stride;
+				for (int c = 0; c < N; c++) {
+					element[c] = readComponent(src + c * view.componentSize, view.componentType, view.normalized);
+				}
+			}
+		}
+
+		void copyIndices(const AccessorView& view, uint32_t* dst, uint32_t baseVertex) {
+			if (view.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT && view.stride == sizeof(uint32_t)) {
+				std::memcpy(dst, view.data, view.count * sizeof(uint32_t));
+			}
+			else {
+				for (size_t i = 0; i < view.count; i++) {
+					const unsigned char* src = view.data + i * view.stride;
+					switch (view.componentType) {
+					case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+						dst[i] = *src;
+						break;
+					case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+						uint16_t value;
+						std::memcpy(&value, src, sizeof(value));
+						dst[i] = value;
+						break;
+					}
+					case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+						std::memcpy(&dst[i], src, sizeof(uint32_t));
+						break;
+					default:
+						throw std::runtime_error("unsupported glTF index type!");
+					}
+				}
+			}
+
+			if (baseVertex != 0) {
+				for (size_t i = 0; i < view.count; i++) {
+					dst[i] += baseVertex;
+				}
+			}
+		}
+
+		glm::mat4 nodeMatrix(const tinygltf::Node& node) {
+			glm::mat4 matrix{ 1.f };
+			if (node.matrix.size() == 16) {
+				for (int column = 0; column < 4; column++) {
+					for (int row = 0; row < 4; row++) {
+						matrix[column][row] = static_cast<float>(node.matrix[column * 4 + row]);
+					}
+				}
+				return matrix;
+			}
+
+			if (node.rotation.size() == 4) {
+				const float x = static_cast<float>(node.rotation[0]);
+				const float y = static_cast<float>(node.rotation[1]);
+				const float z = static_cast<float>(node.rotation[2]);
+				const float w = static_cast<float>(node.rotation[3]);
+				matrix[0] = glm::vec4{ 1.f - 2.f * (y * y + z * z), 2.f * (x * y + w * z), 2.f * (x * z - w * y), 0.f };
+				matrix[1] = glm::vec4{ 2.f * (x * y - w * z), 1.f - 2.f * (x * x + z * z), 2.f * (y * z + w * x), 0.f };
+				matrix[2] = glm::vec4{ 2.f * (x * z + w * y), 2.f * (y * z - w * x), 1.f - 2.f * (x * x + y * y), 0.f };
+			}
+			if (node.scale.size() == 3) {
+				matrix[0] *= static_cast<float>(node.scale[0]);
+				matrix[1] *= static_cast<float>(node.scale[1]);
+				matrix[2] *= static_cast<float>(node.scale[2]);
+			}
+			if (node.translation.size() == 3) {
+				matrix[3] = glm::vec4{
+					static_cast<float>(node.translation[0]),
+					static_cast<float>(node.translation[1]),
+					static_cast<float>(node.translation[2]), 1.f };
+			}
+			return matrix;
+		}
+
+		void appendPrimitive(const tinygltf::Model& model, const tinygltf::Primitive& primitive, const glm::mat4& transform,
+			VcuModel::Builder& builder) {
+			if (primitive.mode != TINYGLTF_MODE_TRIANGLES) {
+				std::cout << "Skipping glTF primitive that is not a triangle list" << std::endl;
+				return;
+			}
+
+			const auto position = primitive.attributes.find("POSITION");
+			if (position == primitive.attributes.end()) return;
+
+			const AccessorView positions = viewAccessor(model, position->second);
+			const size_t baseVertex = builder.vertices.size();
+			builder.vertices.resize(baseVertex + positions.count);
+			VcuModel::Vertex* vertices = builder.vertices.data() + baseVertex;
+
+			// tinyobjloader defaults to white as well
+			for (size_t i = 0; i < positions.count; i++) {
+				vertices[i].color = glm::vec3{ 1.f };
+			}
+
+			copyAttribute<3>(positions, reinterpret_cast<float*>(&vertices[0].position), sizeof(VcuModel::Vertex));
+
+			auto copyOptional = [&](const char* name, auto dstMember, auto copy) {
+				const auto attribute = primitive.attributes.find(name);
+				if (attribute == primitive.attributes.end()) return;
+
+				const AccessorView view = viewAccessor(model, attribute->second);
+				if (view.count != positions.count) {
+					throw std::runtime_error(std::string("glTF attribute count mismatch for ") + name + "!");
+				}
+				copy(view, reinterpret_cast<float*>(&(vertices[0].*dstMember)), sizeof(VcuModel::Vertex));
+			};
+			copyOptional("NORMAL", &VcuModel::Vertex::normal, copyAttribute<3>);
+			copyOptional("TEXCOORD_0", &VcuModel::Vertex::uv, copyAttribute<2>);
+			copyOptional("COLOR_0", &VcuModel::Vertex::color, copyAttribute<3>);
+
+			const size_t baseIndex = builder.indices.size();
+			if (primitive.indices >= 0) {
+				const AccessorView indices = viewAccessor(model, primitive.indices);
+				builder.indices.resize(baseIndex + indices.count);
+				copyIndices(indices, builder.indices.data() + baseIndex, static_cast<uint32_t>(baseVertex));
+			}
+			else {
+				builder.indices.resize(baseIndex + positions.count);
+				for (size_t i = 0; i < positions.count; i++) {
+					builder.indices[baseIndex + i] = static_cast<uint32_t>(baseVertex + i);
+				}
+			}
+
+			if (transform == glm::mat4{ 1.f }) return;
+
+			const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3{ transform }));
+			for (size_t i = 0; i < positions.count; i++) {
+				vertices[i].position = glm::vec3{ transform * glm::vec4{ vertices[i].position, 1.f } };
+				vertices[i].normal = normalMatrix * vertices[i].normal;
+			}
+		}
+
+		void appendNode(const tinygltf::Model& model, int nodeIndex, const glm::mat4& parentMatrix, VcuModel::Builder& builder) {
+			const auto& node = model.nodes[nodeIndex];
+			const glm::mat4 worldMatrix = parentMatrix * nodeMatrix(node);
+
+			if (node.mesh >= 0) {
+				for (const auto& primitive : model.meshes[node.mesh].primitives) {
+					appendPrimitive(model, primitive, worldMatrix, builder);
+				}
+			}
+			for (int child : node.children) {
+				appendNode(model, child, worldMatrix, builder);
+			}
+		}
+	}
+
+	void VcuModel::Builder::loadGltf(const std::string& filepath) {
+		tinygltf::TinyGLTF loader;
+		tinygltf::Model model;
+		std::string warn, err;
+		loader.SetImageLoader(&skipImage, nullptr);
+
+		const bool binary = filepath.size() >= 4 && filepath.compare(filepath.size() - 4, 4, ".glb") == 0;
+		const bool loaded = binary
+			? loader.LoadBinaryFromFile(&model, &err, &warn, filepath)
+			: loader.LoadASCIIFromFile(&model, &err, &warn, filepath);
+		if (!loaded) {
+			throw std::runtime_error(warn + err);
+		}
+
+		vertices.clear();
+		indices.clear();
+
+		if (model.scenes.empty()) {
+			for (const auto& mesh : model.meshes) {
+				for (const auto& primitive : mesh.primitives) {
+					appendPrimitive(model, primitive, glm::mat4{ 1.f }, *this);
+				}
+			}
+			return;
+		}
+
+		const int scene = model.defaultScene >= 0 ? model.defaultScene : 0;
+		for (int node : model.scenes[scene].nodes) {
+			appendNode(model, node, glm::mat4{ 1.f }, *this);
+		}
+	}
+}
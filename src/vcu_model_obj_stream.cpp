@@ -0,0 +1,169 @@
+#include "vcu_model.hpp"
+#include "vcu_utils.hpp"
+
+// libs
+#include <tiny_obj_loader.h>
+
+// std
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace vcu {
+
+	namespace {
+		// indices after which the deduplication map starts over. Bounds the map on huge scans, at the
+		// cost of duplicating the vertices shared across a chunk border.
+		constexpr size_t DEDUP_CHUNK_INDICES = 3 * 1024 * 1024;
+
+		// a face corner is identified by its attribute indices, much smaller to hash than a Vertex
+		struct CornerKey {
+			int position;
+			int texcoord;
+			int normal;
+
+			bool operator==(const CornerKey& other) const {
+				return position == other.position && texcoord == other.texcoord && normal == other.normal;
+			}
+		};
+
+		struct CornerKeyHash {
+			size_t operator()(const CornerKey& key) const {
+				size_t seed = 0;
+				hashCombine(seed, key.position, key.texcoord, key.normal);
+				return seed;
+			}
+		};
+
+		struct StreamState {
+			VcuModel::Builder& builder;
+			std::vector<glm::vec3> positions{};
+			std::vector<glm::vec3> colors{};
+			std::vector<glm::vec3> normals{};
+			std::vector<glm::vec2> texcoords{};
+			std::unordered_map<CornerKey, uint32_t, CornerKeyHash> corners{};
+			size_t chunkStart = 0;
+			std::vector<int> triangleMaterials{};
+			int currentMaterial = -1;
+		};
+
+		// OBJ indices are 1 based, negative ones count back from the last element and 0 means missing
+		int resolveIndex(int index, size_t count) {
+			const int resolved = index > 0 ? index - 1 : index < 0 ? static_cast<int>(count) + index : -1;
+			if (resolved >= static_cast<int>(count)) {
+				throw std::runtime_error("OBJ face references a missing attribute!");
+			}
+			return resolved;
+		}
+
+		uint32_t emitCorner(StreamState& state, const tinyobj::index_t& index) {
+			const CornerKey key{
+				resolveIndex(index.vertex_index, state.positions.size()),
+				resolveIndex(index.texcoord_index, state.texcoords.size()),
+				resolveIndex(index.normal_index, state.normals.size()) };
+
+			auto found = state.corners.find(key);
+			if (found != state.corners.end()) return found->second;
+
+			VcuModel::Vertex vertex{};
+			if (key.position >= 0) {
+				vertex.position = state.positions[key.position];
+				vertex.color = state.colors[key.position];
+			}
+			if (key.normal >= 0) {
+				vertex.normal = state.normals[key.normal];
+			}
+			if (key.texcoord >= 0) {
+				vertex.uv = state.texcoords[key.texcoord];
+			}
+
+			const uint32_t vertexIndex = static_cast<uint32_t>(state.builder.vertices.size());
+			state.builder.vertices.push_back(vertex);
+			state.corners.emplace(key, vertexIndex);
+			return vertexIndex;
+		}
+
+		void onVertex(void* userData, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z,
+			tinyobj::real_t r, tinyobj::real_t g, tinyobj::real_t b, bool hasColor) {
+			auto& state = *static_cast<StreamState*>(userData);
+			state.positions.emplace_back(x, y, z);
+			state.colors.push_back(hasColor ? glm::vec3{ r, g, b } : glm::vec3{ 1.f });
+		}
+
+		void onNormal(void* userData, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z) {
+			static_cast<StreamState*>(userData)->normals.emplace_back(x, y, z);
+		}
+
+		void onTexcoord(void* userData, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t) {
+			static_cast<StreamState*>(userData)->texcoords.emplace_back(x, y);
+		}
+
+		void onFace(void* userData, tinyobj::index_t* indices, int count) {
+			auto& state = *static_cast<StreamState*>(userData);
+			if (count < 3) return;
+
+			auto& out = state.builder.indices;
+			if (out.size() - state.chunkStart >= DEDUP_CHUNK_INDICES) {
+				state.corners.clear();
+				state.chunkStart = out.size();
+			}
+
+			// triangle fan, same as tinyobj's triangulation of convex faces
+			const uint32_t first = emitCorner(state, indices[0]);
+			uint32_t previous = emitCorner(state, indices[1]);
+			for (int i = 2; i < count; i++) {
+				const uint32_t current = emitCorner(state, indices[i]);
+				out.push_back(first);
+				out.push_back(previous);
+				out.push_back(current);
+				state.triangleMaterials.push_back(state.currentMaterial);
+				previous = current;
+			}
+		}
+
+		void onUseMaterial(void* userData, const char*, int materialId) {
+			static_cast<StreamState*>(userData)->currentMaterial = materialId;
+		}
+
+		// called with every material loaded so far, after each mtllib line
+		void onMaterialLibrary(void* userData, const tinyobj::material_t* objMaterials, int count) {
+			auto& materials = static_cast<StreamState*>(userData)->builder.materials;
+			materials.clear();
+			for (int i = 0; i < count; i++) {
+				const auto& material = objMaterials[i];
+				materials.push_back({ material.name,
+					glm::vec3{ material.diffuse[0], material.diffuse[1], material.diffuse[2] }, material.diffuse_texname });
+			}
+		}
+	}
+
+	void VcuModel::Builder::loadModelStreaming(const std::string& filepath) {
+		std::ifstream file{ filepath };
+		if (!file.is_open()) {
+			throw std::runtime_error("failed to open file: " + filepath);
+		}
+
+		vertices.clear();
+		indices.clear();
+		indexRanges.clear();
+		materials.clear();
+
+		StreamState state{ *this };
+		tinyobj::callback_t callbacks{};
+		callbacks.vertex_color_cb = onVertex;
+		callbacks.normal_cb = onNormal;
+		callbacks.texcoord_cb = onTexcoord;
+		callbacks.index_cb = onFace;
+		callbacks.usemtl_cb = onUseMaterial;
+		callbacks.mtllib_cb = onMaterialLibrary;
+
+		tinyobj::MaterialFileReader materialReader{ std::filesystem::path{ filepath }.parent_path().string() };
+		std::string warn, err;
+		if (!tinyobj::LoadObjWithCallback(file, callbacks, &state, &materialReader, &warn, &err)) {
+			throw std::runtime_error(warn + err);
+		}
+
+		sortByMaterial(state.triangleMaterials);
+	}
+}
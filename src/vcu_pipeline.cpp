@@ -3,6 +3,7 @@
 
 
 //std
+#include <algorithm>
 #include <fstream>
 #include <stdexcept>
 #include <iostream>
@@ -30,6 +31,10 @@ namespace vcu {
 	}
 
 
+	bool VcuPipeline::shaderExists(const std::string& filepath) {
+		return std::ifstream{ ENGINE_DIR + filepath, std::ios::binary }.is_open();
+	}
+
 	std::vector<char> VcuPipeline::readFile(const std::string& filepath) {
 		std::string fullpath = ENGINE_DIR + filepath;
 		std::ifstream file{ fullpath, std::ios::ate | std::ios::binary };
@@ -65,6 +70,17 @@ namespace vcu {
 		createShaderModule(vertCode, &vertShaderModule);
 		createShaderModule(fragCode, &fragShaderModule);
 
+		VkSpecializationMapEntry specializationEntry{};
+		specializationEntry.constantID = 0;
+		specializationEntry.offset = 0;
+		specializationEntry.size = sizeof(VkBool32);
+
+		VkSpecializationInfo vertSpecializationInfo{};
+		vertSpecializationInfo.mapEntryCount = 1;
+		vertSpecializationInfo.pMapEntries = &specializationEntry;
+		vertSpecializationInfo.dataSize = sizeof(VkBool32);
+		vertSpecializationInfo.pData = &configInfo.packedVertices;
+
 		VkPipelineShaderStageCreateInfo shaderStages[2];
 		shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 		shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
@@ -72,7 +88,7 @@ namespace vcu {
 		shaderStages[0].pName = "main";
 		shaderStages[0].flags = 0;
 		shaderStages[0].pNext = nullptr;
-		shaderStages[0].pSpecializationInfo = nullptr;
+		shaderStages[0].pSpecializationInfo = &vertSpecializationInfo;
 		shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 		shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
 		shaderStages[1].module = fragShaderModule;
@@ -202,8 +218,8 @@ namespace vcu {
 		configInfo.dynamicStateInfo.dynamicStateCount = static_cast<uint32_t>(configInfo.dynamicStateEnables.size());
 		configInfo.dynamicStateInfo.flags = 0;
 
-		configInfo.bindingDescriptions = VcuModel::Vertex::getBindingDescriptions();
-		configInfo.attributeDescriptions = VcuModel::Vertex::getAttributeDescriptions();
+		configInfo.bindingDescriptions = VcuModel::StandardVertexLayout::getBindingDescriptions();
+		configInfo.attributeDescriptions = VcuModel::StandardVertexLayout::getAttributeDescriptions();
 	}
 
 	void VcuPipeline::enableAlphaBlending(PipelineConfigInfo& configInfo) {
@@ -218,4 +234,59 @@ namespace vcu {
 		configInfo.colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;  
 		configInfo.colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;             
 	}
+
+	void VcuPipeline::enablePackedVertices(PipelineConfigInfo& configInfo) {
+		configInfo.packedVertices = VK_TRUE;
+		configInfo.bindingDescriptions = VcuModel::PackedVertexLayout::getBindingDescriptions();
+
+		// keeps the inputs chosen with setVertexInputs
+		std::vector<VkVertexInputAttributeDescription> attributeDescriptions{};
+		for (const auto& packed : VcuModel::PackedVertexLayout::getAttributeDescriptions()) {
+			const bool used = std::any_of(configInfo.attributeDescriptions.begin(), configInfo.attributeDescriptions.end(),
+				[&](const VkVertexInputAttributeDescription& attribute) { return attribute.location == packed.location; });
+			if (used) attributeDescriptions.push_back(packed);
+		}
+		configInfo.attributeDescriptions = attributeDescriptions;
+	}
+
+	void VcuPipeline::enablePositionStream(PipelineConfigInfo& configInfo) {
+		if (configInfo.packedVertices) {
+			configInfo.bindingDescriptions = VcuModel::PackedPositionLayout::getBindingDescriptions();
+			configInfo.attributeDescriptions = VcuModel::PackedPositionLayout::getAttributeDescriptions();
+		}
+		else {
+			configInfo.bindingDescriptions = VcuModel::StandardPositionLayout::getBindingDescriptions();
+			configInfo.attributeDescriptions = VcuModel::StandardPositionLayout::getAttributeDescriptions();
+		}
+	}
+
+	void VcuPipeline::enableVertexPulling(PipelineConfigInfo& configInfo) {
+		configInfo.bindingDescriptions.clear();
+		configInfo.attributeDescriptions.clear();
+		configInfo.packedVertices = VK_FALSE; // the format is picked per draw
+	}
+
+	void VcuPipeline::enableBackfaceCulling(PipelineConfigInfo& configInfo) {
+		configInfo.rasterizationInfo.cullMode = VK_CULL_MODE_BACK_BIT;
+		configInfo.rasterizationInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	}
+
+	VcuPipelineVariants::VcuPipelineVariants(
+		VcuDevice& device,
+		const std::string& vertFilepath,
+		const std::string& fragFilepath,
+		const std::function<void(PipelineConfigInfo&)>& configure) {
+		for (uint32_t variant = 0; variant < pipelines.size(); variant++) {
+			PipelineConfigInfo configInfo{};
+			VcuPipeline::defaultPipelineConfigInfo(configInfo);
+			configure(configInfo);
+			if (variant & 2) {
+				VcuPipeline::enableBackfaceCulling(configInfo);
+			}
+			if (variant & 1) {
+				VcuPipeline::enablePackedVertices(configInfo);
+			}
+			pipelines[variant] = std::make_unique<VcuPipeline>(device, vertFilepath, fragFilepath, configInfo);
+		}
+	}
 }
\ No newline at end of file
@@ -1,8 +1,12 @@
 #pragma once
 
 #include "vcu_device.hpp"
+#include "vcu_model.hpp"
 
 //std
+#include <array>
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -27,6 +31,7 @@ namespace vcu {
 		VkPipelineLayout pipelineLayout = nullptr;
 		VkRenderPass renderPass = nullptr;
 		uint32_t subpass = 0;
+		VkBool32 packedVertices = VK_FALSE; // specialization constant 0 of the vertex shader
 	};
 
 
@@ -47,6 +52,26 @@ namespace vcu {
 
 		 static void defaultPipelineConfigInfo(PipelineConfigInfo& configInfo);
 		 static void enableAlphaBlending(PipelineConfigInfo& configInfo);
+		 static void enablePackedVertices(PipelineConfigInfo& configInfo);
+		 // keeps only the attributes the vertex shader reads, call before enablePackedVertices which
+		 // carries the selection over. Both streams have to provide every input.
+		 template<typename Inputs>
+		 static void setVertexInputs(PipelineConfigInfo& configInfo) {
+			 static_assert(VcuModel::StandardVertexLayout::provides<Inputs>() && VcuModel::PackedVertexLayout::provides<Inputs>(),
+				 "Shader reads a vertex input the model streams do not have");
+			 configInfo.attributeDescriptions = configInfo.packedVertices ?
+				 VcuModel::PackedVertexLayout::getAttributeDescriptions<Inputs>() :
+				 VcuModel::StandardVertexLayout::getAttributeDescriptions<Inputs>();
+		 }
+		 // vertex input of VcuModel::drawPositions for depth only passes, call after enablePackedVertices
+		 // for pipelines that draw packed models
+		 static void enablePositionStream(PipelineConfigInfo& configInfo);
+		 // no vertex input at all, the vertex shader reads the vertices through a buffer device address
+		 static void enableVertexPulling(PipelineConfigInfo& configInfo);
+		 // culls back faces with counter clockwise front faces, only for models where VcuModel::canBackfaceCull is true
+		 static void enableBackfaceCulling(PipelineConfigInfo& configInfo);
+		 // true if the compiled shader is there, for optional shaders that are not always built
+		 static bool shaderExists(const std::string& filepath);
 
 	private:
 		static std::vector<char> readFile(const std::string& filepath);
@@ -63,4 +88,28 @@ namespace vcu {
 		VkShaderModule vertShaderModule;
 		VkShaderModule fragShaderModule;
 	};
+
+	// The same shaders built once per {packed, culled} combination. configure is called on a default
+	// config for every variant and sets what they share (render pass, layout, vertex inputs), the
+	// packed vertex and back face culling state is applied after it.
+	class VcuPipelineVariants {
+	public:
+		VcuPipelineVariants(
+			VcuDevice& device,
+			const std::string& vertFilepath,
+			const std::string& fragFilepath,
+			const std::function<void(PipelineConfigInfo&)>& configure);
+
+		VcuPipelineVariants(const VcuPipelineVariants&) = delete;
+		VcuPipelineVariants& operator=(const VcuPipelineVariants&) = delete;
+
+		VcuPipeline& get(bool packed, bool culled) { return *pipelines[(packed ? 1 : 0) | (culled ? 2 : 0)]; }
+		// the variant for the model's vertex format, culled if its back faces can be under modelMatrix
+		VcuPipeline& select(const VcuModel& model, const glm::mat4& modelMatrix) {
+			return get(model.getVertexFormat() == VcuModel::VertexFormat::Packed, model.canBackfaceCull(modelMatrix));
+		}
+
+	private:
+		std::array<std::unique_ptr<VcuPipeline>, 4> pipelines;
+	};
 }	
\ No newline at end of file
@@ -82,6 +82,12 @@ namespace vcu {
 		if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
 			throw std::runtime_error("failed to begin recording command buffer");
 		}
+		// before the acquire below, the moves are submitted ahead of this frame and may only copy
+		// uploads acquired by frames already submitted
+		vcuDevice.defragmenter().update();
+		// uploads that finished on the transfer queue become usable from this frame on
+		vcuDevice.stagingRing().acquireCompleted(commandBuffer);
+		vcuDevice.updateMemoryBudget();
 		return commandBuffer;
 	}
 	void VcuRenderer::endFrame() {
@@ -0,0 +1,390 @@
+#include "vcu_staging_ring.hpp"
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+namespace vcu {
+
+	VcuStagingRing::VcuStagingRing(VkDevice device, VcuAllocator& allocator, VkCommandPool commandPool, VkQueue queue,
+		uint32_t transferFamily, uint32_t graphicsFamily, uint32_t rowGranularity, VkDeviceSize capacity)
+		: device{ device }, allocator{ allocator }, commandPool{ commandPool }, queue{ queue },
+		transferFamily{ transferFamily }, graphicsFamily{ graphicsFamily }, rowGranularity{ rowGranularity }, capacity{ capacity } {
+		assert(rowGranularity > 0 && "Queues that only copy whole mip levels are not supported");
+		createBuffer();
+	}
+
+	VcuStagingRing::~VcuStagingRing() {
+		waitIdle();
+		for (VkFence fence : freeFences) {
+			vkDestroyFence(device, fence, nullptr);
+		}
+		if (!freeCommandBuffers.empty()) {
+			vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(freeCommandBuffers.size()), freeCommandBuffers.data());
+		}
+		destroyBuffer();
+	}
+
+	void VcuStagingRing::createBuffer() {
+		VkBufferCreateInfo bufferInfo{};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = capacity;
+		bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create staging buffer!");
+		}
+		creatingBuffer = true;
+		try {
+			allocation = allocator.allocateForBuffer(buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				VcuAllocator::MemoryCategory::Staging);
+		}
+		catch (...) {
+			creatingBuffer = false;
+			vkDestroyBuffer(device, buffer, nullptr);
+			buffer = VK_NULL_HANDLE;
+			throw;
+		}
+		creatingBuffer = false;
+		mapped = static_cast<char*>(allocation->mapped);
+	}
+
+	void VcuStagingRing::destroyBuffer() {
+		if (buffer == VK_NULL_HANDLE) return;
+		vkDestroyBuffer(device, buffer, nullptr);
+		allocator.free(allocation);
+		buffer = VK_NULL_HANDLE;
+		allocation = nullptr;
+		mapped = nullptr;
+	}
+
+	bool VcuStagingRing::trim(uint32_t heapIndex) {
+		if (creatingBuffer) return false;
+		std::unique_lock<std::mutex> lock{ mutex, std::try_to_lock };
+		if (!lock.owns_lock() || buffer == VK_NULL_HANDLE || recording || holding) return false;
+		if (allocator.getHeapIndex(allocation->memoryTypeIndex) != heapIndex) return false;
+
+		retire(false);
+		if (!batches.empty()) return false;
+		destroyBuffer();
+		return true;
+	}
+
+	bool VcuStagingRing::tryAcquire(VkDeviceSize size, VkDeviceSize& offset) const {
+		if (batches.empty()) {
+			offset = 0;
+			return size <= capacity;
+		}
+
+		const VkDeviceSize tail = batches.front().begin;
+		const VkDeviceSize head = (batches.back().end + REGION_ALIGNMENT - 1) & ~(REGION_ALIGNMENT - 1);
+		if (batches.back().end > tail) {
+			// used space is [tail, head), free space is behind head and in front of tail
+			if (head + size <= capacity) {
+				offset = head;
+				return true;
+			}
+			if (size <= tail) {
+				offset = 0;
+				return true;
+			}
+			return false;
+		}
+		// wrapped, the only free space is [head, tail)
+		if (head + size <= tail) {
+			offset = head;
+			return true;
+		}
+		return false;
+	}
+
+	VkDeviceSize VcuStagingRing::acquire(VkDeviceSize size) {
+		assert(size <= capacity && "Staging region is bigger than the ring");
+		retire(false);
+		if (buffer == VK_NULL_HANDLE) {
+			createBuffer();
+		}
+
+		VkDeviceSize offset;
+		while (!tryAcquire(size, offset)) {
+			// the batch being recorded holds ring space too, it has to be submitted before waiting
+			if (recording) submitBatch();
+			retire(true);
+		}
+		return offset;
+	}
+
+	VkCommandBuffer VcuStagingRing::beginBatch(VkDeviceSize begin) {
+		Batch batch{ begin, begin, VK_NULL_HANDLE, VK_NULL_HANDLE, ++submittedValue, {}, holding };
+		if (!freeCommandBuffers.empty()) {
+			batch.commandBuffer = freeCommandBuffers.back();
+			freeCommandBuffers.pop_back();
+		}
+		else {
+			VkCommandBufferAllocateInfo allocInfo{};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			allocInfo.commandPool = commandPool;
+			allocInfo.commandBufferCount = 1;
+			if (vkAllocateCommandBuffers(device, &allocInfo, &batch.commandBuffer) != VK_SUCCESS) {
+				throw std::runtime_error("failed to allocate staging command buffer!");
+			}
+		}
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(batch.commandBuffer, &beginInfo);
+
+		batches.push_back(std::move(batch));
+		recording = true;
+		return batches.back().commandBuffer;
+	}
+
+	void VcuStagingRing::submitBatch(VkSemaphore signalSemaphore) {
+		assert(recording && "No staging batch is being recorded");
+		Batch& batch = batches.back();
+
+		if (isDedicated()) {
+			// images move to the graphics family, buffers are shared by both families
+			if (!batch.imageReleases.empty()) {
+				vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+					0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(batch.imageReleases.size()), batch.imageReleases.data());
+			}
+		}
+		else {
+			// later submissions on this queue may read the data as vertices, indices, uniforms or textures
+			VkMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+				VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+			vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+				0, 1, &barrier, 0, nullptr, 0, nullptr);
+		}
+		vkEndCommandBuffer(batch.commandBuffer);
+
+		if (!freeFences.empty()) {
+			batch.fence = freeFences.back();
+			freeFences.pop_back();
+		}
+		else {
+			VkFenceCreateInfo fenceInfo{};
+			fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+			if (vkCreateFence(device, &fenceInfo, nullptr, &batch.fence) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create staging fence!");
+			}
+		}
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &batch.commandBuffer;
+		if (signalSemaphore != VK_NULL_HANDLE) {
+			submitInfo.signalSemaphoreCount = 1;
+			submitInfo.pSignalSemaphores = &signalSemaphore;
+		}
+		if (vkQueueSubmit(queue, 1, &submitInfo, batch.fence) != VK_SUCCESS) {
+			throw std::runtime_error("failed to submit staging copy!");
+		}
+		recording = false;
+
+		// on a single queue the barrier above already orders the copy before everything submitted later
+		if (!isDedicated()) {
+			acquiredValue = batch.value;
+		}
+	}
+
+	void VcuStagingRing::retire(bool wait) {
+		while (!batches.empty() && batches.front().fence != VK_NULL_HANDLE) {
+			Batch& batch = batches.front();
+			if (wait) {
+				vkWaitForFences(device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+				wait = false;
+			}
+			else if (vkGetFenceStatus(device, batch.fence) != VK_SUCCESS) {
+				break;
+			}
+
+			completedValue = batch.value;
+			if (!batch.held) {
+				pendingAcquires.insert(pendingAcquires.end(), batch.imageReleases.begin(), batch.imageReleases.end());
+			}
+			vkResetFences(device, 1, &batch.fence);
+			vkResetCommandBuffer(batch.commandBuffer, 0);
+			freeFences.push_back(batch.fence);
+			freeCommandBuffers.push_back(batch.commandBuffer);
+			batches.pop_front();
+		}
+	}
+
+	void VcuStagingRing::acquireCompleted(VkCommandBuffer commandBuffer) {
+		std::lock_guard<std::mutex> lock{ mutex };
+		if (!isDedicated()) return;
+		retire(false);
+		if (completedValue == acquiredValue) return;
+
+		// The fence already made the copies available, this makes them visible to the graphics
+		// queue and takes over the images released by the transfer queue.
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+			VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		for (auto& acquireBarrier : pendingAcquires) {
+			acquireBarrier.srcAccessMask = 0;
+			acquireBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
+		}
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+			0, 1, &barrier, 0, nullptr, static_cast<uint32_t>(pendingAcquires.size()), pendingAcquires.data());
+
+		pendingAcquires.clear();
+		acquiredValue = completedValue;
+	}
+
+	void VcuStagingRing::waitForValue(uint64_t value) {
+		std::lock_guard<std::mutex> lock{ mutex };
+		while (completedValue < value && !batches.empty()) {
+			if (recording && batches.back().value <= value) submitBatch();
+			retire(true);
+		}
+	}
+
+	void VcuStagingRing::hold() {
+		std::lock_guard<std::mutex> lock{ mutex };
+		assert(!holding && "Staging ring is already held");
+		holding = true;
+		heldUploads = false;
+	}
+
+	bool VcuStagingRing::release(VkSemaphore signalSemaphore) {
+		std::lock_guard<std::mutex> lock{ mutex };
+		assert(holding && "Staging ring is not held");
+		holding = false;
+		if (!heldUploads) return false;
+
+		if (recording) {
+			submitBatch(signalSemaphore);
+		}
+		else if (signalSemaphore != VK_NULL_HANDLE) {
+			// the held uploads were all submitted when the ring ran full, queue order covers them
+			VkSubmitInfo submitInfo{};
+			submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			submitInfo.signalSemaphoreCount = 1;
+			submitInfo.pSignalSemaphores = &signalSemaphore;
+			if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+				throw std::runtime_error("failed to submit staging copy!");
+			}
+		}
+		return true;
+	}
+
+	uint64_t VcuStagingRing::uploadToBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size) {
+		std::lock_guard<std::mutex> lock{ mutex };
+		const char* bytes = static_cast<const char*>(data);
+
+		// half the ring per chunk, so the next chunk can be staged while the previous one is copied
+		const VkDeviceSize chunkSize = capacity / 2;
+		for (VkDeviceSize copied = 0; copied < size; copied += chunkSize) {
+			const VkDeviceSize chunk = std::min(chunkSize, size - copied);
+			const VkDeviceSize offset = acquire(chunk);
+			std::memcpy(mapped + offset, bytes + copied, chunk);
+
+			VkCommandBuffer commandBuffer = recording ? batches.back().commandBuffer : beginBatch(offset);
+			VkBufferCopy region{};
+			region.srcOffset = offset;
+			region.dstOffset = dstOffset + copied;
+			region.size = chunk;
+			vkCmdCopyBuffer(commandBuffer, buffer, dstBuffer, 1, &region);
+			batches.back().end = offset + chunk;
+		}
+		heldUploads |= holding;
+		if (recording && !holding) submitBatch();
+		return submittedValue;
+	}
+
+	uint64_t VcuStagingRing::uploadToImage(VkImage image, const void* data, uint32_t width, uint32_t height, uint32_t texelSize,
+		uint32_t mipLevels) {
+		std::lock_guard<std::mutex> lock{ mutex };
+		const char* bytes = static_cast<const char*>(data);
+
+		// whole rows per chunk, so each chunk is a plain rectangle of the image
+		const VkDeviceSize rowSize = static_cast<VkDeviceSize>(width) * texelSize;
+		if (rowSize > capacity) {
+			throw std::runtime_error("image row does not fit into the staging ring!");
+		}
+		uint32_t chunkRows = static_cast<uint32_t>(std::max<VkDeviceSize>(capacity / 2 / rowSize, 1));
+		// chunks start at multiples of the transfer granularity, only the last one may end in between
+		if (chunkRows < height) {
+			chunkRows = std::max(chunkRows - chunkRows % rowGranularity, rowGranularity);
+			if (rowSize * chunkRows > capacity) {
+				throw std::runtime_error("image rows at the transfer granularity do not fit into the staging ring!");
+			}
+		}
+
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.image = image;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = mipLevels;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+
+		for (uint32_t row = 0; row < height; row += chunkRows) {
+			const uint32_t rows = std::min(chunkRows, height - row);
+			const VkDeviceSize chunk = rowSize * rows;
+			const VkDeviceSize offset = acquire(chunk);
+			std::memcpy(mapped + offset, bytes + rowSize * row, chunk);
+
+			VkCommandBuffer commandBuffer = recording ? batches.back().commandBuffer : beginBatch(offset);
+			if (row == 0) {
+				// the old contents are dropped, so the queue that does the copy can take the image as it is
+				barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+				barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.srcAccessMask = 0;
+				barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+					0, 0, nullptr, 0, nullptr, 1, &barrier);
+			}
+
+			VkBufferImageCopy region{};
+			region.bufferOffset = offset;
+			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.imageSubresource.mipLevel = 0;
+			region.imageSubresource.baseArrayLayer = 0;
+			region.imageSubresource.layerCount = 1;
+			region.imageOffset = { 0, static_cast<int32_t>(row), 0 };
+			region.imageExtent = { width, rows, 1 };
+			vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+			batches.back().end = offset + chunk;
+		}
+
+		if (isDedicated()) {
+			// released by the batch that copied the last rows, acquired by acquireCompleted
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.srcQueueFamilyIndex = transferFamily;
+			barrier.dstQueueFamilyIndex = graphicsFamily;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = 0;
+			batches.back().imageReleases.push_back(barrier);
+		}
+		heldUploads |= holding;
+		if (recording && !holding) submitBatch();
+		return submittedValue;
+	}
+
+	void VcuStagingRing::waitIdle() {
+		std::lock_guard<std::mutex> lock{ mutex };
+		if (recording) submitBatch();
+		while (!batches.empty()) {
+			retire(true);
+		}
+	}
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "vcu_allocator.hpp"
+
+// std
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace vcu {
+	// One persistently mapped host visible buffer that all uploads are staged through. Data is
+	// copied into the next free part of the ring and the copy is submitted with a fence. Regions come
+	// back once their fence has signaled, oldest first, so the ring only blocks when it is full. Data
+	// bigger than the ring is uploaded in chunks.
+	//
+	// With a dedicated transfer queue the copies run next to rendering. Every submission gets the
+	// next upload value, and acquireCompleted makes the uploads that have finished by then visible to
+	// the graphics queue, so a frame never waits for a copy. A resource is ready to draw once
+	// getAcquiredValue has reached the value its upload returned.
+	class VcuStagingRing {
+	public:
+		static constexpr VkDeviceSize DEFAULT_CAPACITY = 32 * 1024 * 1024;
+
+		// image chunks start at multiples of rowGranularity, the minImageTransferGranularity height of the
+		// queue, which has to be at least 1
+		VcuStagingRing(VkDevice device, VcuAllocator& allocator, VkCommandPool commandPool, VkQueue queue,
+			uint32_t transferFamily, uint32_t graphicsFamily, uint32_t rowGranularity, VkDeviceSize capacity = DEFAULT_CAPACITY);
+		~VcuStagingRing();
+
+		VcuStagingRing(const VcuStagingRing&) = delete;
+		VcuStagingRing& operator=(const VcuStagingRing&) = delete;
+
+		// The copies are submitted before these return, without waiting for them. Both return the
+		// upload value of the last submission the data went into.
+		uint64_t uploadToBuffer(VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size);
+		// Tightly packed rows of the first mip level. All mip levels are moved to TRANSFER_DST_OPTIMAL
+		// first and stay in it, owned by the graphics queue once acquired.
+		uint64_t uploadToImage(VkImage image, const void* data, uint32_t width, uint32_t height, uint32_t texelSize,
+			uint32_t mipLevels);
+
+		// Records the queue family acquire of every finished upload into a graphics command buffer,
+		// call at its start. Uploads still running are left for a later call.
+		void acquireCompleted(VkCommandBuffer commandBuffer);
+		uint64_t getAcquiredValue() const { return acquiredValue; }
+		// blocks until the upload with value has finished on the transfer queue
+		void waitForValue(uint64_t value);
+
+		// Between hold and release the uploads are collected into one submission, which is only split
+		// when the ring runs full. release submits it and signals signalSemaphore, if set, once all of it
+		// has finished. The holder acquires the images of held uploads itself, see VcuUploadBatch.
+		// Returns false if nothing was uploaded, the semaphore is not signaled then.
+		void hold();
+		bool release(VkSemaphore signalSemaphore);
+		// waits for every upload still in flight
+		void waitIdle();
+
+		// Frees the ring's memory if it is on heapIndex and no upload is in flight, the next upload
+		// allocates it again. Returns false without waiting if the ring is in use. Registered as a
+		// budget callback by VcuDevice.
+		bool trim(uint32_t heapIndex);
+
+		VkDeviceSize getCapacity() const { return capacity; }
+
+	private:
+		static constexpr VkDeviceSize REGION_ALIGNMENT = 16;
+
+		// one submission, its staging data starts at begin and ends right before end (possibly wrapped)
+		struct Batch {
+			VkDeviceSize begin;
+			VkDeviceSize end;
+			VkCommandBuffer commandBuffer;
+			VkFence fence;
+			uint64_t value;
+			std::vector<VkImageMemoryBarrier> imageReleases; // matched by an acquire on the graphics queue
+			bool held; // recorded between hold and release
+		};
+
+		bool isDedicated() const { return transferFamily != graphicsFamily; }
+		void createBuffer();
+		void destroyBuffer();
+		// returns the offset of size free bytes, waiting for older batches if the ring is full
+		VkDeviceSize acquire(VkDeviceSize size);
+		bool tryAcquire(VkDeviceSize size, VkDeviceSize& offset) const;
+		VkCommandBuffer beginBatch(VkDeviceSize begin);
+		void submitBatch(VkSemaphore signalSemaphore = VK_NULL_HANDLE);
+		// pops finished batches off the front, blocking on the oldest one if wait is set
+		void retire(bool wait);
+
+		VkDevice device;
+		VcuAllocator& allocator;
+		VkCommandPool commandPool;
+		VkQueue queue;
+		uint32_t transferFamily;
+		uint32_t graphicsFamily;
+		uint32_t rowGranularity;
+
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VcuAllocator::Allocation* allocation = nullptr;
+		char* mapped = nullptr;
+		VkDeviceSize capacity;
+		// set while createBuffer allocates with the lock held, a budget callback on this thread must not lock again
+		std::atomic<bool> creatingBuffer{ false };
+
+		std::deque<Batch> batches; // in submission order, the last one may still be recording
+		bool recording = false;
+		bool holding = false;
+		bool heldUploads = false; // since hold
+		std::vector<VkCommandBuffer> freeCommandBuffers;
+		std::vector<VkFence> freeFences;
+
+		uint64_t submittedValue = 0;
+		uint64_t completedValue = 0;
+		std::atomic<uint64_t> acquiredValue{ 0 };
+		std::vector<VkImageMemoryBarrier> pendingAcquires; // of finished batches
+		std::mutex mutex;
+	};
+}
@@ -45,7 +45,7 @@ namespace vcu {
         for (int i = 0; i < depthImages.size(); i++) {
             vkDestroyImageView(device.device(), depthImageViews[i], nullptr);
             vkDestroyImage(device.device(), depthImages[i], nullptr);
-            vkFreeMemory(device.device(), depthImageMemorys[i], nullptr);
+            device.allocator().free(depthImageAllocations[i]);
         }
 
         for (auto framebuffer : swapChainFramebuffers) {
@@ -301,7 +301,7 @@ namespace vcu {
         VkExtent2D swapChainExtent = getSwapChainExtent();
 
         depthImages.resize(imageCount());
-        depthImageMemorys.resize(imageCount());
+        depthImageAllocations.resize(imageCount());
         depthImageViews.resize(imageCount());
 
         for (int i = 0; i < depthImages.size(); i++) {
@@ -325,7 +325,7 @@ namespace vcu {
                 imageInfo,
                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
                 depthImages[i],
-                depthImageMemorys[i]);
+                depthImageAllocations[i]);
 
             VkImageViewCreateInfo viewInfo{};
             viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
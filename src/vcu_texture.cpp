@@ -5,11 +5,23 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #include "vcu_buffer.hpp"
+#include <algorithm>
 #include <cmath>
+#include <vector>
 #include <stdexcept>
 
 namespace vcu {
     Texture::Texture(VcuDevice& device, const std::string& filepath) : vcuDevice{ device } {
+        VcuUploadBatch uploads{ device };
+        createTexture(filepath, uploads);
+        uploads.submit();
+    }
+
+    Texture::Texture(VcuDevice& device, const std::string& filepath, VcuUploadBatch& uploads) : vcuDevice{ device } {
+        createTexture(filepath, uploads);
+    }
+
+    void Texture::createTexture(const std::string& filepath, VcuUploadBatch& uploads) {
         int channels;
         int m_BytesPerPixel;
 
@@ -17,40 +29,13 @@ namespace vcu {
 
         mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
 
-        VcuBuffer stagingBuffer{
-                vcuDevice,
-                4,
-                static_cast<uint32_t>(width * height),
-                VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-        };
-
-        stagingBuffer.map();
-        stagingBuffer.writeToBuffer(data);
-
         imageFormat = VK_FORMAT_R8G8B8A8_SRGB;
 
-        VkImageCreateInfo imageInfo = {};
-        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-        imageInfo.imageType = VK_IMAGE_TYPE_2D;
-        imageInfo.format = imageFormat;
-        imageInfo.mipLevels = mipLevels;
-        imageInfo.arrayLayers = 1;
-        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        imageInfo.extent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height), 1 };
-        imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-
+        VkImageCreateInfo imageInfo = getImageCreateInfo();
+        vcuDevice.createImageWithInfo(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageAllocation);
 
-        vcuDevice.createImageWithInfo(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageMemory);
-
-        transitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-        vcuDevice.copyBufferToImage(stagingBuffer.getBuffer(), image, static_cast<uint32_t>(width), static_cast<uint32_t>(height), 1);
-
-        generateMipmaps();
+        uploads.copyImage(image, data, static_cast<uint32_t>(width), static_cast<uint32_t>(height), 4, mipLevels);
+        generateMipmaps(uploads.commandBuffer());
         imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
         VkSamplerCreateInfo samplerInfo{};
@@ -71,73 +56,128 @@ namespace vcu {
 
         vkCreateSampler(vcuDevice.device(), &samplerInfo, nullptr, &sampler);
 
-        VkImageViewCreateInfo imageViewInfo{};
-        imageViewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-        imageViewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-        imageViewInfo.format = imageFormat;
-        imageViewInfo.components = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A };
-        imageViewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        imageViewInfo.subresourceRange.baseMipLevel = 0;
-        imageViewInfo.subresourceRange.baseArrayLayer = 0;
-        imageViewInfo.subresourceRange.layerCount = 1;
-        imageViewInfo.subresourceRange.levelCount = mipLevels;
-        imageViewInfo.image = image;
-
-        vkCreateImageView(vcuDevice.device(), &imageViewInfo, nullptr, &imageView);
+        imageView = createImageView(image);
+        registerMoves();
 
         stbi_image_free(data);
     }
 
     Texture::~Texture() {
+        vcuDevice.defragmenter().unregisterAllocation(imageAllocation);
         vkDestroyImage(vcuDevice.device(), image, nullptr);
-        vkFreeMemory(vcuDevice.device(), imageMemory, nullptr);
+        vcuDevice.allocator().free(imageAllocation);
         vkDestroyImageView(vcuDevice.device(), imageView, nullptr);
         vkDestroySampler(vcuDevice.device(), sampler, nullptr);
     }
 
-    void Texture::transitionImageLayout(VkImageLayout oldLayout, VkImageLayout newLayout) {
-        VkCommandBuffer commandBuffer = vcuDevice.beginSingleTimeCommands();
-
-        VkImageMemoryBarrier barrier{};
-        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        barrier.oldLayout = oldLayout;
-        barrier.newLayout = newLayout;
-        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.image = image;
-        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        barrier.subresourceRange.baseMipLevel = 0;
-        barrier.subresourceRange.levelCount = mipLevels;
-        barrier.subresourceRange.baseArrayLayer = 0;
-        barrier.subresourceRange.layerCount = 1;
-
-        VkPipelineStageFlags sourceStage;
-        VkPipelineStageFlags destinationStage;
-
-        if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-            barrier.srcAccessMask = 0;
-            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    VkImageCreateInfo Texture::getImageCreateInfo() const {
+        VkImageCreateInfo imageInfo = {};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = imageFormat;
+        imageInfo.mipLevels = mipLevels;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageInfo.extent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height), 1 };
+        imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        return imageInfo;
+    }
 
-            sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-            destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        }
-        else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    VkImageView Texture::createImageView(VkImage image) {
+        VkImageViewCreateInfo imageViewInfo{};
+        imageViewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        imageViewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        imageViewInfo.format = imageFormat;
+        imageViewInfo.components = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A };
+        imageViewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        imageViewInfo.subresourceRange.baseMipLevel = 0;
+        imageViewInfo.subresourceRange.baseArrayLayer = 0;
+        imageViewInfo.subresourceRange.layerCount = 1;
+        imageViewInfo.subresourceRange.levelCount = mipLevels;
+        imageViewInfo.image = image;
 
-            sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-            destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        VkImageView view;
+        if (vkCreateImageView(vcuDevice.device(), &imageViewInfo, nullptr, &view) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create texture image view!");
         }
-        else {
-            throw std::runtime_error("unsupported layout transition!");
-        }
-
-        vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        return view;
+    }
 
-        vcuDevice.endSingleTimeCommands(commandBuffer);
+    void Texture::registerMoves() {
+        VcuDefragmenter::Handler handler;
+        handler.recordMove = [this](VkCommandBuffer commandBuffer, VkDeviceMemory memory, VkDeviceSize offset) {
+            VkImageCreateInfo imageInfo = getImageCreateInfo();
+            if (vkCreateImage(vcuDevice.device(), &imageInfo, nullptr, &movedImage) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create image!");
+            }
+            vkBindImageMemory(vcuDevice.device(), movedImage, memory, offset);
+
+            VkImageMemoryBarrier barriers[2]{};
+            for (auto& barrier : barriers) {
+                barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+                barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, static_cast<uint32_t>(mipLevels), 0, 1 };
+            }
+            barriers[0].image = image;
+            barriers[0].oldLayout = imageLayout;
+            barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            barriers[0].srcAccessMask = 0;
+            barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            barriers[1].image = movedImage;
+            barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barriers[1].srcAccessMask = 0;
+            barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            // frames submitted before still sample the old image, their reads finish before the layout changes
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                0, 0, nullptr, 0, nullptr, 2, barriers);
+
+            std::vector<VkImageCopy> regions(mipLevels);
+            for (uint32_t i = 0; i < static_cast<uint32_t>(mipLevels); i++) {
+                VkImageCopy& region = regions[i];
+                region = {};
+                region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, i, 0, 1 };
+                region.dstSubresource = region.srcSubresource;
+                region.extent = {
+                    std::max(1u, static_cast<uint32_t>(width) >> i),
+                    std::max(1u, static_cast<uint32_t>(height) >> i),
+                    1 };
+            }
+            vkCmdCopyImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, movedImage,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+
+            barriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            barriers[0].newLayout = imageLayout;
+            barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barriers[1].newLayout = imageLayout;
+            barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                0, 0, nullptr, 0, nullptr, 2, barriers);
+        };
+        handler.finishMove = [this]() {
+            VkImageView movedView = createImageView(movedImage);
+            VkDevice device = vcuDevice.device();
+            VkImage oldImage = image;
+            VkImageView oldView = imageView;
+            vcuDevice.defragmenter().destroyLater([device, oldImage, oldView]() {
+                vkDestroyImageView(device, oldView, nullptr);
+                vkDestroyImage(device, oldImage, nullptr);
+            });
+            image = movedImage;
+            imageView = movedView;
+            movedImage = VK_NULL_HANDLE;
+        };
+        vcuDevice.defragmenter().registerAllocation(imageAllocation, std::move(handler));
     }
 
-    void Texture::generateMipmaps() {
+    void Texture::generateMipmaps(VkCommandBuffer commandBuffer) {
         VkFormatProperties formatProperties;
         vkGetPhysicalDeviceFormatProperties(vcuDevice.getPhysicalDevice(), imageFormat, &formatProperties);
 
@@ -145,8 +185,6 @@ namespace vcu {
             throw std::runtime_error("texture image format does not support linear blitting!");
         }
 
-        VkCommandBuffer commandBuffer = vcuDevice.beginSingleTimeCommands();
-
         VkImageMemoryBarrier barrier{};
         barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
         barrier.image = image;
@@ -203,7 +241,5 @@ namespace vcu {
         barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
         vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-        vcuDevice.endSingleTimeCommands(commandBuffer);
     }
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "vcu_device.hpp"
+#include "vcu_upload_batch.hpp"
 #include <string.h>
 #include <vulkan/vulkan_core.h>
 
@@ -8,6 +9,8 @@ namespace vcu {
     class Texture {
     public:
         Texture(VcuDevice& device, const std::string& filepath);
+        // records the upload and the mipmaps into uploads, the texture can be used once it is submitted
+        Texture(VcuDevice& device, const std::string& filepath, VcuUploadBatch& uploads);
         ~Texture();
 
         Texture(const Texture&) = delete;
@@ -19,15 +22,20 @@ namespace vcu {
         VkImageView getImageView() { return imageView; }
         VkImageLayout getImageLayout() { return imageLayout; }
     private:
-        void transitionImageLayout(VkImageLayout oldLayout, VkImageLayout newLayout);
-        void generateMipmaps();
+        void createTexture(const std::string& filepath, VcuUploadBatch& uploads);
+        void generateMipmaps(VkCommandBuffer commandBuffer);
+        VkImageCreateInfo getImageCreateInfo() const;
+        VkImageView createImageView(VkImage image);
+        // lets the defragmenter move the image, the view is created again for the moved image
+        void registerMoves();
 
         int width, height, mipLevels;
 
         VcuDevice& vcuDevice;
         VkImage image;
-        VkDeviceMemory imageMemory;
+        VcuAllocator::Allocation* imageAllocation;
         VkImageView imageView;
+        VkImage movedImage = VK_NULL_HANDLE; // copy target of a move in flight
         VkSampler sampler;
         VkFormat imageFormat;
         VkImageLayout imageLayout;
@@ -0,0 +1,46 @@
+#include "vcu_thread_pool.hpp"
+
+// std
+#include <algorithm>
+
+namespace vcu {
+
+	VcuThreadPool::VcuThreadPool(uint32_t threadCount) {
+		threadCount = std::max(threadCount, 1u);
+		workers.reserve(threadCount);
+		for (uint32_t i = 0; i < threadCount; i++) {
+			workers.emplace_back([this]() { workerLoop(); });
+		}
+	}
+
+	VcuThreadPool::~VcuThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock{ mutex };
+			stopping = true;
+		}
+		condition.notify_all();
+		for (auto& worker : workers) {
+			worker.join();
+		}
+	}
+
+	VcuThreadPool& VcuThreadPool::shared() {
+		static VcuThreadPool pool{ std::max(std::thread::hardware_concurrency(), 2u) - 1 };
+		return pool;
+	}
+
+	void VcuThreadPool::workerLoop() {
+		while (true) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock{ mutex };
+				condition.wait(lock, [this]() { return stopping || !jobs.empty(); });
+				if (stopping && jobs.empty()) return;
+
+				job = std::move(jobs.front());
+				jobs.pop();
+			}
+			job();
+		}
+	}
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+// std
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace vcu {
+	class VcuThreadPool {
+	public:
+		explicit VcuThreadPool(uint32_t threadCount);
+		~VcuThreadPool();
+
+		VcuThreadPool(const VcuThreadPool&) = delete;
+		VcuThreadPool& operator=(const VcuThreadPool&) = delete;
+
+		// pool shared by background jobs such as async model loading, one thread less than the core count
+		static VcuThreadPool& shared();
+
+		uint32_t getThreadCount() const { return static_cast<uint32_t>(workers.size()); }
+
+		// runs job on a worker, exceptions thrown by the job are rethrown by future::get
+		template<typename F>
+		std::future<std::invoke_result_t<F>> submit(F&& job) {
+			using Result = std::invoke_result_t<F>;
+			auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(job));
+			std::future<Result> result = task->get_future();
+			{
+				std::lock_guard<std::mutex> lock{ mutex };
+				jobs.emplace([task]() { (*task)(); });
+			}
+			condition.notify_one();
+			return result;
+		}
+
+		// Calls body(begin, end) over [0, count) in chunks of grainSize and returns once all chunks are
+		// done. The calling thread works on chunks as well, so this is safe to use from inside a job.
+		template<typename F>
+		void parallelFor(size_t count, size_t grainSize, F&& body) {
+			const size_t chunkCount = (count + grainSize - 1) / grainSize;
+			if (chunkCount <= 1 || workers.empty()) {
+				if (count > 0) body(size_t{ 0 }, count);
+				return;
+			}
+
+			struct Progress {
+				std::atomic<size_t> next{ 0 };
+				std::atomic<size_t> finished{ 0 };
+				std::mutex mutex;
+				std::condition_variable done;
+				std::exception_ptr error;
+			};
+			auto progress = std::make_shared<Progress>();
+
+			// helpers that start after every chunk is taken return without touching body
+			auto runChunks = [progress, chunkCount, count, grainSize, &body]() {
+				size_t chunk;
+				while ((chunk = progress->next.fetch_add(1)) < chunkCount) {
+					try {
+						body(chunk * grainSize, std::min(count, (chunk + 1) * grainSize));
+					}
+					catch (...) {
+						std::lock_guard<std::mutex> lock{ progress->mutex };
+						if (!progress->error) progress->error = std::current_exception();
+					}
+					if (progress->finished.fetch_add(1) + 1 == chunkCount) {
+						std::lock_guard<std::mutex> lock{ progress->mutex };
+						progress->done.notify_all();
+					}
+				}
+			};
+
+			const size_t helpers = std::min(workers.size(), chunkCount - 1);
+			{
+				std::lock_guard<std::mutex> lock{ mutex };
+				for (size_t i = 0; i < helpers; i++) {
+					jobs.emplace(runChunks);
+				}
+			}
+			condition.notify_all();
+
+			runChunks();
+			std::unique_lock<std::mutex> lock{ progress->mutex };
+			progress->done.wait(lock, [&]() { return progress->finished.load() == chunkCount; });
+			if (progress->error) std::rethrow_exception(progress->error);
+		}
+
+	private:
+		void workerLoop();
+
+		std::vector<std::thread> workers;
+		std::queue<std::function<void()>> jobs;
+		std::mutex mutex;
+		std::condition_variable condition;
+		bool stopping = false;
+	};
+}
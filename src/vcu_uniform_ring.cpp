@@ -0,0 +1,52 @@
+#include "vcu_uniform_ring.hpp"
+
+#include "vcu_swap_chain.hpp"
+
+// std
+#include <algorithm>
+#include <stdexcept>
+
+namespace vcu {
+	namespace {
+		VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+			return (value + alignment - 1) / alignment * alignment;
+		}
+	}
+
+	VcuUniformRing::VcuUniformRing(VcuDevice& device, VkDeviceSize frameCapacity)
+		: alignment{ std::max<VkDeviceSize>(device.properties.limits.minUniformBufferOffsetAlignment, 16) } {
+		this->frameCapacity = alignUp(frameCapacity, alignment);
+		VkBufferUsageFlags usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+		if (device.hasBufferDeviceAddress()) {
+			usage |= VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR;
+		}
+		buffer = std::make_unique<VcuBuffer>(
+			device,
+			this->frameCapacity,
+			VcuSwapChain::MAX_FRAMES_IN_FLIGHT,
+			usage,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		if (buffer->map() != VK_SUCCESS) {
+			throw std::runtime_error("failed to map uniform ring!");
+		}
+	}
+
+	void VcuUniformRing::beginFrame(int frameIndex) {
+		frameBegin = frameCapacity * static_cast<VkDeviceSize>(frameIndex);
+		head = frameBegin;
+	}
+
+	uint32_t VcuUniformRing::push(const void* data, VkDeviceSize size) {
+		if (head + size > frameBegin + frameCapacity) {
+			throw std::runtime_error("uniform ring frame capacity exceeded!");
+		}
+		const VkDeviceSize offset = head;
+		buffer->writeToBuffer(const_cast<void*>(data), size, offset);
+		head = alignUp(head + size, alignment);
+		return static_cast<uint32_t>(offset);
+	}
+
+	VkDescriptorBufferInfo VcuUniformRing::descriptorInfo(VkDeviceSize range) const {
+		return VkDescriptorBufferInfo{ buffer->getBuffer(), 0, range };
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "vcu_buffer.hpp"
+
+// std
+#include <memory>
+
+namespace vcu {
+	// One persistently mapped uniform buffer split into a slice per frame in flight. Uniform data of a
+	// frame is pushed into its slice with a bump pointer and bound through a UNIFORM_BUFFER_DYNAMIC
+	// descriptor with the offset push returned, so one buffer and one descriptor set serve every
+	// frame and pass. The memory is host coherent, nothing has to be flushed.
+	class VcuUniformRing {
+	public:
+		static constexpr VkDeviceSize DEFAULT_FRAME_CAPACITY = 64 * 1024;
+
+		explicit VcuUniformRing(VcuDevice& device, VkDeviceSize frameCapacity = DEFAULT_FRAME_CAPACITY);
+
+		VcuUniformRing(const VcuUniformRing&) = delete;
+		VcuUniformRing& operator=(const VcuUniformRing&) = delete;
+
+		// starts over at the slice of frameIndex, the fence of the frame must have been waited on
+		void beginFrame(int frameIndex);
+		// copies data into the current slice and returns its dynamic offset, throws if the slice is full
+		uint32_t push(const void* data, VkDeviceSize size);
+		template <typename T>
+		uint32_t push(const T& data) { return push(&data, sizeof(T)); }
+
+		// range is the size of the struct the shader reads at each dynamic offset
+		VkDescriptorBufferInfo descriptorInfo(VkDeviceSize range) const;
+		// address of the data at a pushed offset, only with VcuDevice::hasBufferDeviceAddress
+		VkDeviceAddress getDeviceAddress(uint32_t offset) { return buffer->getDeviceAddress() + offset; }
+		VkDeviceSize getFrameCapacity() const { return frameCapacity; }
+
+	private:
+		std::unique_ptr<VcuBuffer> buffer;
+		VkDeviceSize alignment; // minUniformBufferOffsetAlignment, at least 16 for buffer references
+		VkDeviceSize frameCapacity;
+		VkDeviceSize frameBegin = 0;
+		VkDeviceSize head = 0; // next free byte of the current slice
+	};
+}
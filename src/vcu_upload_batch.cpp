@@ -0,0 +1,70 @@
+#include "vcu_upload_batch.hpp"
+
+// std
+#include <stdexcept>
+
+namespace vcu {
+	VcuUploadBatch::VcuUploadBatch(VcuDevice& device) : vcuDevice{ device } {
+		vcuDevice.stagingRing().hold();
+	}
+
+	VcuUploadBatch::~VcuUploadBatch() {
+		submit();
+		if (copiesDone != VK_NULL_HANDLE) {
+			vkDestroySemaphore(vcuDevice.device(), copiesDone, nullptr);
+		}
+	}
+
+	uint64_t VcuUploadBatch::copyBuffer(VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size) {
+		return vcuDevice.stagingRing().uploadToBuffer(buffer, offset, data, size);
+	}
+
+	void VcuUploadBatch::copyImage(VkImage image, const void* data, uint32_t width, uint32_t height, uint32_t texelSize, uint32_t mipLevels) {
+		vcuDevice.stagingRing().uploadToImage(image, data, width, height, texelSize, mipLevels);
+		if (!vcuDevice.hasDedicatedTransferQueue()) return;
+
+		// takes over the image the ring released on the transfer queue, the semaphore orders it after the copy
+		const QueueFamilyIndices& families = vcuDevice.queueFamilyIndices();
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcQueueFamilyIndex = families.transferFamily;
+		barrier.dstQueueFamilyIndex = families.graphicsFamily;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.image = image;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = mipLevels;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		vkCmdPipelineBarrier(commandBuffer(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+
+	VkCommandBuffer VcuUploadBatch::commandBuffer() {
+		if (graphicsCommands != VK_NULL_HANDLE) return graphicsCommands;
+
+		graphicsCommands = vcuDevice.beginSingleTimeCommands();
+		if (vcuDevice.hasDedicatedTransferQueue()) {
+			VkSemaphoreCreateInfo semaphoreInfo{};
+			semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+			if (vkCreateSemaphore(vcuDevice.device(), &semaphoreInfo, nullptr, &copiesDone) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create upload semaphore!");
+			}
+		}
+		return graphicsCommands;
+	}
+
+	void VcuUploadBatch::submit() {
+		if (submitted) return;
+		submitted = true;
+
+		// on a single queue the copies are submitted first and ordered by the ring's barrier
+		const bool copied = vcuDevice.stagingRing().release(copiesDone);
+		if (graphicsCommands != VK_NULL_HANDLE) {
+			vcuDevice.endSingleTimeCommands(graphicsCommands, copied ? copiesDone : VK_NULL_HANDLE);
+		}
+	}
+}
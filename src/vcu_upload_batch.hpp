@@ -0,0 +1,38 @@
+#pragma once
+
+#include "vcu_device.hpp"
+
+namespace vcu {
+	// Collects the uploads of many resources into one staging submission and the work that has to
+	// run on the graphics queue afterwards (layout transitions, mipmap blits) into one command
+	// buffer. submit sends both with a single fence wait instead of one queue round trip per step.
+	// Everything uploaded through the staging ring while a batch is open joins it, including the
+	// geometry pool uploads of new models. Only one batch can be open at a time.
+	class VcuUploadBatch {
+	public:
+		explicit VcuUploadBatch(VcuDevice& device);
+		// submits if submit has not been called
+		~VcuUploadBatch();
+
+		VcuUploadBatch(const VcuUploadBatch&) = delete;
+		VcuUploadBatch& operator=(const VcuUploadBatch&) = delete;
+
+		// returns the upload value, see VcuStagingRing::getAcquiredValue
+		uint64_t copyBuffer(VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size);
+		// The image starts out undefined and is in TRANSFER_DST_OPTIMAL for all mip levels when the
+		// commands recorded after this call run.
+		void copyImage(VkImage image, const void* data, uint32_t width, uint32_t height, uint32_t texelSize, uint32_t mipLevels);
+
+		// graphics queue commands, they run after every copy of the batch has finished
+		VkCommandBuffer commandBuffer();
+
+		// submits the copies and, if anything was recorded, the graphics commands and waits for them
+		void submit();
+
+	private:
+		VcuDevice& vcuDevice;
+		VkCommandBuffer graphicsCommands = VK_NULL_HANDLE;
+		VkSemaphore copiesDone = VK_NULL_HANDLE; // only used with a dedicated transfer queue
+		bool submitted = false;
+	};
+}
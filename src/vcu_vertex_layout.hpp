@@ -0,0 +1,112 @@
+#pragma once
+
+// libs
+#include <vulkan/vulkan.h>
+
+// std
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace vcu {
+	// one attribute of a vertex stream: the shader input location, the type stored per vertex and
+	// the format the input assembler reads it as
+	template<uint32_t Location, typename T, VkFormat Format>
+	struct VertexAttribute {
+		static constexpr uint32_t location = Location;
+		using type = T;
+		static constexpr VkFormat format = Format;
+	};
+
+	// the locations a vertex shader reads, kept next to the pipeline that uses the shader and
+	// matching its layout(location = n) in declarations
+	template<uint32_t... Locations>
+	struct VertexInputs {
+		static constexpr std::array<uint32_t, sizeof...(Locations)> locations{ { Locations... } };
+	};
+
+	// Interleaved vertex made of Attributes in order without padding. Binding and attribute
+	// descriptions are built at compile time, and a pipeline can ask for the subset its shader reads
+	// so a stream with more attributes still feeds it. Asking for a location the stream does not
+	// have fails to compile.
+	template<typename... Attributes>
+	struct VertexLayout {
+		static constexpr size_t attributeCount = sizeof...(Attributes);
+		static constexpr std::array<uint32_t, attributeCount> locations{ { Attributes::location... } };
+		static constexpr std::array<VkFormat, attributeCount> formats{ { Attributes::format... } };
+		static constexpr std::array<uint32_t, attributeCount> sizes{ { static_cast<uint32_t>(sizeof(typename Attributes::type))... } };
+		static constexpr uint32_t stride = (0u + ... + static_cast<uint32_t>(sizeof(typename Attributes::type)));
+
+		using AllInputs = VertexInputs<Attributes::location...>;
+
+		static constexpr bool hasLocation(uint32_t location) {
+			for (size_t i = 0; i < attributeCount; i++) {
+				if (locations[i] == location) return true;
+			}
+			return false;
+		}
+
+		template<typename Inputs>
+		static constexpr bool provides() {
+			for (size_t i = 0; i < Inputs::locations.size(); i++) {
+				if (!hasLocation(Inputs::locations[i])) return false;
+			}
+			return true;
+		}
+
+		static constexpr uint32_t offsetOf(uint32_t location) {
+			uint32_t offset = 0;
+			for (size_t i = 0; i < attributeCount; i++) {
+				if (locations[i] == location) return offset;
+				offset += sizes[i];
+			}
+			return stride;
+		}
+
+		static constexpr VkFormat formatOf(uint32_t location) {
+			for (size_t i = 0; i < attributeCount; i++) {
+				if (locations[i] == location) return formats[i];
+			}
+			return VK_FORMAT_UNDEFINED;
+		}
+
+		static constexpr bool uniqueLocations() {
+			for (size_t i = 0; i < attributeCount; i++) {
+				for (size_t j = i + 1; j < attributeCount; j++) {
+					if (locations[i] == locations[j]) return false;
+				}
+			}
+			return true;
+		}
+
+		template<typename Inputs = AllInputs>
+		static constexpr std::array<VkVertexInputAttributeDescription, Inputs::locations.size()> attributeDescriptions(uint32_t binding = 0) {
+			static_assert(uniqueLocations(), "Vertex layout uses a location twice");
+			static_assert(provides<Inputs>(), "Vertex layout is missing an input of the shader");
+			std::array<VkVertexInputAttributeDescription, Inputs::locations.size()> descriptions{};
+			for (size_t i = 0; i < Inputs::locations.size(); i++) {
+				const uint32_t location = Inputs::locations[i];
+				descriptions[i] = { location, binding, formatOf(location), offsetOf(location) };
+			}
+			return descriptions;
+		}
+
+		static std::vector<VkVertexInputBindingDescription> getBindingDescriptions() {
+			return { { 0, stride, VK_VERTEX_INPUT_RATE_VERTEX } };
+		}
+
+		template<typename Inputs = AllInputs>
+		static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions() {
+			constexpr auto descriptions = attributeDescriptions<Inputs>();
+			return { descriptions.begin(), descriptions.end() };
+		}
+
+		// writes one vertex, values are given in attribute order
+		static void write(void* out, const typename Attributes::type&... values) {
+			char* bytes = static_cast<char*>(out);
+			uint32_t offset = 0;
+			((std::memcpy(bytes + offset, &values, sizeof(values)), offset += static_cast<uint32_t>(sizeof(values))), ...);
+		}
+	};
+}